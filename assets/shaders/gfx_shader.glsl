@@ -192,18 +192,22 @@ void main() {
 
     for (int i = 0; i < 256; i += 2) {
 
-        vec4 fst_attr = texture(sprites, vec2(float(i) / 255.5, 0.5));
-        vec4 snd_attr = texture(sprites, vec2(float(i + 1) / 255.5, 0.5));
-
-        vec2 sprite_pos   = fst_attr.xy - vec2(TILE_WIDTH, TILE_HEIGHT);
-        int tile_number   = int(fst_attr.z);
-        int palette_msk   = int(fst_attr.w);
-        float f_behind_fg = snd_attr.x;
-        float f_flip_y    = snd_attr.y;
-        float f_flip_x    = snd_attr.z;
-        float f_height_32 = snd_attr.w;
-
-        float sprite_height = (f_height_32 > 0.5) ? 32.0 : 16.0;
+        /* Each sprite is stored as raw bytes in two RGBA8 pixels, as organized in the hardware */
+        ivec4 fst_attr = ivec4(texelFetch(sprites, ivec2(i, 0), 0) * 255.0 + 0.5);
+        ivec4 snd_attr = ivec4(texelFetch(sprites, ivec2(i + 1, 0), 0) * 255.0 + 0.5);
+
+        int sprite_y      = fst_attr.r | (fst_attr.g << 8);
+        int sprite_x      = fst_attr.b | (fst_attr.a << 8);
+        int flags         = snd_attr.g;
+        vec2 sprite_pos   = vec2(sprite_x, sprite_y) - vec2(TILE_WIDTH, TILE_HEIGHT);
+        int tile_number   = snd_attr.r | ((flags & 1) << 8);
+        int palette_msk   = flags & 0xf0;
+        bool f_behind_fg  = (flags & 2) != 0;
+        bool f_flip_y     = (flags & 4) != 0;
+        bool f_flip_x     = (flags & 8) != 0;
+        bool f_height_32  = (snd_attr.b & 2) != 0;
+
+        float sprite_height = f_height_32 ? 32.0 : 16.0;
         /* Ignore the palette in 8-bit mode */
         if (!color_4bit) {
             palette_msk = 0;
@@ -216,14 +220,14 @@ void main() {
             fcoord.y <  sprite_pos.y + sprite_height &&
             /* Check if we have to show the layer1 instead:
              * If the layers_color variable comes from layer1, the `a` field is not 0 */
-            (f_behind_fg < 0.1 || layers_color.a < 0.5)
+            (!f_behind_fg || layers_color.a < 0.5)
             )
         {
             vec2 pix_pos = fcoord - sprite_pos;
-            if (f_flip_y > 0.5) {
+            if (f_flip_y) {
                 pix_pos.y = sprite_height - 1.0 - pix_pos.y;
             }
-            if (f_flip_x > 0.5) {
+            if (f_flip_x) {
                 pix_pos.x = float(TILE_WIDTH) - 1.0 - pix_pos.x;
             }
             /* Get the address of the pixel to show within the 16x16 tile. Get it in one dimension */
@@ -15,12 +15,16 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifndef _WIN32
+    #include <sys/mman.h>
+#endif
 #include <errno.h>
 #include <fcntl.h>
 
 #include "hw/compactflash.h"
 #include "utils/paths.h"
 #include "utils/log.h"
+#include "utils/helpers.h"
 
 static uint8_t compactflash_read_data(compactflash_t* cf);
 static void compactflash_write_data(compactflash_t* cf, uint8_t value);
@@ -32,9 +36,37 @@ static uint16_t le16(uint16_t v)
     return p[0] | (p[1] << 8);
 }
 
-static void perror_exit(compactflash_t *cf, char *str) {
-    log_perror("[COMPACTFLASH] ERROR '%s' %s\n", cf->file_name, str);
-    exit(1);
+/**
+ * @brief Start writing the modified sectors back, to the delta or to the image
+ *
+ * @returns false if the previous write back is not over yet
+ */
+static bool compactflash_start_write_back(compactflash_t* cf, bool sync)
+{
+    return cf->copy_on_write ? disk_cow_flush(&cf->cow, sync) : disk_cache_flush(&cf->cache, sync);
+}
+
+static bool compactflash_write_back_busy(compactflash_t* cf)
+{
+    return cf->copy_on_write ? disk_cow_busy(&cf->cow) : disk_cache_busy(&cf->cache);
+}
+
+/**
+ * @brief The device stays busy until the sectors flushed by FLUSH CACHE have been written back
+ */
+static uint8_t compactflash_status(compactflash_t* cf)
+{
+    if (cf->flushing) {
+        /* The write back can only start once the previous one is over */
+        if (!cf->flush_started) {
+            cf->flush_started = compactflash_start_write_back(cf, cf->durability != DISK_DURABILITY_NONE);
+        }
+        if (!cf->flush_started || compactflash_write_back_busy(cf)) {
+            return (cf->status | (1 << IDE_STAT_BUSY)) & ~(1 << IDE_STAT_RDY);
+        }
+        cf->flushing = false;
+    }
+    return cf->status;
 }
 
 static uint8_t io_read(device_t* dev, uint32_t addr)
@@ -42,7 +74,7 @@ static uint8_t io_read(device_t* dev, uint32_t addr)
     compactflash_t* cf = (compactflash_t*) dev;
     if (!cf->master) return 0;
     switch (addr) {
-        case IDE_REG_STATUS:  return cf->status;
+        case IDE_REG_STATUS:  return compactflash_status(cf);
         case IDE_REG_ERROR:   return cf->error;
         case IDE_REG_SEC_CNT: return cf->sec_cnt & 0xff;
         case IDE_REG_LBA_0:   return cf->lba_0;
@@ -76,7 +108,7 @@ static void io_write(device_t* dev, uint32_t addr, uint8_t value)
         }
 }
 
-static uint32_t compactflash_data_ofs(compactflash_t* cf)
+static long compactflash_data_ofs(compactflash_t* cf)
 {
     if (!cf->master) {
         log_printf("[COMPACTFLASH] Slave device does not support data access.\n");
@@ -117,39 +149,128 @@ static void data_state(compactflash_t* cf, compactflash_state_t state)
     }
 }
 
+/**
+ * @brief Get the current sector directly in the image mapping, NULL if it must go through the file
+ */
+static uint8_t* compactflash_mapped_sector(compactflash_t* cf)
+{
+    if (cf->image == NULL || cf->data_ofs + 512 > (long) cf->image_size) {
+        return NULL;
+    }
+    return cf->image + cf->data_ofs;
+}
+
+static void compactflash_sync(compactflash_t* cf)
+{
+    if (!compactflash_start_write_back(cf, false)) {
+        /* The previous write back is not over yet, try again on the next tick */
+        return;
+    }
+    cf->dirty = false;
+}
+
+/**
+ * @brief Write all the modified sectors back and make sure they reach the disk, unless the durability
+ * policy leaves it to the host
+ */
+static void compactflash_flush_cache(compactflash_t* cf)
+{
+    cf->dirty = false;
+    cf->flushing = true;
+    cf->flush_started = compactflash_start_write_back(cf, cf->durability != DISK_DURABILITY_NONE);
+}
+
+static void compactflash_mark_dirty(compactflash_t* cf)
+{
+    /* The idle policy waits for a whole period without any write, the periodic one doesn't */
+    if (cf->sync == CF_SYNC_IDLE || !cf->dirty) {
+        cf->sync_countdown = cf->sync_period;
+    }
+    cf->dirty = true;
+}
+
 static void compactflash_read_sector_buffer(compactflash_t* cf)
 {
-    if (lseek(cf->fd, cf->data_ofs, SEEK_SET) == -1)
-        perror_exit(cf, "seek()");
-    int bytes_read = read(cf->fd, cf->sector_buffer, 512);
-    if (bytes_read == -1)
-        perror_exit(cf, "read()");
-    if (bytes_read < 512)
-        memset(cf->sector_buffer + bytes_read, 0, 512 - bytes_read);
+    if (cf->copy_on_write) {
+        cf->data = (uint8_t*) disk_cow_read(&cf->cow, cf->data_ofs / 512, cf->sector_buffer);
+        return;
+    }
+
+    cf->data = compactflash_mapped_sector(cf);
+    if (cf->data != NULL) {
+        return;
+    }
+
+    cf->data = cf->sector_buffer;
+    disk_cache_read(&cf->cache, cf->data_ofs / 512, cf->sector_buffer);
+}
+
+/**
+ * @brief Prepare the buffer that will receive the next sector written by the CPU. The sector is only
+ * committed once all its bytes have been received, an aborted command leaves the image untouched.
+ */
+static void compactflash_prepare_sector_buffer(compactflash_t* cf)
+{
+    cf->data = cf->sector_buffer;
 }
 
 static void compactflash_write_sector_buffer(compactflash_t* cf)
 {
-    if (lseek(cf->fd, cf->data_ofs, SEEK_SET) == -1)
-        perror_exit(cf, "seek()");
-    if (write(cf->fd, cf->sector_buffer, 512) == -1)
-        perror_exit(cf, "write()");
+    const uint32_t sector = cf->data_ofs / 512;
+    uint8_t* dst;
+
+    if (cf->copy_on_write) {
+        dst = disk_cow_write(&cf->cow, sector);
+        if (dst == NULL) {
+            /* The sector couldn't be added to the delta, the base image must not be modified */
+            return;
+        }
+    } else {
+        dst = compactflash_mapped_sector(cf);
+        if (dst == NULL) {
+            disk_cache_write(&cf->cache, sector, cf->sector_buffer);
+            compactflash_mark_dirty(cf);
+            return;
+        }
+    }
+    memcpy(dst, cf->sector_buffer, 512);
+    compactflash_mark_dirty(cf);
+}
+
+/**
+ * @brief The whole sector has been read by the CPU, go to the next one, if any
+ */
+static void compactflash_end_read_sector(compactflash_t* cf)
+{
+    cf->sector_buffer_idx = 0;
+    if (++cf->sec_cur < cf->sec_cnt) {
+        cf->data_ofs += 512;
+        compactflash_read_sector_buffer(cf);
+    } else
+        data_state(cf, IDE_DATA_IDLE);
+}
+
+/**
+ * @brief The whole sector has been written by the CPU, commit it and go to the next one, if any
+ */
+static void compactflash_end_write_sector(compactflash_t* cf)
+{
+    cf->sector_buffer_idx = 0;
+    compactflash_write_sector_buffer(cf);
+    if (++cf->sec_cur < cf->sec_cnt) {
+        cf->data_ofs += 512;
+        compactflash_prepare_sector_buffer(cf);
+    } else
+        data_state(cf, IDE_DATA_IDLE);
 }
 
 static uint8_t compactflash_read_data(compactflash_t* cf)
 {
     if (cf->state != IDE_DATA_IN)
         return 0;
-    uint8_t data = cf->sector_buffer[cf->sector_buffer_idx];
-    cf->sector_buffer_idx = (cf->sector_buffer_idx + 1) % 512;
-    if (cf->sector_buffer_idx == 0) {
-        if (++cf->sec_cur < cf->sec_cnt) {
-            cf->data_ofs += 512;
-            cf->sector_buffer_idx = 0;
-            compactflash_read_sector_buffer(cf);
-        } else
-            data_state(cf, IDE_DATA_IDLE);
-    }
+    uint8_t data = cf->data[cf->sector_buffer_idx++];
+    if (cf->sector_buffer_idx == 512)
+        compactflash_end_read_sector(cf);
     return data;
 }
 
@@ -157,16 +278,57 @@ static void compactflash_write_data(compactflash_t* cf, uint8_t value)
 {
     if (cf->state != IDE_DATA_OUT)
         return;
-    cf->sector_buffer[cf->sector_buffer_idx] = value;
-    cf->sector_buffer_idx = (cf->sector_buffer_idx + 1) % 512;
-    if (cf->sector_buffer_idx == 0) {
-        compactflash_write_sector_buffer(cf);
-        if (++cf->sec_cur < cf->sec_cnt) {
-            cf->data_ofs += 512;
-            cf->sector_buffer_idx = 0;
-        } else
-            data_state(cf, IDE_DATA_IDLE);
+    cf->data[cf->sector_buffer_idx++] = value;
+    if (cf->sector_buffer_idx == 512)
+        compactflash_end_write_sector(cf);
+}
+
+/**
+ * @brief Transfer several bytes of the data register at once, used by INIR/OTIR.
+ * The transfer stops at the end of the current sector.
+ */
+static uint32_t io_block(device_t* dev, uint32_t addr, bool write, uint8_t* data, uint32_t count)
+{
+    compactflash_t* cf = (compactflash_t*) dev;
+    if (addr != IDE_REG_DATA || !cf->master || cf->state != (write ? IDE_DATA_OUT : IDE_DATA_IN))
+        return 0;
+
+    count = MIN(count, (uint32_t) (512 - cf->sector_buffer_idx));
+    if (write)
+        memcpy(cf->data + cf->sector_buffer_idx, data, count);
+    else
+        memcpy(data, cf->data + cf->sector_buffer_idx, count);
+
+    cf->sector_buffer_idx += count;
+    if (cf->sector_buffer_idx == 512) {
+        if (write)
+            compactflash_end_write_sector(cf);
+        else
+            compactflash_end_read_sector(cf);
     }
+    return count;
+}
+
+static void compactflash_abort(compactflash_t* cf)
+{
+    data_state(cf, IDE_DATA_IDLE);
+    cf->status |= (1 << IDE_STAT_ERR);
+    cf->error = (1 << IDE_ERR_ABRT);
+}
+
+/**
+ * @brief Set the number of sectors per DRQ block of READ/WRITE MULTIPLE, from the sector count register.
+ * The data register can be read or written continuously, so the block size doesn't change the transfers.
+ */
+static void compactflash_set_multiple(compactflash_t* cf)
+{
+    /* A sector count of 0 disables the multiple mode */
+    const int count = cf->sec_cnt == 256 ? 0 : cf->sec_cnt;
+    if (count > CF_MAX_MULTIPLE || (count & (count - 1)) != 0)
+        return compactflash_abort(cf);
+
+    cf->multiple = count;
+    cf->identity[59] = le16(count == 0 ? 0 : (1 << 8) | count);
 }
 
 static void compactflash_process_command(compactflash_t* cf, uint8_t cmd)
@@ -182,9 +344,22 @@ static void compactflash_process_command(compactflash_t* cf, uint8_t cmd)
 
         case IDE_CMD_IDENTIFY:
             memcpy(cf->sector_buffer, cf->identity, 512);
+            cf->data = cf->sector_buffer;
             data_state(cf, IDE_DATA_IN);
             break;
 
+        case IDE_CMD_SET_MULTIPLE:
+            compactflash_set_multiple(cf);
+            break;
+
+        case IDE_CMD_FLUSH_CACHE:
+            compactflash_flush_cache(cf);
+            break;
+
+        case IDE_CMD_READ_MULTIPLE:
+            if (cf->multiple == 0)
+                return compactflash_abort(cf);
+        // Fall-through
         case IDE_CMD_READ_SECTOR:
         case IDE_CMD_READ_SECTOR_NR:
             cf->data_ofs = compactflash_data_ofs(cf);
@@ -197,6 +372,10 @@ static void compactflash_process_command(compactflash_t* cf, uint8_t cmd)
             data_state(cf, IDE_DATA_IN);
             break;
 
+        case IDE_CMD_WRITE_MULTIPLE:
+            if (cf->multiple == 0)
+                return compactflash_abort(cf);
+        // Fall-through
         case IDE_CMD_WRITE_SECTOR:
         case IDE_CMD_WRITE_SECTOR_NR:
             cf->data_ofs = compactflash_data_ofs(cf);
@@ -205,36 +384,54 @@ static void compactflash_process_command(compactflash_t* cf, uint8_t cmd)
         case IDE_CMD_WRITE_BUFFER:
             if (cf->data_ofs == -1)
                 return data_state(cf, IDE_DATA_ERROR);
+            compactflash_prepare_sector_buffer(cf);
             data_state(cf, IDE_DATA_OUT);
             break;
     }
 }
 
-int compactflash_init(compactflash_t* cf, const char *file_name)
+int compactflash_init(compactflash_t* cf, const char *file_name,
+                      const char *delta_name, bool discard,
+                      compactflash_sync_t sync, int sync_period_ms,
+                      disk_durability_t durability, bool async)
 {
     struct stat st;
+    disk_cow_t cow;
+    int fd = -1;
 
     if (file_name == NULL) {
         /* No CompactFlash file specified */
         return 1;
     }
 
-    int fd = open(file_name, O_RDWR);
-    if (fd < 0) {
-        log_perror("[COMPACTFLASH] Could not open file");
-        /* Continue without CF emulation */
-        return 1;
-    }
+    const bool copy_on_write = delta_name != NULL || discard;
+    if (copy_on_write) {
+        if (disk_cow_open(&cow, file_name, delta_name, discard, durability, async) != 0) {
+            return 1;
+        }
+        st.st_size = cow.base_size;
+    } else {
+        fd = open(file_name, O_RDWR | OPEN_BINARY);
+        if (fd < 0) {
+            log_perror("[COMPACTFLASH] Could not open file");
+            /* Continue without CF emulation */
+            return 1;
+        }
 
-    if (fstat(fd, &st) == -1) {
-        log_perror("[COMPACTFLASH] Could not stat file");
-        close(fd);
-        return 1;
+        if (fstat(fd, &st) == -1) {
+            log_perror("[COMPACTFLASH] Could not stat file");
+            close(fd);
+            return 1;
+        }
     }
 
     if (st.st_size < 1024 * 1024) {
         log_err_printf("[COMPACTFLASH] Image must be at least 1MB big\n");
-        close(fd);
+        if (copy_on_write) {
+            disk_cow_close(&cow);
+        } else {
+            close(fd);
+        }
         return 1;
     }
 
@@ -243,24 +440,80 @@ int compactflash_init(compactflash_t* cf, const char *file_name)
 
     *cf = (compactflash_t) {
         .fd = fd,
+        .copy_on_write = copy_on_write,
         .size = 8,
         .total_sectors = total_sectors,
         .file_name = strdup(file_name),
         .status = (1 << IDE_STAT_RDY) | (1 << IDE_STAT_DSC),
         .lba_24 = 0xE0,
+        .sync = sync,
+        .sync_period = (long) MAX(sync_period_ms, 0) * (CPUFREQ / 1000),
+        .durability = durability,
         .sec_cnt = 1,
         .master = true,
         .identity = {
             [0] = le16(0x848A),                  // CFA magic value
-            [47] = 0,                            // READ/WRITE MULTIPLE not implemented
+            [47] = le16(0x8000 | CF_MAX_MULTIPLE), // READ/WRITE MULTIPLE: maximum sectors per block
             [49] = le16(1 << 9),                 // LBA supported
             [60] = le16(total_sectors & 0xFFFF), // LBA: current capacity in sectors
             [61] = le16(total_sectors >> 16),    // LBA: current capacity in sectors
-            [83] = le16(1 << 2),                 // CFA Feature Set bit
+            [83] = le16(1 << 12 | 1 << 2),       // FLUSH CACHE supported, CFA Feature Set bit
+            [86] = le16(1 << 12),                // FLUSH CACHE enabled
         }
     };
+    cf->data = cf->sector_buffer;
     data_state(cf, IDE_DATA_IDLE);
 
+    if (copy_on_write) {
+        cf->cow = cow;
+    } else {
+#ifndef _WIN32
+        /* Serve the sectors straight from a shared mapping of the image, the modified pages are written
+         * back according to the sync policy. Fall back to regular file accesses if it can't be mapped. */
+        void* image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (image == MAP_FAILED) {
+            log_perror("[COMPACTFLASH] Could not map the image, using file accesses");
+        } else {
+            cf->image = image;
+            cf->image_size = st.st_size;
+        }
+#endif
+        disk_cache_init(&cf->cache, fd, cf->image, cf->image_size, durability, async);
+    }
+
     device_init_io(DEVICE(cf), "compactflash_dev", io_read, io_write, cf->size);
+    device_register_io_block(DEVICE(cf), io_block);
     return 0;
 }
+
+void compactflash_tick(compactflash_t* cf, int elapsed_tstates)
+{
+    if (!cf->dirty || cf->sync == CF_SYNC_EXIT) {
+        return;
+    }
+    cf->sync_countdown -= elapsed_tstates;
+    if (cf->sync_countdown <= 0) {
+        compactflash_sync(cf);
+    }
+}
+
+void compactflash_deinit(compactflash_t* cf)
+{
+    if (cf->file_name == NULL) {
+        return;
+    }
+    if (cf->copy_on_write) {
+        disk_cow_close(&cf->cow);
+    } else {
+        disk_cache_deinit(&cf->cache);
+#ifndef _WIN32
+        if (cf->image != NULL) {
+            munmap(cf->image, cf->image_size);
+            cf->image = NULL;
+        }
+#endif
+        close(cf->fd);
+    }
+    free(cf->file_name);
+    cf->file_name = NULL;
+}
@@ -572,8 +572,10 @@ bool debugger_ui_main_view_bounds(const struct dbg_ui_t* dctx, Rectangle* bounds
     return true;
 }
 
-bool debugger_ui_vram_panel_opened(const struct dbg_ui_t* dctx)
+uint32_t debugger_ui_vram_visible_views(const struct dbg_ui_t* dctx)
 {
-    (void) dctx;
-    return !dbg_panels[DBG_UI_PANEL_VRAM].hidden;
+    if (dbg_panels[DBG_UI_PANEL_VRAM].hidden) {
+        return 0;
+    }
+    return ui_panel_vram_views(dctx);
 }
@@ -37,6 +37,14 @@ static const char *s_tab_names[] = {
     [TAB_PALETTE] = "Palette",
     [TAB_FONT]    = "Font",
 };
+/* Debug texture displayed by each tab */
+static const dbg_vram_t s_tab_views[] = {
+    [TAB_LAYER0]  = DBG_TILEMAP_LAYER0,
+    [TAB_LAYER1]  = DBG_TILEMAP_LAYER1,
+    [TAB_TILESET] = DBG_TILESET,
+    [TAB_PALETTE] = DBG_PALETTE,
+    [TAB_FONT]    = DBG_FONT,
+};
 static const struct nk_color s_active_color   = { .r = 0, .g = 0x2d, .b = 0x78, .a = 0xff };
 static const struct nk_color s_inactive_color = { .r = 0x6c, .g = 0x70, .b = 0x86, .a = 0xff };
 
@@ -212,9 +220,19 @@ static void ui_tab_set(struct dbg_ui_t* dctx, const tab_args_t* args)
 }
 
 
+uint32_t ui_panel_vram_views(const struct dbg_ui_t* dctx)
+{
+    /* Nothing is shown in bitmap mode */
+    if (zvb_is_bitmap_mode(dctx->zvb)) {
+        return 0;
+    }
+    return ZVB_DBG_VIEW(s_tab_views[dctx->vram_tab]);
+}
+
+
 void ui_panel_vram(struct dbg_ui_panel_t* panel, struct dbg_ui_t* dctx, dbg_t* dbg)
 {
-    static int current_tab = 0;
+    int current_tab = dctx->vram_tab;
     struct nk_context* ctx = dctx->ctx;
 
     nk_layout_row_dynamic(ctx, 30, TAB_COUNT);
@@ -228,6 +246,7 @@ void ui_panel_vram(struct dbg_ui_panel_t* panel, struct dbg_ui_t* dctx, dbg_t* d
 
         if (nk_button_label(ctx, s_tab_names[i])) {
             current_tab = i;
+            dctx->vram_tab = i;
         }
 
         nk_style_pop_color(ctx);
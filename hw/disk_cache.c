@@ -0,0 +1,379 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Required for pwritev */
+#ifndef _DEFAULT_SOURCE
+    #define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#ifndef _WIN32
+    #include <sys/uio.h>
+    #include <sys/mman.h>
+#endif
+
+#include "hw/disk_cache.h"
+#include "utils/log.h"
+#include "utils/paths.h"
+
+#define DISK_CACHE_FREE         UINT32_MAX
+#define DISK_CACHE_MIN_ENTRIES  64
+/* Maximum number of adjacent sectors written with a single system call */
+#define DISK_CACHE_MAX_IOV      256
+
+
+static uint32_t set_slot(const disk_cache_set_t* set, uint32_t sector)
+{
+    return (sector * 2654435761u) & (set->capacity - 1);
+}
+
+static disk_cache_entry_t* set_find(const disk_cache_set_t* set, uint32_t sector)
+{
+    if (set->count == 0) {
+        return NULL;
+    }
+    for (uint32_t i = set_slot(set, sector); ; i = (i + 1) & (set->capacity - 1)) {
+        disk_cache_entry_t* entry = &set->entries[i];
+        if (entry->sector == sector) {
+            return entry;
+        } else if (entry->sector == DISK_CACHE_FREE) {
+            return NULL;
+        }
+    }
+}
+
+static void set_clear(disk_cache_set_t* set)
+{
+    for (uint32_t i = 0; i < set->capacity && set->count > 0; i++) {
+        if (set->entries[i].sector != DISK_CACHE_FREE) {
+            set->entries[i].sector = DISK_CACHE_FREE;
+            set->count--;
+        }
+    }
+}
+
+static bool set_grow(disk_cache_set_t* set)
+{
+    const uint32_t capacity = set->capacity == 0 ? DISK_CACHE_MIN_ENTRIES : set->capacity * 2;
+    disk_cache_entry_t* entries = malloc(capacity * sizeof(disk_cache_entry_t));
+    if (entries == NULL) {
+        return false;
+    }
+    for (uint32_t i = 0; i < capacity; i++) {
+        entries[i].sector = DISK_CACHE_FREE;
+    }
+
+    disk_cache_set_t grown = { .entries = entries, .capacity = capacity, .count = set->count };
+    for (uint32_t i = 0; i < set->capacity; i++) {
+        const disk_cache_entry_t* entry = &set->entries[i];
+        if (entry->sector == DISK_CACHE_FREE) {
+            continue;
+        }
+        uint32_t j = set_slot(&grown, entry->sector);
+        while (entries[j].sector != DISK_CACHE_FREE) {
+            j = (j + 1) & (capacity - 1);
+        }
+        entries[j] = *entry;
+    }
+    free(set->entries);
+    *set = grown;
+    return true;
+}
+
+/**
+ * @brief Get the entry of the given sector, inserting it if it doesn't exist yet
+ */
+static disk_cache_entry_t* set_insert(disk_cache_set_t* set, uint32_t sector)
+{
+    disk_cache_entry_t* entry = set_find(set, sector);
+    if (entry != NULL) {
+        return entry;
+    }
+    /* Keep the load factor under 3/4 */
+    if ((set->count + 1) * 4 > set->capacity * 3 && !set_grow(set)) {
+        return NULL;
+    }
+    uint32_t i = set_slot(set, sector);
+    while (set->entries[i].sector != DISK_CACHE_FREE) {
+        i = (i + 1) & (set->capacity - 1);
+    }
+    set->entries[i].sector = sector;
+    set->count++;
+    return &set->entries[i];
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+    const uint32_t sa = (*(const disk_cache_entry_t* const*) a)->sector;
+    const uint32_t sb = (*(const disk_cache_entry_t* const*) b)->sector;
+    return (sa > sb) - (sa < sb);
+}
+
+/**
+ * @brief Write the given sectors to the file, the adjacent ones are written with a single call
+ */
+static void write_sectors(int fd, disk_cache_entry_t** sorted, uint32_t count)
+{
+#ifdef _WIN32
+    /* No vectored writes on Windows, write the sectors one by one */
+    for (uint32_t i = 0; i < count; i++) {
+        const int64_t offset = (int64_t) sorted[i]->sector * DISK_CACHE_SECTOR_SIZE;
+        if (os_pwrite(fd, sorted[i]->data, DISK_CACHE_SECTOR_SIZE, offset) != DISK_CACHE_SECTOR_SIZE) {
+            log_perror("[DISK] Could not write sectors back to the image");
+        }
+    }
+#else
+    struct iovec iov[DISK_CACHE_MAX_IOV];
+
+    for (uint32_t i = 0; i < count; ) {
+        const uint32_t first = sorted[i]->sector;
+        int n = 0;
+        do {
+            iov[n].iov_base = sorted[i]->data;
+            iov[n].iov_len = DISK_CACHE_SECTOR_SIZE;
+            n++;
+            i++;
+        } while (i < count && n < DISK_CACHE_MAX_IOV && sorted[i]->sector == first + n);
+
+        const ssize_t expected = (ssize_t) n * DISK_CACHE_SECTOR_SIZE;
+        if (pwritev(fd, iov, n, (off_t) first * DISK_CACHE_SECTOR_SIZE) != expected) {
+            log_perror("[DISK] Could not write sectors back to the image");
+        }
+    }
+#endif
+}
+
+/**
+ * @brief Write the `flushing` set back to the file, or sync the mapping. Called from the worker.
+ */
+static void write_back(disk_cache_t* cache)
+{
+#ifndef _WIN32
+    if (cache->image != NULL) {
+        if (msync(cache->image, cache->image_size, cache->sync ? MS_SYNC : MS_ASYNC) == -1) {
+            log_perror("[DISK] Could not sync the image");
+        }
+        return;
+    }
+#endif
+
+    const disk_cache_set_t* set = &cache->flushing;
+    if (set->count > 0) {
+        disk_cache_entry_t** sorted = malloc(set->count * sizeof(disk_cache_entry_t*));
+        if (sorted == NULL) {
+            log_err_printf("[DISK] Could not allocate the write back list\n");
+            return;
+        }
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < set->capacity; i++) {
+            if (set->entries[i].sector != DISK_CACHE_FREE) {
+                sorted[count++] = &set->entries[i];
+            }
+        }
+        qsort(sorted, count, sizeof(disk_cache_entry_t*), compare_entries);
+        write_sectors(cache->fd, sorted, count);
+        free(sorted);
+    }
+
+    if (cache->sync && os_fsync(cache->fd) == -1) {
+        log_perror("[DISK] Could not sync the image");
+    }
+}
+
+
+#if DISK_CACHE_ASYNC_SUPPORT
+
+static void* disk_cache_worker(void* arg)
+{
+    disk_cache_t* cache = (disk_cache_t*) arg;
+
+    pthread_mutex_lock(&cache->lock);
+    while (!cache->quit) {
+        if (atomic_load_explicit(&cache->state, memory_order_relaxed) != DISK_CACHE_BUSY) {
+            pthread_cond_wait(&cache->cond, &cache->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&cache->lock);
+        write_back(cache);
+        pthread_mutex_lock(&cache->lock);
+        atomic_store_explicit(&cache->state, DISK_CACHE_DONE, memory_order_release);
+        pthread_cond_broadcast(&cache->cond);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return NULL;
+}
+
+
+static void wait_write_back(disk_cache_t* cache)
+{
+    pthread_mutex_lock(&cache->lock);
+    while (atomic_load_explicit(&cache->state, memory_order_acquire) == DISK_CACHE_BUSY) {
+        pthread_cond_wait(&cache->cond, &cache->lock);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+#endif // DISK_CACHE_ASYNC_SUPPORT
+
+
+/**
+ * @brief Empty the `flushing` set once it has been written back
+ */
+static void poll_write_back(disk_cache_t* cache)
+{
+    if (atomic_load_explicit(&cache->state, memory_order_acquire) == DISK_CACHE_DONE) {
+        set_clear(&cache->flushing);
+        atomic_store_explicit(&cache->state, DISK_CACHE_IDLE, memory_order_relaxed);
+    }
+}
+
+
+void disk_cache_init(disk_cache_t* cache, int fd, uint8_t* image, size_t image_size,
+                     disk_durability_t durability, bool async)
+{
+    memset(cache, 0, sizeof(disk_cache_t));
+    cache->fd = fd;
+    cache->image = image;
+    cache->image_size = image_size;
+    cache->durability = durability;
+    atomic_init(&cache->state, DISK_CACHE_IDLE);
+
+#if DISK_CACHE_ASYNC_SUPPORT
+    if (async) {
+        pthread_mutex_init(&cache->lock, NULL);
+        pthread_cond_init(&cache->cond, NULL);
+        if (pthread_create(&cache->worker, NULL, disk_cache_worker, cache) != 0) {
+            log_err_printf("[DISK] Could not start the write back thread, writes will be synchronous\n");
+            pthread_cond_destroy(&cache->cond);
+            pthread_mutex_destroy(&cache->lock);
+        } else {
+            cache->async = true;
+        }
+    }
+#else
+    (void) async;
+#endif
+}
+
+
+void disk_cache_read(disk_cache_t* cache, uint32_t sector, uint8_t* data)
+{
+    poll_write_back(cache);
+
+    /* The sectors being written back are still more recent than the file */
+    const disk_cache_entry_t* entry = set_find(&cache->dirty, sector);
+    if (entry == NULL) {
+        entry = set_find(&cache->flushing, sector);
+    }
+    if (entry != NULL) {
+        memcpy(data, entry->data, DISK_CACHE_SECTOR_SIZE);
+        return;
+    }
+
+    ssize_t rd = os_pread(cache->fd, data, DISK_CACHE_SECTOR_SIZE, (int64_t) sector * DISK_CACHE_SECTOR_SIZE);
+    if (rd < 0) {
+        log_perror("[DISK] Could not read the image");
+        rd = 0;
+    }
+    memset(data + rd, 0, DISK_CACHE_SECTOR_SIZE - rd);
+}
+
+
+void disk_cache_write(disk_cache_t* cache, uint32_t sector, const uint8_t* data)
+{
+    poll_write_back(cache);
+
+    disk_cache_entry_t* entry = set_insert(&cache->dirty, sector);
+    if (entry == NULL) {
+        /* Out of memory, write it directly instead of losing it */
+        if (os_pwrite(cache->fd, data, DISK_CACHE_SECTOR_SIZE, (int64_t) sector * DISK_CACHE_SECTOR_SIZE) == -1) {
+            log_perror("[DISK] Could not write the image");
+        }
+        return;
+    }
+    memcpy(entry->data, data, DISK_CACHE_SECTOR_SIZE);
+
+    if (cache->dirty.count >= DISK_CACHE_MAX_DIRTY) {
+        disk_cache_flush(cache, false);
+    }
+}
+
+
+bool disk_cache_flush(disk_cache_t* cache, bool sync)
+{
+    poll_write_back(cache);
+    if (atomic_load_explicit(&cache->state, memory_order_relaxed) != DISK_CACHE_IDLE) {
+        return false;
+    }
+
+    /* The dirty sectors are now the ones to write back, the guest continues with an empty set */
+    const disk_cache_set_t flushing = cache->flushing;
+    cache->flushing = cache->dirty;
+    cache->dirty = flushing;
+    cache->sync = sync || cache->durability == DISK_DURABILITY_PERIODIC;
+
+#if DISK_CACHE_ASYNC_SUPPORT
+    if (cache->async) {
+        pthread_mutex_lock(&cache->lock);
+        atomic_store_explicit(&cache->state, DISK_CACHE_BUSY, memory_order_relaxed);
+        pthread_cond_broadcast(&cache->cond);
+        pthread_mutex_unlock(&cache->lock);
+        return true;
+    }
+#endif
+
+    write_back(cache);
+    set_clear(&cache->flushing);
+    return true;
+}
+
+
+bool disk_cache_busy(disk_cache_t* cache)
+{
+    poll_write_back(cache);
+    return atomic_load_explicit(&cache->state, memory_order_relaxed) != DISK_CACHE_IDLE;
+}
+
+
+void disk_cache_wait(disk_cache_t* cache)
+{
+#if DISK_CACHE_ASYNC_SUPPORT
+    if (cache->async) {
+        wait_write_back(cache);
+    }
+#endif
+    poll_write_back(cache);
+}
+
+
+void disk_cache_deinit(disk_cache_t* cache)
+{
+#if DISK_CACHE_ASYNC_SUPPORT
+    if (cache->async) {
+        wait_write_back(cache);
+        pthread_mutex_lock(&cache->lock);
+        cache->quit = true;
+        pthread_cond_broadcast(&cache->cond);
+        pthread_mutex_unlock(&cache->lock);
+        pthread_join(cache->worker, NULL);
+        pthread_cond_destroy(&cache->cond);
+        pthread_mutex_destroy(&cache->lock);
+        cache->async = false;
+    }
+#endif
+    poll_write_back(cache);
+
+    /* Last write back, performed synchronously since the worker is stopped */
+    disk_cache_flush(cache, cache->durability != DISK_DURABILITY_NONE);
+    free(cache->dirty.entries);
+    free(cache->flushing.entries);
+    memset(&cache->dirty, 0, sizeof(disk_cache_set_t));
+    memset(&cache->flushing, 0, sizeof(disk_cache_set_t));
+}
@@ -0,0 +1,397 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+    #include <sys/mman.h>
+#endif
+
+#include "hw/disk_cow.h"
+#include "utils/log.h"
+#include "utils/paths.h"
+
+#define HEADER_SIZE     24
+
+
+static void put_le32(uint8_t* p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t get_le32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t table_offset(uint32_t slot)
+{
+    return DISK_COW_SECTOR_SIZE + (uint64_t) slot * 4;
+}
+
+static uint64_t slot_offset(const disk_cow_t* cow, uint32_t slot)
+{
+    const uint64_t table_sectors = ((uint64_t) cow->total_sectors * 4 + DISK_COW_SECTOR_SIZE - 1) / DISK_COW_SECTOR_SIZE;
+    return (1 + table_sectors + slot) * DISK_COW_SECTOR_SIZE;
+}
+
+static uint8_t* slot_data(const disk_cow_t* cow, uint32_t slot)
+{
+    return cow->chunks[slot / DISK_COW_CHUNK_SECTORS] + (slot % DISK_COW_CHUNK_SECTORS) * DISK_COW_SECTOR_SIZE;
+}
+
+/**
+ * @brief Get the slot of the given sector in the delta, -1 if it was never written
+ */
+static int64_t cow_lookup(const disk_cow_t* cow, uint32_t sector)
+{
+    if (sector >= cow->total_sectors) {
+        return -1;
+    }
+    const uint32_t* table = cow->index[sector >> DISK_COW_TABLE_BITS];
+    if (table == NULL || table[sector & (DISK_COW_TABLE_SIZE - 1)] == 0) {
+        return -1;
+    }
+    return table[sector & (DISK_COW_TABLE_SIZE - 1)] - 1;
+}
+
+/**
+ * @brief Allocate a new slot in the delta for the given sector. Its content is left uninitialized so
+ * the sector keeps being read from the base image until the slot is published.
+ */
+static int64_t cow_allocate(disk_cow_t* cow, uint32_t sector)
+{
+    uint32_t** table = &cow->index[sector >> DISK_COW_TABLE_BITS];
+    if (*table == NULL) {
+        *table = calloc(DISK_COW_TABLE_SIZE, sizeof(uint32_t));
+        if (*table == NULL) {
+            return -1;
+        }
+    }
+
+    const uint32_t slot = cow->count;
+    if (slot == cow->capacity) {
+        const uint32_t capacity = cow->capacity + DISK_COW_CHUNK_SECTORS;
+        uint8_t** chunks = realloc(cow->chunks, (capacity / DISK_COW_CHUNK_SECTORS) * sizeof(uint8_t*));
+        if (chunks == NULL) {
+            return -1;
+        }
+        cow->chunks = chunks;
+        uint32_t* sectors = realloc(cow->sectors, capacity * sizeof(uint32_t));
+        if (sectors == NULL) {
+            return -1;
+        }
+        cow->sectors = sectors;
+        uint8_t* dirty = realloc(cow->dirty, capacity);
+        if (dirty == NULL) {
+            return -1;
+        }
+        cow->dirty = dirty;
+        chunks[slot / DISK_COW_CHUNK_SECTORS] = malloc(DISK_COW_CHUNK_SECTORS * DISK_COW_SECTOR_SIZE);
+        if (chunks[slot / DISK_COW_CHUNK_SECTORS] == NULL) {
+            return -1;
+        }
+        cow->capacity = capacity;
+    }
+
+    cow->sectors[slot] = sector;
+    cow->dirty[slot] = 1;
+    cow->count++;
+    return slot;
+}
+
+/**
+ * @brief Redirect the accesses to the sector to its slot in the delta, which must be filled
+ */
+static void cow_publish(disk_cow_t* cow, uint32_t sector, uint32_t slot)
+{
+    cow->index[sector >> DISK_COW_TABLE_BITS][sector & (DISK_COW_TABLE_SIZE - 1)] = slot + 1;
+}
+
+static void read_base(const disk_cow_t* cow, uint32_t sector, uint8_t* buffer)
+{
+    const uint64_t offset = (uint64_t) sector * DISK_COW_SECTOR_SIZE;
+    ssize_t rd = os_pread(cow->fd, buffer, DISK_COW_SECTOR_SIZE, offset);
+    if (rd < 0) {
+        log_perror("[DISK] Could not read the base image");
+        rd = 0;
+    }
+    memset(buffer + rd, 0, DISK_COW_SECTOR_SIZE - rd);
+}
+
+/**
+ * @brief Load the sectors of an existing delta file in memory
+ */
+static int cow_load_delta(disk_cow_t* cow, int fd, const char* delta_path)
+{
+    uint8_t header[HEADER_SIZE];
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        log_perror("[DISK] Could not stat the delta");
+        return -1;
+    }
+    if (st.st_size == 0) {
+        /* New delta */
+        return 0;
+    }
+
+    if (os_pread(fd, header, HEADER_SIZE, 0) != HEADER_SIZE || memcmp(header, DISK_COW_MAGIC, 8) != 0 ||
+        get_le32(header + 8) != DISK_COW_SECTOR_SIZE)
+    {
+        log_err_printf("[DISK] %s is not a valid delta\n", delta_path);
+        return -1;
+    }
+    const uint64_t base_size = get_le32(header + 16) | ((uint64_t) get_le32(header + 20) << 32);
+    if (base_size != cow->base_size) {
+        log_err_printf("[DISK] %s was made for a base image of %llu bytes, not %llu\n", delta_path,
+                       (unsigned long long) base_size, (unsigned long long) cow->base_size);
+        return -1;
+    }
+
+    const uint32_t count = get_le32(header + 12);
+    if (count > cow->total_sectors) {
+        log_err_printf("[DISK] %s has an invalid sector count\n", delta_path);
+        return -1;
+    }
+    uint8_t* table = malloc((size_t) count * 4 + 1);
+    if (table == NULL || os_pread(fd, table, (size_t) count * 4, table_offset(0)) != (ssize_t) count * 4) {
+        log_err_printf("[DISK] %s is truncated\n", delta_path);
+        free(table);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t sector = get_le32(table + i * 4);
+        if (sector >= cow->total_sectors || cow_lookup(cow, sector) != -1) {
+            log_err_printf("[DISK] %s has an invalid sector table\n", delta_path);
+            free(table);
+            return -1;
+        }
+        const int64_t slot = cow_allocate(cow, sector);
+        if (slot < 0 || os_pread(fd, slot_data(cow, slot), DISK_COW_SECTOR_SIZE, slot_offset(cow, slot)) != DISK_COW_SECTOR_SIZE) {
+            log_err_printf("[DISK] Could not load sector %u of %s\n", sector, delta_path);
+            free(table);
+            return -1;
+        }
+        cow_publish(cow, sector, slot);
+        cow->dirty[slot] = 0;
+    }
+    free(table);
+    cow->saved_count = count;
+    cow->pending_count = count;
+    return 0;
+}
+
+int disk_cow_open(disk_cow_t* cow, const char* base_path, const char* delta_path, bool discard,
+                  disk_durability_t durability, bool async)
+{
+    struct stat st;
+
+    *cow = (disk_cow_t) {
+        .fd = open(base_path, O_RDONLY | OPEN_BINARY),
+        .delta_fd = -1,
+    };
+    if (cow->fd < 0) {
+        log_perror("[DISK] Could not open the base image");
+        return -1;
+    }
+    if (fstat(cow->fd, &st) != 0) {
+        log_perror("[DISK] Could not stat the base image");
+        close(cow->fd);
+        return -1;
+    }
+    cow->base_size = st.st_size;
+    cow->total_sectors = (st.st_size + DISK_COW_SECTOR_SIZE - 1) / DISK_COW_SECTOR_SIZE;
+    const uint32_t tables = (cow->total_sectors + DISK_COW_TABLE_SIZE - 1) >> DISK_COW_TABLE_BITS;
+    cow->index = calloc(tables + 1, sizeof(uint32_t*));
+    if (cow->index == NULL) {
+        log_err_printf("[DISK] Could not allocate the sector index\n");
+        close(cow->fd);
+        return -1;
+    }
+
+#ifndef _WIN32
+    /* The mapping is never written, so all the instances share the same pages of the base image */
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, cow->fd, 0);
+    if (base != MAP_FAILED) {
+        cow->base = base;
+    }
+#endif
+
+    if (delta_path != NULL) {
+        const int fd = discard ? open(delta_path, O_RDONLY | OPEN_BINARY) :
+                                 open(delta_path, O_RDWR | O_CREAT | OPEN_BINARY, 0644);
+        if (fd < 0 && !discard) {
+            log_perror("[DISK] Could not open the delta");
+            disk_cow_close(cow);
+            return -1;
+        }
+        if (fd >= 0 && cow_load_delta(cow, fd, delta_path) != 0) {
+            close(fd);
+            disk_cow_close(cow);
+            return -1;
+        }
+        if (discard) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        } else {
+            cow->delta_fd = fd;
+            disk_cache_init(&cow->writer, fd, NULL, 0, durability, async);
+        }
+    }
+
+    log_printf("[DISK] %s opened copy-on-write, %u sectors in the delta\n", base_path, cow->count);
+    return 0;
+}
+
+const uint8_t* disk_cow_read(disk_cow_t* cow, uint32_t sector, uint8_t* buffer)
+{
+    const int64_t slot = cow_lookup(cow, sector);
+    if (slot >= 0) {
+        return slot_data(cow, slot);
+    }
+    const uint64_t offset = (uint64_t) sector * DISK_COW_SECTOR_SIZE;
+    if (cow->base != NULL && offset + DISK_COW_SECTOR_SIZE <= cow->base_size) {
+        return cow->base + offset;
+    }
+    read_base(cow, sector, buffer);
+    return buffer;
+}
+
+uint8_t* disk_cow_write(disk_cow_t* cow, uint32_t sector)
+{
+    if (sector >= cow->total_sectors) {
+        return NULL;
+    }
+    int64_t slot = cow_lookup(cow, sector);
+    if (slot >= 0) {
+        cow->dirty[slot] = 1;
+        return slot_data(cow, slot);
+    }
+
+    slot = cow_allocate(cow, sector);
+    if (slot < 0) {
+        log_err_printf("[DISK] Could not allocate a sector in the delta\n");
+        return NULL;
+    }
+    /* The slot is not published yet, so this reads the base image */
+    uint8_t* data = slot_data(cow, slot);
+    const uint8_t* original = disk_cow_read(cow, sector, data);
+    if (original != data) {
+        memcpy(data, original, DISK_COW_SECTOR_SIZE);
+    }
+    cow_publish(cow, sector, slot);
+    return data;
+}
+
+/**
+ * @brief Queue the table sectors holding the entries of the slots added since the last header
+ */
+static void cow_queue_table(disk_cow_t* cow)
+{
+    const uint32_t per_sector = DISK_COW_SECTOR_SIZE / 4;
+    uint8_t buffer[DISK_COW_SECTOR_SIZE];
+
+    for (uint32_t first = cow->saved_count - cow->saved_count % per_sector; first < cow->count; first += per_sector) {
+        memset(buffer, 0, sizeof(buffer));
+        for (uint32_t slot = first; slot < cow->count && slot < first + per_sector; slot++) {
+            put_le32(buffer + (slot - first) * 4, cow->sectors[slot]);
+        }
+        disk_cache_write(&cow->writer, table_offset(first) / DISK_COW_SECTOR_SIZE, buffer);
+    }
+}
+
+bool disk_cow_flush(disk_cow_t* cow, bool sync)
+{
+    if (cow->delta_fd < 0) {
+        return true;
+    }
+    if (disk_cache_busy(&cow->writer)) {
+        return false;
+    }
+
+    if (cow->pending_count != cow->saved_count) {
+        /* The sectors of the previous call are on the disk, the header can now cover them */
+        uint8_t header[DISK_COW_SECTOR_SIZE] = { 0 };
+        memcpy(header, DISK_COW_MAGIC, 8);
+        put_le32(header + 8, DISK_COW_SECTOR_SIZE);
+        put_le32(header + 12, cow->pending_count);
+        put_le32(header + 16, (uint32_t) cow->base_size);
+        put_le32(header + 20, (uint32_t) (cow->base_size >> 32));
+        disk_cache_write(&cow->writer, 0, header);
+        disk_cache_flush(&cow->writer, sync);
+        cow->saved_count = cow->pending_count;
+        /* Sectors may have been modified in the meantime */
+        return false;
+    }
+
+    for (uint32_t slot = 0; slot < cow->count; slot++) {
+        if (cow->dirty[slot]) {
+            disk_cache_write(&cow->writer, slot_offset(cow, slot) / DISK_COW_SECTOR_SIZE, slot_data(cow, slot));
+            cow->dirty[slot] = 0;
+        }
+    }
+    const bool added = cow->count != cow->saved_count;
+    if (added) {
+        cow_queue_table(cow);
+    }
+
+    /* The header must not reach the disk before the sectors it covers, else a crash in between would
+     * leave it pointing to garbage, so they are synced whatever the durability. The cache may have
+     * started writing some of them already when it got full, in which case the sync is still to come. */
+    if (!disk_cache_flush(&cow->writer, sync || added)) {
+        return false;
+    }
+    cow->pending_count = cow->count;
+    return !added;
+}
+
+bool disk_cow_busy(disk_cow_t* cow)
+{
+    return cow->delta_fd >= 0 && (disk_cache_busy(&cow->writer) || cow->pending_count != cow->saved_count);
+}
+
+void disk_cow_close(disk_cow_t* cow)
+{
+    if (cow->fd < 0) {
+        return;
+    }
+    if (cow->delta_fd >= 0) {
+        while (!disk_cow_flush(cow, false)) {
+            disk_cache_wait(&cow->writer);
+        }
+        disk_cache_deinit(&cow->writer);
+        close(cow->delta_fd);
+    }
+#ifndef _WIN32
+    if (cow->base != NULL) {
+        munmap((void*) cow->base, cow->base_size);
+    }
+#endif
+    if (cow->index != NULL) {
+        const uint32_t tables = (cow->total_sectors + DISK_COW_TABLE_SIZE - 1) >> DISK_COW_TABLE_BITS;
+        for (uint32_t i = 0; i < tables; i++) {
+            free(cow->index[i]);
+        }
+        free(cow->index);
+    }
+    for (uint32_t i = 0; i < cow->capacity / DISK_COW_CHUNK_SECTORS; i++) {
+        free(cow->chunks[i]);
+    }
+    free(cow->chunks);
+    free(cow->sectors);
+    free(cow->dirty);
+    close(cow->fd);
+    cow->fd = -1;
+}
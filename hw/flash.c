@@ -4,6 +4,10 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+/* Required for MAP_ANONYMOUS */
+#ifndef _DEFAULT_SOURCE
+    #define _DEFAULT_SOURCE
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,6 +19,9 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifndef _WIN32
+    #include <sys/mman.h>
+#endif
 #include <fcntl.h>
 /* **** */
 #include "utils/helpers.h"
@@ -40,6 +47,9 @@ typedef struct {
     uint8_t  seconds;
 } __attribute__((packed)) romdisk_entry_t;
 
+/* The user program is stored right after the romdisk header */
+#define ROMDISK_HEADER_SIZE 64
+
 typedef enum {
     STATE_IDLE,
     STATE_SOFTWARE_ID,
@@ -59,6 +69,41 @@ typedef enum {
     STATE_PERFORM_ERASE_DELAY,
 } fsm_state_t;
 
+/* Delay without any change after which the changed sectors are written back, in T-states */
+#define FLASH_SYNC_PERIOD   CPUFREQ
+
+
+static void flash_mark_dirty(flash_t* f, uint32_t sector)
+{
+    f->dirty_sectors[sector / 32] |= 1u << (sector % 32);
+    f->dirty = 1;
+    f->modified = true;
+    f->sync_countdown = FLASH_SYNC_PERIOD;
+}
+
+static bool flash_sector_dirty(const flash_t* f, uint32_t sector)
+{
+    return (f->dirty_sectors[sector / 32] >> (sector % 32)) & 1;
+}
+
+/**
+ * @brief Writing a sector after the end of the file would leave a hole of zeroes, mark the erased sectors
+ * in between as dirty so that they are written too
+ */
+static void flash_dirty_gap(flash_t* f, off_t file_size)
+{
+    const uint32_t count = f->size / FLASH_SECTOR_SIZE;
+    uint32_t last = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (flash_sector_dirty(f, i)) {
+            last = i;
+        }
+    }
+    for (uint32_t i = (uint32_t) MIN(file_size / FLASH_SECTOR_SIZE, count); i < last; i++) {
+        f->dirty_sectors[i / 32] |= 1u << (i % 32);
+    }
+}
+
 static uint8_t flash_read(device_t* dev, uint32_t addr)
 {
     flash_t* f = (flash_t*) dev;
@@ -103,6 +148,27 @@ static uint8_t flash_debug_read(device_t* dev, uint32_t addr)
     return f->data[addr];
 }
 
+/**
+ * @brief Direct access to the flash content, only possible for reads in array mode.
+ * Writes always go through the command state machine.
+ */
+static uint8_t* flash_direct(device_t* dev, uint32_t addr, bool write, uint32_t* size)
+{
+    flash_t* f = (flash_t*) dev;
+
+    if (write || addr >= f->size ||
+        f->state == STATE_SOFTWARE_ID ||
+        f->state == STATE_PERFORM_WRITE_DELAY ||
+        f->state == STATE_PERFORM_ERASE_DELAY)
+    {
+        return NULL;
+    }
+    if (*size > f->size - addr) {
+        *size = f->size - addr;
+    }
+    return &f->data[addr];
+}
+
 static void flash_write(device_t* dev, uint32_t addr, uint8_t data)
 {
     flash_t* f = (flash_t*) dev;
@@ -143,7 +209,7 @@ static void flash_write(device_t* dev, uint32_t addr, uint8_t data)
              * Write the value right now to simplify the logic after */
             log_printf("[FLASH] Writing byte 0x%x (& %x = %x) @ 0x%x\n", data, f->data[addr], data & f->data[addr], addr);
             f->data[addr] &= data;
-            f->dirty = 1;
+            flash_mark_dirty(f, addr / FLASH_SECTOR_SIZE);
             /* The byte being written must have bit 7 flipped, DQ6 must be toggled at each read */
             f->writing_byte = data ^ 0x80;
             /* Writing a byte takes 20us on real hardware, register a callback to actually reflect this */
@@ -160,7 +226,7 @@ static void flash_write(device_t* dev, uint32_t addr, uint8_t data)
                 /* Get the corresponding 4KB-sector to erase out of the 22-bit address */
                 const uint32_t sector = addr & 0x3ff000;
                 log_printf("[FLASH] Erasing sector %d @ address 0x%x\n", sector / 4096, sector);
-                f->dirty = 1;
+                flash_mark_dirty(f, sector / FLASH_SECTOR_SIZE);
                 memset(&f->data[sector], 0xff, 4096);
             } else if (data == 0x10 && addr == 0x5555) {
                 /* Chip erase! */
@@ -168,7 +234,9 @@ static void flash_write(device_t* dev, uint32_t addr, uint8_t data)
                 f->state = STATE_PERFORM_ERASE_DELAY;
                 /* Erasing the chip takes 100ms on real hardware */
                 f->ticks_remaining = us_to_tstates(100000);
-                f->dirty = 1;
+                for (uint32_t i = 0; i < f->size / FLASH_SECTOR_SIZE; i++) {
+                    flash_mark_dirty(f, i);
+                }
                 memset(f->data, 0xff, f->size);
             } else {
                 /* Invalid state, try again */
@@ -198,29 +266,94 @@ static void flash_write(device_t* dev, uint32_t addr, uint8_t data)
 }
 
 
-int flash_init(flash_t* f)
+int flash_init(flash_t* f, bool readonly)
 {
     if (f == NULL) {
         return 1;
     }
-    /* Empty flash contains FF bytes*/
-    memset(f, 0xFF, sizeof(*f));
+    memset(f, 0, sizeof(*f));
     f->size = NOR_FLASH_SIZE_KB;
     f->state = STATE_IDLE;
-    f->dirty = 0;
-
-#if CONFIG_NOR_FLASH_DYNAMIC_ARRAY
-    f->data = malloc(f->size);
-    if (f->data == NULL) {
-        log_err_printf("[FLASH] ERROR: could not allocate enough memory for the NOR flash\n");
-        return 2;
+    f->readonly = readonly;
+    f->writer_fd = -1;
+
+#ifndef _WIN32
+    /* The array is a mapping so that the ROM file can later be mapped at the same address */
+    void* data = mmap(NULL, f->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data != MAP_FAILED) {
+        f->data = data;
+        f->mapped = true;
     }
 #endif
+    if (f->data == NULL) {
+        f->data = malloc(f->size);
+        if (f->data == NULL) {
+            log_err_printf("[FLASH] ERROR: could not allocate enough memory for the NOR flash\n");
+            return 2;
+        }
+    }
+    /* Empty flash contains FF bytes*/
+    memset(f->data, 0xFF, f->size);
 
     device_init_mem_debug(DEVICE(f), "nor_flash_dev", flash_read, flash_write, flash_debug_read, f->size);
+    device_register_direct(DEVICE(f), flash_direct);
     return 0;
 }
 
+/**
+ * @brief Hand the changed sectors to the background writer, the emulation doesn't wait for the file
+ */
+static void flash_write_back(flash_t* flash)
+{
+    struct stat st;
+
+    if (flash->writer_fd < 0) {
+        flash->writer_fd = open(flash->file_name, O_WRONLY | O_CREAT | OPEN_BINARY, 0666);
+        if (flash->writer_fd < 0) {
+            log_perror("[FLASH] Could not open file to dump NOR flash");
+            return;
+        }
+        disk_cache_init(&flash->writer, flash->writer_fd, NULL, 0, DISK_DURABILITY_NONE, true);
+    }
+    /* The size of the file is only known once the previous write-back is over, retry on the next tick */
+    if (disk_cache_busy(&flash->writer)) {
+        flash->sync_countdown = 0;
+        return;
+    }
+    if (fstat(flash->writer_fd, &st) != 0) {
+        log_perror("[FLASH] Could not stat file to dump NOR flash");
+        return;
+    }
+    flash_dirty_gap(flash, st.st_size);
+
+    const uint32_t per_sector = FLASH_SECTOR_SIZE / DISK_CACHE_SECTOR_SIZE;
+    for (uint32_t i = 0; i < flash->size / FLASH_SECTOR_SIZE; i++) {
+        if (!flash_sector_dirty(flash, i)) {
+            continue;
+        }
+        for (uint32_t j = 0; j < per_sector; j++) {
+            disk_cache_write(&flash->writer, i * per_sector + j,
+                             flash->data + (size_t) i * FLASH_SECTOR_SIZE + j * DISK_CACHE_SECTOR_SIZE);
+        }
+    }
+    disk_cache_flush(&flash->writer, false);
+
+    flash->dirty = 0;
+    memset(flash->dirty_sectors, 0, sizeof(flash->dirty_sectors));
+}
+
+/**
+ * @brief Wait for the background writer to finish and close its file
+ */
+static void flash_stop_writer(flash_t* flash)
+{
+    if (flash->writer_fd >= 0) {
+        disk_cache_deinit(&flash->writer);
+        close(flash->writer_fd);
+        flash->writer_fd = -1;
+    }
+}
+
 void flash_tick(flash_t* flash, int elapsed_tstates)
 {
     if (flash->state == STATE_PERFORM_ERASE_DELAY || flash->state == STATE_PERFORM_WRITE_DELAY) {
@@ -229,6 +362,37 @@ void flash_tick(flash_t* flash, int elapsed_tstates)
             flash->state = STATE_IDLE;
         }
     }
+
+    if (flash->dirty && flash->file_name != NULL && !flash->readonly) {
+        flash->sync_countdown -= elapsed_tstates;
+        if (flash->sync_countdown <= 0) {
+            /* Retry after a whole period in case of failure */
+            flash->sync_countdown = FLASH_SYNC_PERIOD;
+            flash_write_back(flash);
+        }
+    }
+}
+
+/**
+ * @brief Check whether two status describe the same, unmodified, file
+ */
+static bool flash_same_file(const struct stat* a, const struct stat* b)
+{
+#if defined(__APPLE__)
+    const long nsec_a = a->st_mtimespec.tv_nsec;
+    const long nsec_b = b->st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    const long nsec_a = 0;
+    const long nsec_b = 0;
+#else
+    const long nsec_a = a->st_mtim.tv_nsec;
+    const long nsec_b = b->st_mtim.tv_nsec;
+#endif
+    /* Without sub-second timestamps, a file rewritten within the same second would look unchanged,
+     * consider it modified so that it is read again */
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_size == b->st_size && a->st_mtime == b->st_mtime &&
+           nsec_a != 0 && nsec_a == nsec_b;
 }
 
 static inline uint16_t flash_dereference(flash_t* flash, uint16_t os_addr, uint16_t data_addr)
@@ -294,15 +458,99 @@ static int flash_is_init_path(const char *s)
 }
 
 
+/**
+ * @brief Write `len` bytes to the flash, skipping the ones that already have the right value so that the
+ * pages of the ROM mapping that don't change stay shared.
+ *
+ * @returns the number of bytes modified
+ */
+static uint32_t flash_patch_bytes(uint8_t* dst, const uint8_t* src, size_t len)
+{
+    uint32_t changed = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (dst[i] != src[i]) {
+            dst[i] = src[i];
+            changed++;
+        }
+    }
+    return changed;
+}
+
+
+/**
+ * @brief Read the user program and write it, with its romdisk entry, over the romdisk. Only the bytes
+ * that differ from the program previously written, if any, are modified.
+ */
+static int flash_patch_romdisk(flash_t* flash, int fd, size_t size)
+{
+    flash_romdisk_t* romdisk = &flash->romdisk;
+
+    if (size > (flash->size - romdisk->offset - ROMDISK_HEADER_SIZE)) {
+        log_err_printf("[FLASH] User file is too big to fit in ROM\n");
+        return -1;
+    }
+
+    const uint32_t length = ROMDISK_HEADER_SIZE + size;
+    /* Keep the ROM content before overwriting it, to restore it if the program gets smaller. The bytes
+     * after the ones written so far are still the ROM's */
+    if (length > romdisk->pristine_size) {
+        uint8_t* pristine = realloc(romdisk->pristine, length);
+        if (pristine == NULL) {
+            log_err_printf("[FLASH] No more memory!\n");
+            return -1;
+        }
+        memcpy(pristine + romdisk->pristine_size, flash->data + romdisk->offset + romdisk->pristine_size,
+               length - romdisk->pristine_size);
+        romdisk->pristine = pristine;
+        romdisk->pristine_size = length;
+    }
+
+    uint8_t* program = malloc(size + 1);
+    if (program == NULL) {
+        log_err_printf("[FLASH] No more memory!\n");
+        return -1;
+    }
+    const ssize_t rd = read(fd, program, size);
+    if (rd != (ssize_t) size) {
+        log_perror("[FLASH] Could not read user file: %s\n", path_sanitize(romdisk->path));
+        free(program);
+        return -1;
+    }
+
+    /* FIXME: Made the assumption that the host CPU is little-endian */
+    romdisk_entry_t entry = {
+        /* Single entry in the romdisk */
+        .entry = 1,
+        .size = size,
+        .offset = ROMDISK_HEADER_SIZE,
+        /* Ignore the date, let them be 0 */
+    };
+    memcpy(entry.name, romdisk->name, sizeof(entry.name));
+
+    uint8_t* dst = flash->data + romdisk->offset;
+    uint32_t changed = flash_patch_bytes(dst, (const uint8_t*) &entry, sizeof(entry));
+    changed += flash_patch_bytes(dst + ROMDISK_HEADER_SIZE, program, size);
+    if (romdisk->length > length) {
+        changed += flash_patch_bytes(dst + length, romdisk->pristine + length, romdisk->length - length);
+    }
+    romdisk->length = length;
+    free(program);
+    return (int) changed;
+}
+
+
 static int flash_override_romdisk(flash_t* flash, const char* userprog_filename)
 {
+    flash_romdisk_t* romdisk = &flash->romdisk;
     int err = 0;
     int romdisk_offset = 0;
-    const int romdisk_header = 64;
     uint32_t config_addr = 0;
     char* path = strdup(userprog_filename);
-    if (path == NULL) {
+    char* argument = strdup(userprog_filename);
+    if (path == NULL || argument == NULL) {
         log_err_printf("[FLASH] No more memory!\n");
+        free(path);
+        free(argument);
         return -1;
     }
 
@@ -310,6 +558,8 @@ static int flash_override_romdisk(flash_t* flash, const char* userprog_filename)
     const int zealos_offset = flash_find_os_page(flash, &config_addr);
     if (zealos_offset == -1) {
         log_err_printf("[FLASH] Could not find Zeal 8-bit OS in the given ROM. Cannot override init program.\n");
+        free(path);
+        free(argument);
         return 1;
     }
 
@@ -329,12 +579,25 @@ static int flash_override_romdisk(flash_t* flash, const char* userprog_filename)
         /* Make the assumption romdisk is right after the OS */
         romdisk_offset = zealos_offset + 0x4000;
     }
+    romdisk->argument = argument;
+    romdisk->path = path;
+    romdisk->offset = romdisk_offset;
 
-    int fd = open(path, O_RDONLY);
+    /* Find the name pointer of the init program from the configuration structure */
+    const uint16_t os_init_addr = flash_dereference(flash, zealos_offset, config_addr + 0xa);
+    const char* os_init_path = (const char*) (&flash->data[zealos_offset + os_init_addr]);
+    if (flash_is_init_path(os_init_path)) {
+        /* Escape the A:/ prefix */
+        snprintf(romdisk->name, sizeof(romdisk->name), "%s", os_init_path + 3);
+    } else {
+        strcpy(romdisk->name, "init.bin");
+    }
+    log_printf("Loading user program as %s\n", romdisk->name);
+
+    int fd = open(path, O_RDONLY | OPEN_BINARY);
     if (fd < 0) {
         log_perror("[FLASH] Could not open user file: %s\n", path_sanitize(path));
-        err = fd;
-        goto ret;
+        return fd;
     }
 
     /* Get the file size and make sure it's not too big for the flash */
@@ -344,44 +607,12 @@ static int flash_override_romdisk(flash_t* flash, const char* userprog_filename)
         err = -1;
         goto ret_close;
     }
-    const size_t size = st.st_size;
 
-    if (size > (flash->size - romdisk_offset - romdisk_header)) {
-        log_err_printf("[FLASH] User file is too big to fit in ROM\n");
-        err = -1;
-        goto ret_close;
-    }
-
-    /* Generate a small header for the romdisk */
-    uint8_t* romdisk = flash->data + romdisk_offset;
-    /* FIXME: Made the assumption that the host CPU is little-endian */
-    romdisk_entry_t entry = {
-        /* Single entry in the romdisk */
-        .entry = 1,
-        .size = size,
-        .offset = romdisk_header,
-        /* Ignore the date, let them be 0 */
-    };
-    /* Find the name pointer of the init program from the configuration structure */
-    const uint16_t os_init_addr = flash_dereference(flash, zealos_offset, config_addr + 0xa);
-    const char* os_init_path = (const char*) (&flash->data[zealos_offset + os_init_addr]);
-    if (flash_is_init_path(os_init_path)) {
-        /* Escape the A:/ prefix */
-        snprintf(entry.name, sizeof(entry.name), "%s", os_init_path + 3);
-    } else {
-        strcpy(entry.name, "init.bin");
-    }
-    log_printf("Loading user program as %s\n", entry.name);
-
-    memcpy(romdisk, &entry, sizeof(entry));
-
-    /* Read the data directly in flash */
-    int rd = read(fd, flash->data + romdisk_offset + romdisk_header, flash->size);
-    if (rd < 0) {
-        log_perror("[FLASH] Could not read user file: %s\n", path);
-        err = rd;
+    err = flash_patch_romdisk(flash, fd, st.st_size);
+    if (err < 0) {
         goto ret_close;
     }
+    romdisk->stat = st;
 
     log_printf("[FLASH] User program %s loaded successfully @ 0x%x\n", path_sanitize(path), romdisk_offset);
 
@@ -389,12 +620,89 @@ static int flash_override_romdisk(flash_t* flash, const char* userprog_filename)
     /* Fall-through */
 ret_close:
     close(fd);
-ret:
-    free(path);
     return err;
 }
 
 
+/**
+ * @brief Write the user program again over the romdisk, only if it changed since it was last written
+ */
+static int flash_refresh_romdisk(flash_t* flash)
+{
+    flash_romdisk_t* romdisk = &flash->romdisk;
+    struct stat st;
+
+    int fd = open(romdisk->path, O_RDONLY | OPEN_BINARY);
+    if (fd < 0) {
+        log_perror("[FLASH] Could not open user file: %s\n", path_sanitize(romdisk->path));
+        return fd;
+    }
+    if (fstat(fd, &st)) {
+        log_perror("[FLASH] Could not stat user file: %s\n", path_sanitize(romdisk->path));
+        close(fd);
+        return -1;
+    }
+
+    int err = 0;
+    if (flash_same_file(&st, &romdisk->stat)) {
+        log_printf("[FLASH] User program %s unchanged\n", path_sanitize(romdisk->path));
+    } else {
+        err = flash_patch_romdisk(flash, fd, st.st_size);
+        if (err >= 0) {
+            log_printf("[FLASH] User program %s reloaded, %d bytes changed\n", path_sanitize(romdisk->path), err);
+            romdisk->stat = st;
+            err = 0;
+        }
+    }
+    close(fd);
+    return err;
+}
+
+
+/**
+ * @brief Forget the user program written over the romdisk, the flash content was replaced
+ */
+static void flash_romdisk_clear(flash_romdisk_t* romdisk)
+{
+    free(romdisk->argument);
+    free(romdisk->path);
+    free(romdisk->pristine);
+    memset(romdisk, 0, sizeof(*romdisk));
+}
+
+
+/**
+ * @brief Map the ROM file privately over the flash array, so that all the instances using the same file
+ * share its pages until they modify them. Only done in read-only mode: a write-back from another
+ * instance would show through the pages not modified yet, and truncating the file would fault on them.
+ *
+ * @returns the number of bytes of the flash backed by the file, -1 if the file couldn't be mapped
+ */
+static int flash_map_file(flash_t* flash, int fd)
+{
+#ifdef _WIN32
+    (void) flash;
+    (void) fd;
+    return -1;
+#else
+    struct stat st;
+
+    if (!flash->mapped || !flash->readonly || fstat(fd, &st) != 0) {
+        return -1;
+    }
+    const size_t size = MIN((size_t) st.st_size, flash->size);
+    if (size == 0) {
+        return 0;
+    }
+    /* Replace the beginning of the existing mapping, the rest stays anonymous */
+    if (mmap(flash->data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        return -1;
+    }
+    return (int) size;
+#endif
+}
+
+
 int flash_load_from_file(flash_t* flash, const char* rom_filename, const char* userprog_filename)
 {
     char rom_path[PATH_MAX];
@@ -437,22 +745,52 @@ int flash_load_from_file(flash_t* flash, const char* rom_filename, const char* u
         }
     }
 
-    int fd = open(rom_path, O_RDONLY);
+    /* When the flash still holds the content of the ROM file, only the user program may have to be written
+     * again, no need to read the ROM and look for the OS */
+    struct stat rom_st;
+    const bool rom_unchanged = !flash->modified && flash->rom_path != NULL && strcmp(flash->rom_path, rom_path) == 0 &&
+                               stat(rom_path, &rom_st) == 0 && flash_same_file(&rom_st, &flash->rom_stat);
+    if (rom_unchanged && userprog_filename != NULL && flash->romdisk.argument != NULL &&
+        strcmp(flash->romdisk.argument, userprog_filename) == 0) {
+        flash->state = STATE_IDLE;
+        return flash_refresh_romdisk(flash);
+    }
+
+    /* The file is about to be read again, don't lose the changes made since the last write-back */
+    flash_stop_writer(flash);
+    if (flash->dirty && flash->file_name != NULL) {
+        flash_save_to_file(flash, flash->file_name);
+    }
+
+    int fd = open(rom_path, O_RDONLY | OPEN_BINARY);
     if (fd < 0) {
         log_perror("[FLASH] Could not open file to load");
         return fd;
     }
+    flash_romdisk_clear(&flash->romdisk);
+    free(flash->rom_path);
+    flash->rom_path = NULL;
 
-    int rd = read(fd, flash->data, flash->size);
+    int rd = flash_map_file(flash, fd);
+    if (rd < 0) {
+        rd = read(fd, flash->data, flash->size);
+    }
     if (rd < 0) {
         log_perror("[FLASH] Could not read file to load");
         close(fd);
         return rd;
     }
+    /* Empty flash contains FF bytes, including after the end of the file */
+    memset(flash->data + rd, 0xFF, flash->size - rd);
 
     log_printf("[FLASH] %s loaded successfully\n", path_sanitize(rom_path));
 
+    if (fstat(fd, &flash->rom_stat) == 0) {
+        flash->rom_path = strdup(rom_path);
+    }
     close(fd);
+    flash->file_name = rom_filename;
+    flash->modified = false;
 
     /* Try to load the user program, if any */
     if (userprog_filename != NULL ) {
@@ -462,6 +800,7 @@ int flash_load_from_file(flash_t* flash, const char* rom_filename, const char* u
 
     flash->state = STATE_IDLE;
     flash->dirty = 0;
+    memset(flash->dirty_sectors, 0, sizeof(flash->dirty_sectors));
 
     return 0;
 }
@@ -473,26 +812,68 @@ int flash_save_to_file(flash_t* flash, const char* name)
         return -1;
     }
 
+    /* The sectors written here must land after the ones being written in the background */
+    flash_stop_writer(flash);
+
     /* No change performed on the flash, nothing to write */
-    if (flash->dirty == 0) {
+    if (flash->dirty == 0 || flash->readonly) {
         return 0;
     }
 
-    int fd = open(name, O_WRONLY | O_TRUNC | O_CREAT, 0666);
+    int fd = open(name, O_WRONLY | O_CREAT | OPEN_BINARY, 0666);
     if (fd < 0) {
         log_perror("[FLASH] Could not create file to dump NOR flash");
         return fd;
     }
 
-    int wr = write(fd, flash->data, flash->size);
-    if (wr < 0) {
-        log_perror("[FLASH] Could not dump to file");
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        log_perror("[FLASH] Could not stat file to dump NOR flash");
         close(fd);
-        return wr;
+        return -1;
+    }
+    flash_dirty_gap(flash, st.st_size);
+
+    /* Write the runs of consecutive sectors with a single call */
+    const uint32_t count = flash->size / FLASH_SECTOR_SIZE;
+    int written = 0;
+    for (uint32_t i = 0; i < count; ) {
+        if (!flash_sector_dirty(flash, i)) {
+            i++;
+            continue;
+        }
+        uint32_t end = i + 1;
+        while (end < count && flash_sector_dirty(flash, end)) {
+            end++;
+        }
+        const size_t length = (size_t) (end - i) * FLASH_SECTOR_SIZE;
+        const ssize_t wr = os_pwrite(fd, flash->data + (size_t) i * FLASH_SECTOR_SIZE, length,
+                                     (int64_t) i * FLASH_SECTOR_SIZE);
+        if (wr != (ssize_t) length) {
+            log_perror("[FLASH] Could not dump to file");
+            close(fd);
+            return -1;
+        }
+        written += end - i;
+        i = end;
     }
 
-    log_printf("[FLASH] Dump saved to %s successfully\n", name);
+    log_printf("[FLASH] %d sector(s) saved to %s successfully\n", written, name);
 
+    flash->dirty = 0;
+    memset(flash->dirty_sectors, 0, sizeof(flash->dirty_sectors));
     close(fd);
     return 0;
 }
+
+
+void flash_deinit(flash_t* flash)
+{
+    if (flash == NULL) {
+        return;
+    }
+    flash_stop_writer(flash);
+    flash_romdisk_clear(&flash->romdisk);
+    free(flash->rom_path);
+    flash->rom_path = NULL;
+}
@@ -20,10 +20,16 @@
 #include <limits.h>
 #include <time.h>
 #include <libgen.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 #include "hw/hostfs.h"
 #include "utils/log.h"
 #include "utils/paths.h"
+#include "utils/pages.h"
 
 #define MIN(a,b)    ((a) < (b) ? (a) : (b))
 
@@ -64,6 +70,12 @@
 #define ZOS_FL_APPEND       (2 << 2)
 #define ZOS_FL_CREAT        (4 << 2)
 
+#ifdef __linux__
+/* Modifications on the host that invalidate the cached status */
+#define HOSTFS_WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | \
+                             IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+#endif
+
 
 static int descriptor_valid(hostfs_fd_t* desc)
 {
@@ -142,20 +154,40 @@ static char *resolve_path(const char *path, int prefix_len)
 
 
 
-static char *get_path(zeal_hostfs_t *host)
+/**
+ * @brief Read the NULL-terminated path given by the guest, page by page when possible
+ */
+static void read_guest_path(zeal_hostfs_t *host, uint16_t virt_addr, char path[HOSTFS_GUEST_PATH_MAX])
 {
-    uint16_t virt_addr = (host->registers[2] << 8) | host->registers[1];
-    static char full_path[PATH_MAX];
-    char path[256];
     size_t i = 0;
-    while (i < sizeof(path) - 1) {
-        const uint8_t byte = memory_read_byte(host->host_ops, virt_addr++);
-        if (byte == 0) {
+
+    while (i < HOSTFS_GUEST_PATH_MAX - 1) {
+        uint32_t count = HOSTFS_GUEST_PATH_MAX - 1 - i;
+        const uint8_t* src = memory_direct(host->host_ops, virt_addr, false, &count);
+        if (src == NULL) {
+            const uint8_t byte = memory_read_byte(host->host_ops, virt_addr++);
+            if (byte == 0) {
+                break;
+            }
+            path[i++] = (char) byte;
+            continue;
+        }
+        const uint8_t* end = memchr(src, 0, count);
+        const size_t length = end ? (size_t) (end - src) : count;
+        memcpy(path + i, src, length);
+        i += length;
+        virt_addr += length;
+        if (end) {
             break;
         }
-        path[i++] = (char) byte;
     }
     path[i] = '\0';
+}
+
+
+static char *resolve_guest_path(zeal_hostfs_t *host, const char *path)
+{
+    static char full_path[PATH_MAX];
 
     /* Concatenate the root path and the relative path */
     if ((size_t) snprintf(full_path, sizeof(full_path), "%s/%s", host->root_path, path) >= sizeof(full_path)) {
@@ -194,6 +226,243 @@ static char *get_path(zeal_hostfs_t *host)
     return full_path;
 }
 
+
+static uint32_t cache_hash(const char *key)
+{
+    /* FNV-1a, never 0 so that it can't be mistaken for a free entry */
+    uint32_t hash = 2166136261u;
+    while (*key) {
+        hash = (hash ^ (uint8_t) *key++) * 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+
+/**
+ * @brief Mark all the cached status as outdated, the resolved paths remain valid
+ */
+static void cache_invalidate(hostfs_cache_t *cache)
+{
+    cache->stat_gen++;
+}
+
+
+/**
+ * @brief Invalidate the cached status if anything changed in the watched directories
+ */
+static void cache_poll_watch(hostfs_cache_t *cache)
+{
+#ifdef __linux__
+    /* The events themselves don't matter, any of them invalidates the whole cache */
+    char events[4096];
+    bool changed = false;
+
+    if (cache->watch_fd < 0) {
+        return;
+    }
+    while (read(cache->watch_fd, events, sizeof(events)) > 0) {
+        changed = true;
+    }
+    if (changed) {
+        cache_invalidate(cache);
+    }
+#else
+    (void) cache;
+#endif
+}
+
+
+/**
+ * @brief Start watching the root directory, the status are only cached if this succeeds
+ */
+static void cache_start_watch(hostfs_cache_t *cache, const char *root)
+{
+#ifdef __linux__
+    cache->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cache->watch_fd < 0 || inotify_add_watch(cache->watch_fd, root, HOSTFS_WATCH_EVENTS) < 0) {
+        log_perror("[HostFS] Could not watch the root directory, disabling the status cache");
+        if (cache->watch_fd >= 0) {
+            close(cache->watch_fd);
+            cache->watch_fd = -1;
+        }
+        return;
+    }
+    cache->cache_stat = true;
+#else
+    (void) cache;
+    (void) root;
+    log_printf("[HostFS] Host directory changes cannot be watched, disabling the status cache\n");
+#endif
+}
+
+
+/**
+ * @brief Watch the directory containing `path`, so that modifications made to it on the host
+ * invalidate its cached status
+ */
+static void cache_watch_parent(hostfs_cache_t *cache, const char *path)
+{
+#ifdef __linux__
+    char parent[PATH_MAX];
+
+    if (cache->watch_fd < 0) {
+        return;
+    }
+    strcpy(parent, path);
+    char *dir = dirname(parent);
+    /* Adding a watch to an already watched directory is harmless. If the parent doesn't exist,
+     * watch its closest existing ancestor instead, which will report the parent's creation */
+    while (inotify_add_watch(cache->watch_fd, dir, HOSTFS_WATCH_EVENTS) < 0) {
+        if ((errno != ENOENT && errno != ENOTDIR) || strcmp(dir, "/") == 0 || strcmp(dir, ".") == 0) {
+            /* The status of this entry can't be trusted anymore, stop caching them altogether */
+            log_perror("[HostFS] Could not watch directory, disabling the status cache");
+            cache->cache_stat = false;
+            return;
+        }
+        dir = dirname(dir);
+    }
+#else
+    (void) cache;
+    (void) path;
+#endif
+}
+
+
+static hostfs_cache_entry_t *cache_lookup(hostfs_cache_t *cache, const char *key)
+{
+    const uint32_t hash = cache_hash(key);
+
+    for (int i = 0; i < HOSTFS_CACHE_ENTRIES; i++) {
+        hostfs_cache_entry_t *entry = &cache->entries[i];
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            entry->last_use = ++cache->use_counter;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Store a resolved path in the cache, replacing the least recently used entry if full
+ */
+static hostfs_cache_entry_t *cache_insert(hostfs_cache_t *cache, const char *key, const char *path)
+{
+    hostfs_cache_entry_t *entry = &cache->entries[0];
+
+    for (int i = 1; i < HOSTFS_CACHE_ENTRIES && entry->hash != 0; i++) {
+        if (cache->entries[i].hash == 0 || cache->entries[i].last_use < entry->last_use) {
+            entry = &cache->entries[i];
+        }
+    }
+
+    free(entry->key);
+    free(entry->path);
+    memset(entry, 0, sizeof(*entry));
+    entry->key = strdup(key);
+    entry->path = strdup(path);
+    if (entry->key == NULL || entry->path == NULL) {
+        free(entry->key);
+        free(entry->path);
+        memset(entry, 0, sizeof(*entry));
+        return NULL;
+    }
+    entry->hash = cache_hash(key);
+    entry->last_use = ++cache->use_counter;
+    return entry;
+}
+
+
+/**
+ * @brief Same as `stat` on the request's path, served from the cache when possible
+ */
+static int cached_stat(zeal_hostfs_t *host, hostfs_req_t *req, struct stat *st)
+{
+    hostfs_cache_t *cache = &host->cache;
+    hostfs_cache_entry_t *entry = req->entry;
+
+    if (entry == NULL || !cache->cache_stat) {
+        return stat(req->path, st);
+    }
+
+    cache_poll_watch(cache);
+    if (entry->stat_gen != cache->stat_gen) {
+        /* Watch the parent before the stat, a change right after it must invalidate the result */
+        cache_watch_parent(cache, req->path);
+        entry->stat_ret = stat(req->path, &entry->st);
+        entry->stat_gen = cache->stat_gen;
+    }
+    *st = entry->st;
+    return entry->stat_ret;
+}
+
+
+/**
+ * @brief Same as `cached_stat`, but the overlay entry of the path, if any, takes precedence
+ *
+ * @param node Set to the overlay node of the path, NULL if the host entry is the visible one
+ */
+static int visible_stat(zeal_hostfs_t *host, hostfs_req_t *req, hostfs_ovl_node_t **node, struct stat *st)
+{
+    *node = NULL;
+    if (host->overlay.enabled) {
+        *node = hostfs_ovl_find(&host->overlay, req->path);
+        if (*node != NULL) {
+            return hostfs_ovl_stat(*node, st);
+        }
+    }
+    return cached_stat(host, req, st);
+}
+
+
+/**
+ * @brief Check whether the parent of `path` is a directory visible to the guest, with the overlay enabled
+ */
+static bool overlay_parent_is_dir(zeal_hostfs_t *host, const char *path)
+{
+    char parent[PATH_MAX];
+    struct stat st;
+
+    strcpy(parent, path);
+    char *sep = strrchr(parent, '/');
+    if (sep == NULL) {
+        return false;
+    }
+    *sep = '\0';
+
+    const hostfs_ovl_node_t *node = hostfs_ovl_find(&host->overlay, parent);
+    if (node != NULL) {
+        return node->type == HOSTFS_OVL_DIR;
+    }
+    return stat(parent, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+
+static char *get_path(zeal_hostfs_t *host)
+{
+    uint16_t virt_addr = (host->registers[2] << 8) | host->registers[1];
+    char path[HOSTFS_GUEST_PATH_MAX];
+
+    read_guest_path(host, virt_addr, path);
+    if (host->cache.mode == HOSTFS_CACHE_OFF) {
+        return resolve_guest_path(host, path);
+    }
+
+    hostfs_cache_entry_t *entry = cache_lookup(&host->cache, path);
+    if (entry == NULL) {
+        char *resolved = resolve_guest_path(host, path);
+        if (resolved == NULL) {
+            return NULL;
+        }
+        entry = cache_insert(&host->cache, path, resolved);
+        if (entry == NULL) {
+            return resolved;
+        }
+    }
+    host->req.entry = entry;
+    return entry->path;
+}
+
 static FILE *fopen_with_flags(const char *path, int zos_flags)
 {
     int open_flags = 0;
@@ -248,12 +517,57 @@ static FILE *fopen_with_flags(const char *path, int zos_flags)
     return file;
 }
 
-static void populate_opendir(zeal_hostfs_t *host, char* path)
+static int find_free_descriptor(zeal_hostfs_t *host)
+{
+    for (int i = 0; i < MAX_OPENED_FILES; i++) {
+        if (!descriptor_valid(&host->descriptors[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Open a directory with the overlay enabled, its content is merged with the host one
+ */
+static void populate_overlay_dir(zeal_hostfs_t *host, hostfs_req_t *req)
+{
+    hostfs_ovl_listing_t *listing = hostfs_ovl_list(&host->overlay, req->path);
+    if (listing == NULL) {
+        req->status = ZOS_NO_SUCH_ENTRY;
+        return;
+    }
+
+    const int i = find_free_descriptor(host);
+    if (i < 0) {
+        hostfs_ovl_listing_free(listing);
+        req->status = ZOS_CANNOT_REGISTER_MORE;
+        return;
+    }
+
+    hostfs_fd_t* fd = &host->descriptors[i];
+    strncpy(fd->name, basename(req->path), ZOS_MAX_NAME_LENGTH);
+    fd->listing = listing;
+    fd->is_dir = 1;
+    fd->is_overlay = 1;
+    req->registers[4] = (uint8_t) i;
+    /* Tell the Z80 this is a directory */
+    req->registers[5] = 1;
+    req->status = ZOS_SUCCESS;
+}
+
+static void populate_opendir(zeal_hostfs_t *host, hostfs_req_t *req)
 {
+    if (host->overlay.enabled) {
+        populate_overlay_dir(host, req);
+        return;
+    }
+
+    char *path = req->path;
     DIR *dir = opendir(path);
 
     if (!dir) {
-        set_status(host, ZOS_NO_SUCH_ENTRY);
+        req->status = ZOS_NO_SUCH_ENTRY;
         return;
     }
 
@@ -266,48 +580,106 @@ static void populate_opendir(zeal_hostfs_t *host, char* path)
 #endif
             fd->dir = dir;
             fd->is_dir = 1;
-            host->registers[4] = (uint8_t) i;
+            req->registers[4] = (uint8_t) i;
             /* Tell the Z80 this is a directory */
-            host->registers[5] = 1;
-            set_status(host, ZOS_SUCCESS);
+            req->registers[5] = 1;
+            req->status = ZOS_SUCCESS;
             return;
         }
     }
 
     closedir(dir);
-    set_status(host, ZOS_CANNOT_REGISTER_MORE);
+    req->status = ZOS_CANNOT_REGISTER_MORE;
 }
 
-static void fs_open(zeal_hostfs_t *host)
+/**
+ * @brief Open a file in the overlay. A host file is only read when the guest accesses a part it
+ * didn't write yet, a new file is only kept in memory.
+ */
+static void overlay_open(zeal_hostfs_t *host, hostfs_req_t *req, hostfs_ovl_node_t *node,
+                         const struct stat *st, uint8_t flags)
 {
-    char *path = get_path(host);
-    struct stat st;
+    if (st == NULL) {
+        if (!overlay_parent_is_dir(host, req->path)) {
+            req->status = ZOS_NO_SUCH_ENTRY;
+            return;
+        }
+        /* Any node at this path is a whiteout that the new file replaces */
+        node = NULL;
+    }
 
-    if (path == NULL) {
+    const int i = find_free_descriptor(host);
+    if (i < 0) {
+        req->status = ZOS_CANNOT_REGISTER_MORE;
         return;
     }
 
-    int exists = (stat(path, &st) == 0);
+    if (node == NULL) {
+        const uint32_t base_size = st ? (uint32_t) MIN(st->st_size, UINT32_MAX) : 0;
+        node = hostfs_ovl_create(&host->overlay, req->path, HOSTFS_OVL_FILE, base_size, false);
+        if (node == NULL) {
+            req->status = ZOS_FAILURE;
+            return;
+        }
+    }
+    if (flags & ZOS_FL_TRUNC) {
+        hostfs_ovl_truncate(node);
+    }
+
+    hostfs_fd_t* fd = &host->descriptors[i];
+    strncpy(fd->name, basename(req->path), ZOS_MAX_NAME_LENGTH);
+    hostfs_ovl_acquire(node);
+    fd->node = node;
+    fd->is_dir = 0;
+    fd->is_overlay = 1;
+    fd->append = (flags & ZOS_FL_APPEND) ? 1 : 0;
+    req->registers[0] = (node->size >> 0) & 0xFF;
+    req->registers[1] = (node->size >> 8) & 0xFF;
+    req->registers[2] = (node->size >> 16) & 0xFF;
+    req->registers[3] = (node->size >> 24) & 0xFF;
+    req->registers[4] = (uint8_t) i;
+    /* Tell the Z80 this is a file (not directory) */
+    req->registers[5] = 0;
+    req->status = ZOS_SUCCESS;
+}
+
+static void fs_open(zeal_hostfs_t *host, hostfs_req_t *req)
+{
+    char *path = req->path;
+    hostfs_ovl_node_t *node = NULL;
+    struct stat st;
+
+    int exists = (visible_stat(host, req, &node, &st) == 0);
 
     /* Check if the path points to a directory, if yes, switch to opendir */
     if (exists && S_ISDIR(st.st_mode)) {
-        populate_opendir(host, path);
+        populate_opendir(host, req);
         return;
     }
 
-    uint8_t flags = host->registers[0];
+    uint8_t flags = req->registers[0];
 
     /* If it doesn't exist and CREAT is not set, error */
     if(!exists && !(flags & ZOS_FL_CREAT)) {
-        set_status(host, ZOS_NO_SUCH_ENTRY);
+        req->status = ZOS_NO_SUCH_ENTRY;
+        return;
+    }
+
+    /* With the overlay, only the host files opened read-only and untouched by the guest are opened as is */
+    if (host->overlay.enabled && (node != NULL || !exists || (flags & 0x3) != ZOS_FL_RDONLY)) {
+        overlay_open(host, req, node, exists ? &st : NULL, flags);
         return;
     }
 
     FILE *file = fopen_with_flags(path, flags);
     if (!file) {
-        set_status(host, ZOS_NO_SUCH_ENTRY);
+        req->status = ZOS_NO_SUCH_ENTRY;
         return;
     }
+    /* The file was either created or truncated */
+    if (!exists || (flags & ZOS_FL_TRUNC)) {
+        cache_invalidate(&host->cache);
+    }
     for (int i = 0; i < MAX_OPENED_FILES; i++) {
         hostfs_fd_t* fd = &host->descriptors[i];
         if (!descriptor_valid(fd)) {
@@ -316,49 +688,92 @@ static void fs_open(zeal_hostfs_t *host)
             fd->is_dir = 0;
             /* If file was just created, st may be uninitialized, so stat again */
             if (!exists) stat(path, &st);
-            host->registers[0] = (st.st_size >> 0) & 0xFF;
-            host->registers[1] = (st.st_size >> 8) & 0xFF;
-            host->registers[2] = (st.st_size >> 16) & 0xFF;
-            host->registers[3] = (st.st_size >> 24) & 0xFF;
-            host->registers[4] = (uint8_t) i;
+            req->registers[0] = (st.st_size >> 0) & 0xFF;
+            req->registers[1] = (st.st_size >> 8) & 0xFF;
+            req->registers[2] = (st.st_size >> 16) & 0xFF;
+            req->registers[3] = (st.st_size >> 24) & 0xFF;
+            req->registers[4] = (uint8_t) i;
             /* Tell the Z80 this is a file (not directory) */
-            host->registers[5] = 0;
-            set_status(host, ZOS_SUCCESS);
+            req->registers[5] = 0;
+            req->status = ZOS_SUCCESS;
             return;
         }
     }
     fclose(file);
-    set_status(host, ZOS_CANNOT_REGISTER_MORE);
+    req->status = ZOS_CANNOT_REGISTER_MORE;
 }
 
 
-static void fs_close(zeal_hostfs_t *host)
+static void fs_close(zeal_hostfs_t *host, hostfs_req_t *req)
 {
-    const int desc = host->registers[0];
+    const int desc = req->registers[0];
     if (desc >= MAX_OPENED_FILES) {
-        set_status(host, ZOS_FAILURE);
+        req->status = ZOS_FAILURE;
         return;
     }
 
     hostfs_fd_t* fd = &host->descriptors[desc];
 
-    if (!fd->is_dir) {
+    if (fd->is_overlay) {
+        /* The content of the overlay files remains in memory */
+        if (fd->is_dir) {
+            hostfs_ovl_listing_free(fd->listing);
+        } else {
+            hostfs_ovl_release(&host->overlay, fd->node);
+        }
+    } else if (!fd->is_dir) {
         fclose(fd->file);
     } else {
         closedir(fd->dir);
     }
 
     fd->raw = NULL;
-    set_status(host, ZOS_SUCCESS);
+    fd->is_overlay = 0;
+    req->status = ZOS_SUCCESS;
 }
 
 
-static void fs_stat(zeal_hostfs_t *host)
+static int descriptor_stat(hostfs_fd_t *descriptor, struct stat *st)
+{
+#ifdef _WIN32
+    /* On Windows, we cannot get a file descriptor out of a DIR* structure  */
+    if (descriptor->is_dir) {
+        return stat(descriptor->path, st);
+    }
+    return fstat(fileno(descriptor->file), st);
+#else
+    int fd = -1;
+
+    if (descriptor->is_dir) {
+        fd = dirfd(descriptor->dir);
+    } else {
+        fd = fileno(descriptor->file);
+    }
+
+    return fstat(fd, st);
+#endif
+}
+
+
+static int overlay_descriptor_stat(zeal_hostfs_t *host, hostfs_fd_t *descriptor, struct stat *st)
+{
+    if (!descriptor->is_dir) {
+        return hostfs_ovl_stat(descriptor->node, st);
+    }
+
+    const hostfs_ovl_node_t *node = hostfs_ovl_find(&host->overlay, descriptor->listing->path);
+    if (node != NULL) {
+        return hostfs_ovl_stat(node, st);
+    }
+    return stat(descriptor->listing->path, st);
+}
+
+
+static void fs_stat(zeal_hostfs_t *host, hostfs_req_t *req)
 {
     struct stat st;
 
-    const int desc = host->registers[2];
-    uint16_t struct_addr = (host->registers[1] << 8) | host->registers[0];
+    const int desc = req->registers[2];
     hostfs_fd_t* descriptor = &host->descriptors[desc];
 
     /* Target stat structure. For files, the pointer received points to `s_date`  */
@@ -369,44 +784,31 @@ static void fs_stat(zeal_hostfs_t *host)
     } zos_stat = { 0 };
 
     if (!descriptor_valid(descriptor)) {
-        set_status(host, ZOS_NO_SUCH_ENTRY);
+        req->status = ZOS_NO_SUCH_ENTRY;
         return;
     }
 
-#ifdef _WIN32
-    /* On Windows, we cannot get a file descriptor out of a DIR* structure  */
-    if (descriptor->is_dir) {
-        if (stat(descriptor->path, &st)) {
-            log_err_printf("[HostFS] Could not stat file\n");
-            set_status(host, ZOS_FAILURE);
-            return;
-        }
-    } else {
-        if (fstat(fileno(descriptor->file), &st)) {
-            log_err_printf("[HostFS] Could not stat file\n");
-            set_status(host, ZOS_FAILURE);
-            return;
-        }
-    }
-#else
-    int fd = -1;
-
-    if (descriptor->is_dir) {
-        fd = dirfd(descriptor->dir);
-    } else {
-        fd = fileno(descriptor->file);
-    }
-
-    if (fstat(fd, &st)) {
+    const int err = descriptor->is_overlay ? overlay_descriptor_stat(host, descriptor, &st) :
+                                             descriptor_stat(descriptor, &st);
+    if (err) {
         log_err_printf("[HostFS] Could not stat file\n");
-        set_status(host, ZOS_FAILURE);
+        req->status = ZOS_FAILURE;
         return;
     }
-#endif
 
     zos_stat.s_size = st.st_size > 0x100000000L ? 0xffffffff : st.st_size;
 
-    struct tm *tm_info = localtime(&st.st_mtime);
+    /* This may run on the I/O thread, so use the reentrant version of localtime */
+    struct tm tm_buf;
+#ifdef _WIN32
+    struct tm *tm_info = localtime_s(&tm_buf, &st.st_mtime) == 0 ? &tm_buf : NULL;
+#else
+    struct tm *tm_info = localtime_r(&st.st_mtime, &tm_buf);
+#endif
+    if (tm_info == NULL) {
+        req->status = ZOS_FAILURE;
+        return;
+    }
     zos_stat.s_date[0] = (tm_info->tm_year + 1900) / 100; // High year
     zos_stat.s_date[1] = (tm_info->tm_year + 1900) % 100; // Year
     zos_stat.s_date[2] = tm_info->tm_mon + 1;             // Month
@@ -422,168 +824,223 @@ static void fs_stat(zeal_hostfs_t *host)
     /* Write the name in the structure */
     memcpy(zos_stat.s_name, descriptor->name, ZOS_MAX_NAME_LENGTH);
 
-    /* Write the structure to memory so that the Z80 sees it */
+    /* The structure is written to memory on completion so that the Z80 sees it */
     if (descriptor->is_dir) {
-        memory_write_bytes(host->host_ops, struct_addr, (uint8_t*) &zos_stat, sizeof(zos_stat));
+        memcpy(req->data, &zos_stat, sizeof(zos_stat));
+        req->length = sizeof(zos_stat);
     } else {
-        memory_write_bytes(host->host_ops, struct_addr, (uint8_t*) &zos_stat.s_date,
-                           sizeof(zos_stat) - sizeof(zos_stat.s_size));
+        memcpy(req->data, &zos_stat.s_date, sizeof(zos_stat) - sizeof(zos_stat.s_size));
+        req->length = sizeof(zos_stat) - sizeof(zos_stat.s_size);
     }
 
     /* Set success status */
-    set_status(host, ZOS_SUCCESS);
+    req->status = ZOS_SUCCESS;
 }
 
 
-static int seek_file(zeal_hostfs_t *host, uint16_t struct_addr, FILE* file)
+/**
+ * @brief Get the descriptor and the 32-bit offset out of the guest's opened file structure
+ */
+static void prepare_file_access(zeal_hostfs_t *host, hostfs_req_t *req)
 {
+    const uint16_t struct_addr = (req->registers[1] << 8) | req->registers[0];
+    /* Get the abstract context from the structure */
+    req->desc = memory_read_byte(host->host_ops, struct_addr + ZOS_FD_USER_T);
     /* Get the 32-bit offset to start reading from */
     uint8_t offset[4] = { 0 };
     memory_read_bytes(host->host_ops, struct_addr + ZOS_FD_OFFSET_T, offset, sizeof(offset));
-    const long seek_to = offset[3] << 24 |
-                         offset[2] << 16 |
-                         offset[1] << 8  |
-                         offset[0];
-    return fseek(file, seek_to, SEEK_SET);
+    req->offset = offset[3] << 24 |
+                  offset[2] << 16 |
+                  offset[1] << 8  |
+                  offset[0];
+    req->addr   = (req->registers[3] << 8) | req->registers[2];
+    req->length = (req->registers[5] << 8) | req->registers[4];
+}
+
+
+static hostfs_fd_t* request_descriptor(zeal_hostfs_t *host, hostfs_req_t *req)
+{
+    if (req->desc >= MAX_OPENED_FILES) {
+        return NULL;
+    }
+    hostfs_fd_t *fd = &host->descriptors[req->desc];
+    if (!descriptor_valid(fd) || fd->is_dir) {
+        return NULL;
+    }
+    return fd;
 }
 
 
-static void fs_read(zeal_hostfs_t *host)
+static void fs_read(zeal_hostfs_t *host, hostfs_req_t *req)
 {
-    uint8_t buffer[1024];
+    const size_t buffer_len = req->length;
+    size_t total_bytes_read = 0;
 
-    const uint16_t struct_addr = (host->registers[1] << 8) | host->registers[0];
-    const uint16_t buffer_addr = (host->registers[3] << 8) | host->registers[2];
-    const uint16_t buffer_len  = (host->registers[5] << 8) | host->registers[4];
-    size_t bytes_remaining = buffer_len;
-    size_t total_bytes_written = 0;
+    /* Nothing must be copied to the guest memory if the operation fails */
+    req->length = 0;
 
-    /* Get the abstract context from the structure */
-    const int desc = memory_read_byte(host->host_ops, struct_addr + ZOS_FD_USER_T);
-    if (desc >= MAX_OPENED_FILES) {
-        set_status(host, ZOS_FAILURE);
+    hostfs_fd_t *fd = request_descriptor(host, req);
+    if (fd == NULL) {
+        req->status = ZOS_FAILURE;
         return;
     }
 
-    FILE *file = host->descriptors[desc].file;
-    if (file == NULL) {
-        set_status(host, ZOS_FAILURE);
-        return;
+    if (fd->is_overlay) {
+        total_bytes_read = hostfs_ovl_read(fd->node, req->offset, req->data, buffer_len);
+    } else {
+        fseek(fd->file, req->offset, SEEK_SET);
     }
 
-    seek_file(host, struct_addr, file);
-
-    while (bytes_remaining > 0) {
-        size_t bytes_to_read = MIN(bytes_remaining, sizeof(buffer));
-        size_t bytes_read = fread(buffer, 1, bytes_to_read, file);
+    while (!fd->is_overlay && total_bytes_read < buffer_len) {
+        size_t bytes_read = fread(req->data + total_bytes_read, 1, buffer_len - total_bytes_read, fd->file);
 
         if (bytes_read == 0) {
             break;
         }
 
-        memory_write_bytes(host->host_ops, buffer_addr + total_bytes_written, buffer, bytes_read);
-
-        total_bytes_written += bytes_read;
-        bytes_remaining -= bytes_read;
+        total_bytes_read += bytes_read;
     }
 
-    host->registers[4] = total_bytes_written & 0xFF;
-    host->registers[5] = (total_bytes_written >> 8) & 0xFF;
-    set_status(host, ZOS_SUCCESS);
+    req->length = total_bytes_read;
+    req->registers[4] = total_bytes_read & 0xFF;
+    req->registers[5] = (total_bytes_read >> 8) & 0xFF;
+    req->status = ZOS_SUCCESS;
 }
 
 
-static void fs_write(zeal_hostfs_t *host) {
-    uint8_t buffer[1024];
+static void fs_write(zeal_hostfs_t *host, hostfs_req_t *req)
+{
+    const size_t buffer_len = req->length;
 
-    const uint16_t struct_addr = (host->registers[1] << 8) | host->registers[0];
-    const uint16_t buffer_addr = (host->registers[3] << 8) | host->registers[2];
-    const uint16_t buffer_len  = (host->registers[5] << 8) | host->registers[4];
-    size_t bytes_remaining = buffer_len;
-    size_t total_bytes_written = 0;
+    /* The data was copied from the guest memory when the operation was submitted */
+    req->length = 0;
 
-    /* Get the abstract context from the structure */
-    const int desc = memory_read_byte(host->host_ops, struct_addr + ZOS_FD_USER_T);
-    if (desc >= MAX_OPENED_FILES) {
-        set_status(host, ZOS_FAILURE);
+    hostfs_fd_t *fd = request_descriptor(host, req);
+    if (fd == NULL) {
+        req->status = ZOS_FAILURE;
         return;
     }
 
-    FILE *file = host->descriptors[desc].file;
-    if (file == NULL) {
-        set_status(host, ZOS_FAILURE);
-        return;
+    if (fd->is_overlay) {
+        const uint32_t offset = fd->append ? fd->node->size : (uint32_t) req->offset;
+        hostfs_ovl_write(fd->node, offset, req->data, buffer_len);
+    } else {
+        fseek(fd->file, req->offset, SEEK_SET);
+        fwrite(req->data, 1, buffer_len, fd->file);
+        cache_invalidate(&host->cache);
     }
 
-    seek_file(host, struct_addr, file);
+    req->registers[4] = buffer_len & 0xFF;
+    req->registers[5] = (buffer_len >> 8) & 0xFF;
+    req->status = ZOS_SUCCESS;
+}
 
-    while (bytes_remaining > 0) {
-        size_t bytes_to_write = MIN(bytes_remaining, sizeof(buffer));
-        memory_read_bytes(host->host_ops, buffer_addr + total_bytes_written, buffer, bytes_to_write);
-        fwrite(buffer, 1, bytes_to_write, file);
 
-        total_bytes_written += bytes_to_write;
-        bytes_remaining -= bytes_to_write;
-    }
+static void overlay_mkdir(zeal_hostfs_t *host, hostfs_req_t *req)
+{
+    hostfs_ovl_node_t *node = NULL;
+    struct stat st;
 
-    host->registers[4] = total_bytes_written & 0xFF;
-    host->registers[5] = (total_bytes_written >> 8) & 0xFF;
-    set_status(host, ZOS_SUCCESS);
+    if (visible_stat(host, req, &node, &st) == 0 || !overlay_parent_is_dir(host, req->path)) {
+        req->status = ZOS_FAILURE;
+        return;
+    }
+    /* Replacing a removed host directory must not make its former content visible again */
+    if (hostfs_ovl_create(&host->overlay, req->path, HOSTFS_OVL_DIR, 0, node != NULL) == NULL) {
+        req->status = ZOS_FAILURE;
+        return;
+    }
+    req->status = ZOS_SUCCESS;
 }
 
 
-static void fs_mkdir(zeal_hostfs_t *host)
+static void fs_mkdir(zeal_hostfs_t *host, hostfs_req_t *req)
 {
-    char *path = get_path(host);
-    if (path == NULL) {
-        set_status(host, ZOS_FAILURE);
+    if (host->overlay.enabled) {
+        overlay_mkdir(host, req);
         return;
     }
 
-    if (os_mkdir(path, 0755) != 0) {
+    if (os_mkdir(req->path, 0755) != 0) {
         log_perror("[HostFS] Could not create directory");
-        set_status(host, ZOS_FAILURE);
+        req->status = ZOS_FAILURE;
         return;
     }
+    cache_invalidate(&host->cache);
 
-    set_status(host, ZOS_SUCCESS);
+    req->status = ZOS_SUCCESS;
 }
 
 
-static void fs_rm(zeal_hostfs_t *host)
+static void overlay_rm(zeal_hostfs_t *host, hostfs_req_t *req)
 {
-    char *path = get_path(host);
-    if (path == NULL) {
+    hostfs_ovl_node_t *node = NULL;
+    struct stat st;
+
+    if (visible_stat(host, req, &node, &st) != 0) {
+        req->status = ZOS_FAILURE;
         return;
     }
 
-    if (remove(path) != 0) {
-        set_status(host, ZOS_FAILURE);
-        return;
+    /* Same as the host, only empty directories can be removed */
+    if (S_ISDIR(st.st_mode)) {
+        hostfs_ovl_listing_t *listing = hostfs_ovl_list(&host->overlay, req->path);
+        const bool empty = listing != NULL && listing->count == 0;
+        hostfs_ovl_listing_free(listing);
+        if (!empty) {
+            req->status = ZOS_FAILURE;
+            return;
+        }
     }
 
-    set_status(host, ZOS_SUCCESS);
+    /* A host entry at this path has to be hidden by a whiteout */
+    const bool host_exists = (node == NULL) || cached_stat(host, req, &st) == 0;
+    if (hostfs_ovl_remove(&host->overlay, req->path, host_exists) != 0) {
+        req->status = ZOS_FAILURE;
+        return;
+    }
+    req->status = ZOS_SUCCESS;
 }
 
 
-static void fs_opendir(zeal_hostfs_t *host)
+static void fs_rm(zeal_hostfs_t *host, hostfs_req_t *req)
 {
-    char *path = get_path(host);
-    if (path == NULL) {
+    if (host->overlay.enabled) {
+        overlay_rm(host, req);
+        return;
+    }
+
+    if (remove(req->path) != 0) {
+        req->status = ZOS_FAILURE;
         return;
     }
-    populate_opendir(host, path);
+    cache_invalidate(&host->cache);
+
+    req->status = ZOS_SUCCESS;
 }
 
 
-static void fs_readdir(zeal_hostfs_t *host)
+static void fs_readdir(zeal_hostfs_t *host, hostfs_req_t *req)
 {
-    char out_name[ZOS_MAX_NAME_LENGTH];
-    int desc = host->registers[2];
+    int desc = req->registers[2];
 
     hostfs_fd_t* fd = &host->descriptors[desc];
     if (desc >= MAX_OPENED_FILES || !descriptor_valid(fd)) {
-        set_status(host, ZOS_FAILURE);
+        req->status = ZOS_FAILURE;
+        return;
+    }
+
+    if (fd->is_overlay) {
+        hostfs_ovl_listing_t *listing = fd->listing;
+        if (listing->next >= listing->count) {
+            req->status = ZOS_NO_MORE_ENTRIES;
+            return;
+        }
+        const hostfs_ovl_dirent_t *entry = &listing->entries[listing->next++];
+        req->data[0] = entry->is_file;
+        zos_format_name(entry->name, (char*) &req->data[1]);
+        req->length = 1 + ZOS_MAX_NAME_LENGTH;
+        req->status = ZOS_SUCCESS;
         return;
     }
 
@@ -594,7 +1051,7 @@ static void fs_readdir(zeal_hostfs_t *host)
     while (1) {
         entry = readdir(dir);
         if (!entry) {
-            set_status(host, ZOS_NO_MORE_ENTRIES);
+            req->status = ZOS_NO_MORE_ENTRIES;
             return;
         }
         /* Make sure to skip `.`, `..`, or special files */
@@ -608,70 +1065,222 @@ static void fs_readdir(zeal_hostfs_t *host)
         }
     }
 
-    uint16_t buffer_addr = (host->registers[1] << 8) | host->registers[0];
-    zos_format_name(entry->d_name, out_name);
     /* The structure to fill is defined in Zeal 8-bit OS
      * dir_entry_flags   DS.B 1  ; Is the entry a file ? A dir ?
      * dir_entry_name_t  DS.B 16 ; File name NULL-terminated, including the extension
      */
 #ifdef _WIN32
     /* FIXME! Windows doens't have DT_REG flag */
-    const uint8_t is_file = 1;
+    req->data[0] = 1;
 #else
-    const uint8_t is_file = (entry->d_type == DT_REG) ? 1 : 0;
+    req->data[0] = (entry->d_type == DT_REG) ? 1 : 0;
 #endif
-    memory_write_byte(host->host_ops, buffer_addr++, is_file);
-    memory_write_bytes(host->host_ops, buffer_addr, (void*) out_name, ZOS_MAX_NAME_LENGTH);
-    set_status(host, ZOS_SUCCESS);
+    zos_format_name(entry->d_name, (char*) &req->data[1]);
+    req->length = 1 + ZOS_MAX_NAME_LENGTH;
+    req->status = ZOS_SUCCESS;
 }
 
 
-static void handle_operation(zeal_hostfs_t *host, uint8_t operation)
+/**
+ * @brief Gather everything the operation needs from the guest memory, on the emulation thread.
+ *
+ * @returns true if the operation must be performed on the host, false if it is already complete
+ *          and the status register has been set.
+ */
+static bool prepare_operation(zeal_hostfs_t *host, uint8_t operation)
 {
+    hostfs_req_t *req = &host->req;
+    char *path;
+
+    req->op = operation;
+    req->status = ZOS_FAILURE;
+    req->length = 0;
+    req->entry = NULL;
+    memcpy(req->registers, host->registers, sizeof(req->registers));
+
     switch (operation) {
         case OP_WHOAMI:
             fs_whoami(host);
-            break;
+            return false;
         case OP_OPEN:
-            fs_open(host);
+        case OP_OPENDIR:
+        case OP_RM:
+        case OP_MKDIR:
+            path = get_path(host);
+            if (path == NULL) {
+                /* Creating a directory reports a failure instead of a missing entry */
+                if (operation == OP_MKDIR) {
+                    set_status(host, ZOS_FAILURE);
+                }
+                return false;
+            }
+            strcpy(req->path, path);
+            return true;
+        case OP_STAT:
+        case OP_READDIR:
+            req->addr = (req->registers[1] << 8) | req->registers[0];
+            return true;
+        case OP_READ:
+            prepare_file_access(host, req);
+            return true;
+        case OP_WRITE:
+            prepare_file_access(host, req);
+            memory_read_bytes(host->host_ops, req->addr, req->data, req->length);
+            return true;
+        case OP_CLOSE:
+            return true;
+        default:
+            set_status(host, ZOS_FAILURE);
+            return false;
+    }
+}
+
+
+/**
+ * @brief Perform the operation on the host, may be called from the worker thread, so it must
+ * not access the guest memory nor the device registers.
+ */
+static void handle_operation(zeal_hostfs_t *host, hostfs_req_t *req)
+{
+    switch (req->op) {
+        case OP_OPEN:
+            fs_open(host, req);
             break;
         case OP_CLOSE:
-            fs_close(host);
+            fs_close(host, req);
             break;
         case OP_STAT:
-            fs_stat(host);
+            fs_stat(host, req);
             break;
         case OP_READ:
-            fs_read(host);
+            fs_read(host, req);
             break;
         case OP_WRITE:
-            fs_write(host);
+            fs_write(host, req);
             break;
         case OP_MKDIR:
-            fs_mkdir(host);
+            fs_mkdir(host, req);
             break;
         case OP_RM:
-            fs_rm(host);
+            fs_rm(host, req);
             break;
         case OP_OPENDIR:
-            fs_opendir(host);
+            populate_opendir(host, req);
             break;
         case OP_READDIR:
-            fs_readdir(host);
+            fs_readdir(host, req);
             break;
         default:
-            set_status(host, ZOS_FAILURE);
+            req->status = ZOS_FAILURE;
             break;
     }
 }
 
 
+/**
+ * @brief Copy the results of the operation to the guest memory and to the registers,
+ * on the emulation thread.
+ */
+static void complete_operation(zeal_hostfs_t *host)
+{
+    hostfs_req_t *req = &host->req;
+
+    /* RAM and VRAM pages are filled with a single copy each, other areas byte per byte */
+    if (req->length > 0) {
+        memory_write_bytes(host->host_ops, req->addr, req->data, req->length);
+    }
+    memcpy(host->registers, req->registers, sizeof(req->registers));
+    set_status(host, req->status);
+    atomic_store_explicit(&host->req_state, HOSTFS_REQ_IDLE, memory_order_relaxed);
+}
+
+
+#if HOSTFS_ASYNC_SUPPORT
+
+static void* hostfs_worker(void* arg)
+{
+    zeal_hostfs_t *host = (zeal_hostfs_t*) arg;
+
+    pthread_mutex_lock(&host->lock);
+    while (!host->quit) {
+        if (atomic_load_explicit(&host->req_state, memory_order_relaxed) != HOSTFS_REQ_QUEUED) {
+            pthread_cond_wait(&host->cond, &host->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&host->lock);
+        handle_operation(host, &host->req);
+        pthread_mutex_lock(&host->lock);
+        atomic_store_explicit(&host->req_state, HOSTFS_REQ_DONE, memory_order_release);
+        pthread_cond_broadcast(&host->cond);
+    }
+    pthread_mutex_unlock(&host->lock);
+    return NULL;
+}
+
+
+/**
+ * @brief Block until the operation in progress, if any, is done on the host side
+ */
+static void wait_operation(zeal_hostfs_t *host)
+{
+    pthread_mutex_lock(&host->lock);
+    while (atomic_load_explicit(&host->req_state, memory_order_acquire) == HOSTFS_REQ_QUEUED) {
+        pthread_cond_wait(&host->cond, &host->lock);
+    }
+    pthread_mutex_unlock(&host->lock);
+}
+
+#endif // HOSTFS_ASYNC_SUPPORT
+
+
+static void start_operation(zeal_hostfs_t *host, uint8_t operation)
+{
+#if HOSTFS_ASYNC_SUPPORT
+    if (host->async) {
+        /* The guest is not supposed to start an operation while another one is pending. Complete it
+         * without losing the parameters the guest just wrote for the new one */
+        if (atomic_load_explicit(&host->req_state, memory_order_relaxed) != HOSTFS_REQ_IDLE) {
+            uint8_t params[sizeof(host->req.registers)];
+            memcpy(params, host->registers, sizeof(params));
+            wait_operation(host);
+            complete_operation(host);
+            memcpy(host->registers, params, sizeof(params));
+        }
+    }
+#endif
+
+    set_status(host, ZOS_PENDING);
+    if (!prepare_operation(host, operation)) {
+        return;
+    }
+
+#if HOSTFS_ASYNC_SUPPORT
+    if (host->async) {
+        pthread_mutex_lock(&host->lock);
+        atomic_store_explicit(&host->req_state, HOSTFS_REQ_QUEUED, memory_order_relaxed);
+        pthread_cond_broadcast(&host->cond);
+        pthread_mutex_unlock(&host->lock);
+        return;
+    }
+#endif
+
+    handle_operation(host, &host->req);
+    complete_operation(host);
+}
+
+
 /**
  * Define the I/O device operations
  */
 static uint8_t io_read(device_t* dev, uint32_t addr)
 {
     zeal_hostfs_t* hostfs = (zeal_hostfs_t*) dev;
+    /* The results are made visible to the guest when it polls the status of a finished operation */
+    if ((addr & 0xf) == OPERATION_REG &&
+        atomic_load_explicit(&hostfs->req_state, memory_order_acquire) == HOSTFS_REQ_DONE)
+    {
+        complete_operation(hostfs);
+    }
     return hostfs->registers[addr & 0xf];
 }
 
@@ -692,8 +1301,7 @@ static void io_write(device_t* dev, uint32_t addr, uint8_t value)
      */
     if (addr == OPERATION_REG) {
         if (value <= OP_LAST) {
-            set_status(hostfs, ZOS_PENDING);
-            handle_operation(hostfs, value);
+            start_operation(hostfs, value);
         } else {
             log_err_printf("[HostFS] Invalid operation %x\n", value);
             set_status(hostfs, ZOS_FAILURE);
@@ -706,15 +1314,91 @@ static void io_write(device_t* dev, uint32_t addr, uint8_t value)
 }
 
 
-int hostfs_init(zeal_hostfs_t* hostfs, const memory_op_t* ops)
+int hostfs_init(zeal_hostfs_t* hostfs, const memory_op_t* ops, bool async, hostfs_cache_mode_t cache)
 {
     memset(hostfs, 0, sizeof(zeal_hostfs_t));
+    hostfs->req.data = pages_alloc(HOSTFS_REQ_DATA_SIZE);
+    if (hostfs->req.data == NULL) {
+        log_err_printf("[HostFS] Could not allocate the transfer buffer\n");
+        return -1;
+    }
     hostfs->host_ops = ops;
+    hostfs->cache.mode = cache;
+    hostfs->cache.watch_fd = -1;
+    /* Start at 1 so that the free entries don't have a valid status */
+    hostfs->cache.stat_gen = 1;
+    /* Without a watch, only the guest's own changes could invalidate the status */
+    hostfs->cache.cache_stat = (cache == HOSTFS_CACHE_ON);
+    atomic_init(&hostfs->req_state, HOSTFS_REQ_IDLE);
     device_init_io(DEVICE(hostfs), "hostfs_dev", io_read, io_write, 0x10);
+
+#if HOSTFS_ASYNC_SUPPORT
+    if (async) {
+        pthread_mutex_init(&hostfs->lock, NULL);
+        pthread_cond_init(&hostfs->cond, NULL);
+        if (pthread_create(&hostfs->worker, NULL, hostfs_worker, hostfs) != 0) {
+            log_err_printf("[HostFS] Could not start the I/O thread, operations will be synchronous\n");
+            pthread_cond_destroy(&hostfs->cond);
+            pthread_mutex_destroy(&hostfs->lock);
+        } else {
+            hostfs->async = true;
+        }
+    }
+#else
+    (void) async;
+#endif
     return 0;
 }
 
 
+static void hostfs_stop_worker(zeal_hostfs_t* hostfs)
+{
+#if HOSTFS_ASYNC_SUPPORT
+    if (!hostfs->async) {
+        return;
+    }
+    wait_operation(hostfs);
+    pthread_mutex_lock(&hostfs->lock);
+    hostfs->quit = true;
+    pthread_cond_broadcast(&hostfs->cond);
+    pthread_mutex_unlock(&hostfs->lock);
+    pthread_join(hostfs->worker, NULL);
+    pthread_cond_destroy(&hostfs->cond);
+    pthread_mutex_destroy(&hostfs->lock);
+    hostfs->async = false;
+#else
+    (void) hostfs;
+#endif
+}
+
+
+void hostfs_enable_overlay(zeal_hostfs_t* hostfs, const char* export_path)
+{
+    hostfs_ovl_init(&hostfs->overlay, export_path);
+}
+
+
+void hostfs_deinit(zeal_hostfs_t* hostfs)
+{
+    hostfs_stop_worker(hostfs);
+    hostfs_ovl_deinit(&hostfs->overlay);
+    pages_free(hostfs->req.data, HOSTFS_REQ_DATA_SIZE);
+    hostfs->req.data = NULL;
+
+    for (int i = 0; i < HOSTFS_CACHE_ENTRIES; i++) {
+        free(hostfs->cache.entries[i].key);
+        free(hostfs->cache.entries[i].path);
+    }
+    memset(hostfs->cache.entries, 0, sizeof(hostfs->cache.entries));
+#ifdef __linux__
+    if (hostfs->cache.watch_fd >= 0) {
+        close(hostfs->cache.watch_fd);
+        hostfs->cache.watch_fd = -1;
+    }
+#endif
+}
+
+
 int hostfs_load_path(zeal_hostfs_t* hostfs, const char* root_path)
 {
     char resolved_path_buffer[PATH_MAX];
@@ -743,7 +1427,13 @@ int hostfs_load_path(zeal_hostfs_t* hostfs, const char* root_path)
         return 1;
     }
 
-    if (access(resolved_path, R_OK | W_OK) != 0) {
+    if (hostfs->overlay.enabled) {
+        /* The modifications are kept in memory, the host directory is only read */
+        if (access(resolved_path, R_OK) != 0) {
+            log_err_printf("[HostFS] Path %s must be readable!\n", path_sanitize(resolved_path));
+            return 1;
+        }
+    } else if (access(resolved_path, R_OK | W_OK) != 0) {
         log_err_printf("[HostFS] Path %s must be accessible in both read and write!\n", path_sanitize(resolved_path));
         return 1;
     }
@@ -761,8 +1451,14 @@ int hostfs_load_path(zeal_hostfs_t* hostfs, const char* root_path)
         return 1;
     }
     hostfs->root_path = final_path;
+    hostfs_ovl_set_root(&hostfs->overlay, final_path);
+
+    if (hostfs->cache.mode == HOSTFS_CACHE_WATCH) {
+        cache_start_watch(&hostfs->cache, hostfs->root_path);
+    }
 
-    log_printf("[HostFS] %s loaded successfully\n", path_sanitize(get_relative_path(hostfs->root_path)));
+    log_printf("[HostFS] %s loaded successfully%s\n", path_sanitize(get_relative_path(hostfs->root_path)),
+               hostfs->overlay.enabled ? ", modifications are kept in memory" : "");
 
     return 0;
 }
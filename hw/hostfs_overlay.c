@@ -0,0 +1,676 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+#ifndef _DEFAULT_SOURCE
+    #define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "hw/hostfs_overlay.h"
+#include "utils/helpers.h"
+#include "utils/log.h"
+#include "utils/paths.h"
+
+#define TAR_BLOCK_SIZE  512
+
+
+static uint32_t ovl_hash(const char *path)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    while (*path) {
+        hash = (hash ^ (uint8_t) *path++) * 16777619u;
+    }
+    return hash;
+}
+
+
+/**
+ * @brief Check whether `path` is a direct child of the directory `dir`
+ */
+static bool ovl_is_child(const char *path, const char *dir)
+{
+    const size_t dir_len = strlen(dir);
+    return strncmp(path, dir, dir_len) == 0 &&
+           path[dir_len] == '/' &&
+           path[dir_len + 1] != '\0' &&
+           strchr(path + dir_len + 1, '/') == NULL;
+}
+
+
+/**
+ * @brief Path of the node relative to the root directory
+ */
+static const char *ovl_relative(const hostfs_overlay_t *ov, const hostfs_ovl_node_t *node)
+{
+    const size_t root_len = strlen(ov->root_path);
+    if (strncmp(node->path, ov->root_path, root_len) == 0 && node->path[root_len] == '/') {
+        return node->path + root_len + 1;
+    }
+    return node->path;
+}
+
+
+static void ovl_free_chunks(hostfs_ovl_node_t *node)
+{
+    for (uint32_t i = 0; i < node->chunk_count; i++) {
+        free(node->chunks[i]);
+    }
+    free(node->chunks);
+    node->chunks = NULL;
+    node->chunk_count = 0;
+}
+
+
+static void ovl_close_base(hostfs_ovl_node_t *node)
+{
+    if (node->base != NULL) {
+        fclose(node->base);
+        node->base = NULL;
+    }
+}
+
+
+static void ovl_free_node(hostfs_ovl_node_t *node)
+{
+    ovl_close_base(node);
+    ovl_free_chunks(node);
+    free(node->path);
+    free(node);
+}
+
+
+/**
+ * @brief Read bytes of the host file backing the node, the caller makes sure they are below `base_size`
+ */
+static void ovl_read_base(hostfs_ovl_node_t *node, uint32_t offset, uint8_t *data, uint32_t length)
+{
+    size_t bytes_read = 0;
+
+    if (node->base == NULL) {
+        node->base = fopen(node->path, "r" FOPEN_BINARY);
+    }
+    if (node->base != NULL && fseek(node->base, offset, SEEK_SET) == 0) {
+        bytes_read = fread(data, 1, length, node->base);
+    }
+    /* The host file may have shrunk behind our back */
+    memset(data + bytes_read, 0, length - bytes_read);
+}
+
+
+/**
+ * @brief Get the chunk at the given index, allocating it from the host file content if necessary
+ */
+static uint8_t *ovl_get_chunk(hostfs_ovl_node_t *node, uint32_t index)
+{
+    if (index >= node->chunk_count) {
+        uint8_t **chunks = realloc(node->chunks, (index + 1) * sizeof(uint8_t*));
+        if (chunks == NULL) {
+            return NULL;
+        }
+        memset(chunks + node->chunk_count, 0, (index + 1 - node->chunk_count) * sizeof(uint8_t*));
+        node->chunks = chunks;
+        node->chunk_count = index + 1;
+    }
+
+    if (node->chunks[index] == NULL) {
+        uint8_t *chunk = calloc(1, HOSTFS_OVL_CHUNK_SIZE);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        const uint32_t start = index * HOSTFS_OVL_CHUNK_SIZE;
+        if (start < node->base_size) {
+            ovl_read_base(node, start, chunk, MIN(node->base_size - start, HOSTFS_OVL_CHUNK_SIZE));
+        }
+        node->chunks[index] = chunk;
+    }
+    return node->chunks[index];
+}
+
+
+void hostfs_ovl_init(hostfs_overlay_t* ov, const char* export_path)
+{
+    memset(ov, 0, sizeof(*ov));
+    ov->enabled = true;
+    ov->export_path = export_path;
+}
+
+
+void hostfs_ovl_set_root(hostfs_overlay_t* ov, const char* root_path)
+{
+    ov->root_path = root_path;
+}
+
+
+hostfs_ovl_node_t* hostfs_ovl_find(hostfs_overlay_t* ov, const char* path)
+{
+    const uint32_t hash = ovl_hash(path);
+
+    for (int i = 0; i < ov->count; i++) {
+        hostfs_ovl_node_t *node = ov->nodes[i];
+        if (!node->detached && node->hash == hash && strcmp(node->path, path) == 0) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+
+int hostfs_ovl_stat(const hostfs_ovl_node_t* node, struct stat* st)
+{
+    if (node->type == HOSTFS_OVL_WHITEOUT) {
+        return -1;
+    }
+    memset(st, 0, sizeof(*st));
+    st->st_mode = node->type == HOSTFS_OVL_DIR ? (S_IFDIR | 0755) : (S_IFREG | 0644);
+    st->st_size = node->size;
+    st->st_mtime = node->mtime;
+    return 0;
+}
+
+
+/**
+ * @brief Remove the node from the overlay and free it
+ */
+static void ovl_drop(hostfs_overlay_t *ov, hostfs_ovl_node_t *node)
+{
+    for (int i = 0; i < ov->count; i++) {
+        if (ov->nodes[i] == node) {
+            /* Keep the creation order, the listings and the exports rely on it */
+            memmove(&ov->nodes[i], &ov->nodes[i + 1], (ov->count - i - 1) * sizeof(hostfs_ovl_node_t*));
+            ov->count--;
+            break;
+        }
+    }
+    ovl_free_node(node);
+}
+
+
+/**
+ * @brief Detach the current node at `path`, if any. It is freed right away unless a descriptor
+ * still points to it, in which case the last one to be closed frees it.
+ */
+static void ovl_detach(hostfs_overlay_t *ov, const char *path)
+{
+    hostfs_ovl_node_t *node = hostfs_ovl_find(ov, path);
+    if (node == NULL) {
+        return;
+    }
+    node->detached = true;
+    if (node->refs == 0) {
+        ovl_drop(ov, node);
+    }
+}
+
+
+void hostfs_ovl_acquire(hostfs_ovl_node_t* node)
+{
+    node->refs++;
+}
+
+
+void hostfs_ovl_release(hostfs_overlay_t* ov, hostfs_ovl_node_t* node)
+{
+    if (--node->refs > 0) {
+        return;
+    }
+    if (node->detached) {
+        ovl_drop(ov, node);
+    } else {
+        ovl_close_base(node);
+    }
+}
+
+
+hostfs_ovl_node_t* hostfs_ovl_create(hostfs_overlay_t* ov, const char* path, hostfs_ovl_type_t type,
+                                     uint32_t base_size, bool opaque)
+{
+    if (ov->count == ov->capacity) {
+        const int capacity = ov->capacity ? ov->capacity * 2 : 64;
+        hostfs_ovl_node_t **nodes = realloc(ov->nodes, capacity * sizeof(hostfs_ovl_node_t*));
+        if (nodes == NULL) {
+            return NULL;
+        }
+        ov->nodes = nodes;
+        ov->capacity = capacity;
+    }
+
+    hostfs_ovl_node_t *node = calloc(1, sizeof(hostfs_ovl_node_t));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->path = strdup(path);
+    if (node->path == NULL) {
+        free(node);
+        return NULL;
+    }
+
+    ovl_detach(ov, path);
+    node->hash = ovl_hash(path);
+    node->type = type;
+    node->opaque = opaque;
+    node->mtime = time(NULL);
+    node->size = base_size;
+    node->base_size = base_size;
+    ov->nodes[ov->count++] = node;
+    return node;
+}
+
+
+int hostfs_ovl_remove(hostfs_overlay_t* ov, const char* path, bool host_exists)
+{
+    ovl_detach(ov, path);
+    if (host_exists && hostfs_ovl_create(ov, path, HOSTFS_OVL_WHITEOUT, 0, false) == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+
+void hostfs_ovl_truncate(hostfs_ovl_node_t* node)
+{
+    ovl_free_chunks(node);
+    ovl_close_base(node);
+    node->size = 0;
+    node->base_size = 0;
+    node->mtime = time(NULL);
+}
+
+
+uint32_t hostfs_ovl_read(hostfs_ovl_node_t* node, uint32_t offset, uint8_t* data, uint32_t length)
+{
+    if (offset >= node->size) {
+        return 0;
+    }
+    length = MIN(length, node->size - offset);
+
+    uint32_t done = 0;
+    while (done < length) {
+        const uint32_t index = (offset + done) / HOSTFS_OVL_CHUNK_SIZE;
+        const uint32_t chunk_ofs = (offset + done) % HOSTFS_OVL_CHUNK_SIZE;
+        const uint32_t count = MIN(length - done, HOSTFS_OVL_CHUNK_SIZE - chunk_ofs);
+
+        if (index < node->chunk_count && node->chunks[index] != NULL) {
+            memcpy(data + done, node->chunks[index] + chunk_ofs, count);
+        } else if (offset + done < node->base_size) {
+            /* Never written, the host file still holds the content, no need to allocate the chunk */
+            const uint32_t from_base = MIN(count, node->base_size - (offset + done));
+            ovl_read_base(node, offset + done, data + done, from_base);
+            memset(data + done + from_base, 0, count - from_base);
+        } else {
+            memset(data + done, 0, count);
+        }
+        done += count;
+    }
+    return length;
+}
+
+
+uint32_t hostfs_ovl_write(hostfs_ovl_node_t* node, uint32_t offset, const uint8_t* data, uint32_t length)
+{
+    uint32_t done = 0;
+
+    while (done < length) {
+        const uint32_t index = (offset + done) / HOSTFS_OVL_CHUNK_SIZE;
+        const uint32_t chunk_ofs = (offset + done) % HOSTFS_OVL_CHUNK_SIZE;
+        const uint32_t count = MIN(length - done, HOSTFS_OVL_CHUNK_SIZE - chunk_ofs);
+        uint8_t *chunk = ovl_get_chunk(node, index);
+
+        if (chunk == NULL) {
+            log_err_printf("[HostFS] Could not allocate memory for the overlay!\n");
+            break;
+        }
+        memcpy(chunk + chunk_ofs, data + done, count);
+        done += count;
+    }
+
+    node->size = MAX(node->size, offset + done);
+    node->mtime = time(NULL);
+    return done;
+}
+
+
+static int ovl_listing_add(hostfs_ovl_listing_t **listing, int *capacity, const char *name, uint8_t is_file)
+{
+    hostfs_ovl_listing_t *list = *listing;
+
+    if (list->count == *capacity) {
+        const int new_capacity = *capacity * 2;
+        list = realloc(list, sizeof(hostfs_ovl_listing_t) + new_capacity * sizeof(hostfs_ovl_dirent_t));
+        if (list == NULL) {
+            return -1;
+        }
+        *listing = list;
+        *capacity = new_capacity;
+    }
+    list->entries[list->count].name = strdup(name);
+    if (list->entries[list->count].name == NULL) {
+        return -1;
+    }
+    list->entries[list->count].is_file = is_file;
+    list->count++;
+    return 0;
+}
+
+
+hostfs_ovl_listing_t* hostfs_ovl_list(hostfs_overlay_t* ov, const char* path)
+{
+    const hostfs_ovl_node_t *dir_node = hostfs_ovl_find(ov, path);
+    DIR *dir = NULL;
+
+    if (dir_node != NULL && dir_node->type != HOSTFS_OVL_DIR) {
+        return NULL;
+    }
+    if (dir_node == NULL || !dir_node->opaque) {
+        dir = opendir(path);
+        if (dir == NULL && dir_node == NULL) {
+            return NULL;
+        }
+    }
+
+    int capacity = 16;
+    hostfs_ovl_listing_t *listing = calloc(1, sizeof(hostfs_ovl_listing_t) + capacity * sizeof(hostfs_ovl_dirent_t));
+    if (listing == NULL || (listing->path = strdup(path)) == NULL) {
+        free(listing);
+        if (dir) closedir(dir);
+        return NULL;
+    }
+
+    /* Host entries first, unless the overlay replaced or removed them */
+    struct dirent *entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+#ifdef _WIN32
+        /* FIXME! Windows doens't have DT_REG flag */
+        const uint8_t is_file = 1;
+#else
+        if (entry->d_type != DT_DIR && entry->d_type != DT_REG) {
+            continue;
+        }
+        const uint8_t is_file = (entry->d_type == DT_REG) ? 1 : 0;
+#endif
+        char full_path[PATH_MAX];
+        snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
+        if (hostfs_ovl_find(ov, full_path) != NULL) {
+            continue;
+        }
+        if (ovl_listing_add(&listing, &capacity, entry->d_name, is_file)) {
+            break;
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+
+    for (int i = 0; i < ov->count; i++) {
+        const hostfs_ovl_node_t *node = ov->nodes[i];
+        if (node->detached || node->type == HOSTFS_OVL_WHITEOUT || !ovl_is_child(node->path, path)) {
+            continue;
+        }
+        const char *name = strrchr(node->path, '/') + 1;
+        if (ovl_listing_add(&listing, &capacity, name, node->type == HOSTFS_OVL_FILE)) {
+            break;
+        }
+    }
+
+    return listing;
+}
+
+
+void hostfs_ovl_listing_free(hostfs_ovl_listing_t* listing)
+{
+    if (listing == NULL) {
+        return;
+    }
+    for (int i = 0; i < listing->count; i++) {
+        free(listing->entries[i].name);
+    }
+    free(listing->path);
+    free(listing);
+}
+
+
+/**
+ * @brief Write the whole content of a file node to `out`
+ */
+static int ovl_export_content(hostfs_ovl_node_t *node, FILE *out)
+{
+    uint8_t buffer[HOSTFS_OVL_CHUNK_SIZE];
+
+    for (uint32_t offset = 0; offset < node->size; offset += HOSTFS_OVL_CHUNK_SIZE) {
+        const uint32_t count = hostfs_ovl_read(node, offset, buffer, sizeof(buffer));
+        if (fwrite(buffer, 1, count, out) != count) {
+            return -1;
+        }
+    }
+    /* Don't keep the host files of all the nodes open during the export */
+    if (node->refs == 0) {
+        ovl_close_base(node);
+    }
+    return 0;
+}
+
+
+static void tar_octal(char *field, size_t size, unsigned long value)
+{
+    snprintf(field, size, "%0*lo", (int) size - 1, value);
+}
+
+
+static int tar_write_header(FILE *out, const char *name, const hostfs_ovl_node_t *node)
+{
+    struct {
+        char name[100];
+        char mode[8];
+        char uid[8];
+        char gid[8];
+        char size[12];
+        char mtime[12];
+        char chksum[8];
+        char typeflag;
+        char linkname[100];
+        char magic[6];
+        char version[2];
+        char uname[32];
+        char gname[32];
+        char devmajor[8];
+        char devminor[8];
+        char prefix[155];
+        char pad[12];
+    } header;
+    const bool is_dir = node->type == HOSTFS_OVL_DIR;
+    const size_t length = strlen(name);
+
+    _Static_assert(sizeof(header) == TAR_BLOCK_SIZE, "Invalid tar header size");
+    memset(&header, 0, sizeof(header));
+
+    /* Names longer than the field are split in a prefix and a name, at a directory separator */
+    if (length + is_dir <= sizeof(header.name)) {
+        memcpy(header.name, name, length);
+    } else {
+        const char *split = name + length - (sizeof(header.name) - is_dir) - 1;
+        split = strchr(split, '/');
+        if (split == NULL || (size_t) (split - name) > sizeof(header.prefix)) {
+            log_err_printf("[HostFS] Path %s is too long for the archive, skipping\n", name);
+            return 1;
+        }
+        memcpy(header.prefix, name, split - name);
+        memcpy(header.name, split + 1, length - (split - name) - 1);
+    }
+    if (is_dir) {
+        header.name[strlen(header.name)] = '/';
+    }
+
+    tar_octal(header.mode, sizeof(header.mode), is_dir ? 0755 : 0644);
+    tar_octal(header.uid, sizeof(header.uid), 0);
+    tar_octal(header.gid, sizeof(header.gid), 0);
+    tar_octal(header.size, sizeof(header.size), is_dir ? 0 : node->size);
+    tar_octal(header.mtime, sizeof(header.mtime), (unsigned long) node->mtime);
+    header.typeflag = is_dir ? '5' : '0';
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+
+    /* The checksum is computed with the checksum field filled with spaces */
+    unsigned long checksum = 0;
+    memset(header.chksum, ' ', sizeof(header.chksum));
+    for (size_t i = 0; i < sizeof(header); i++) {
+        checksum += ((const uint8_t*) &header)[i];
+    }
+    snprintf(header.chksum, sizeof(header.chksum), "%06lo", checksum);
+
+    return fwrite(&header, sizeof(header), 1, out) == 1 ? 0 : -1;
+}
+
+
+static int ovl_export_tar(hostfs_overlay_t *ov)
+{
+    static const uint8_t zeros[TAR_BLOCK_SIZE] = { 0 };
+    FILE *out = fopen(ov->export_path, "w" FOPEN_BINARY);
+    int err = 0;
+
+    if (out == NULL) {
+        log_perror("[HostFS] Could not create the overlay archive");
+        return -1;
+    }
+
+    for (int i = 0; i < ov->count && err >= 0; i++) {
+        hostfs_ovl_node_t *node = ov->nodes[i];
+        if (node->detached || node->type == HOSTFS_OVL_WHITEOUT) {
+            continue;
+        }
+        err = tar_write_header(out, ovl_relative(ov, node), node);
+        if (err != 0 || node->type == HOSTFS_OVL_DIR) {
+            continue;
+        }
+        err = ovl_export_content(node, out);
+        const size_t padding = (TAR_BLOCK_SIZE - node->size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+        if (err == 0 && fwrite(zeros, 1, padding, out) != padding) {
+            err = -1;
+        }
+    }
+
+    /* The archive ends with two empty blocks */
+    if (err >= 0 && (fwrite(zeros, 1, TAR_BLOCK_SIZE, out) != TAR_BLOCK_SIZE ||
+                     fwrite(zeros, 1, TAR_BLOCK_SIZE, out) != TAR_BLOCK_SIZE)) {
+        err = -1;
+    }
+    if (fclose(out) != 0 || err < 0) {
+        log_perror("[HostFS] Could not write the overlay archive");
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Create the directory and all its parents, like `mkdir -p`
+ */
+static int ovl_mkdir_parents(char *path)
+{
+    for (char *sep = strchr(path + 1, '/'); ; sep = strchr(sep + 1, '/')) {
+        if (sep != NULL) {
+            *sep = '\0';
+        }
+        struct stat st;
+        const int err = (stat(path, &st) != 0 && os_mkdir(path, 0755) != 0);
+        if (sep == NULL) {
+            return err ? -1 : 0;
+        }
+        *sep = '/';
+        if (err) {
+            return -1;
+        }
+    }
+}
+
+
+static int ovl_export_dir(hostfs_overlay_t *ov)
+{
+    char path[PATH_MAX];
+    int err = 0;
+
+    for (int i = 0; i < ov->count; i++) {
+        hostfs_ovl_node_t *node = ov->nodes[i];
+        if (node->detached || node->type == HOSTFS_OVL_WHITEOUT) {
+            continue;
+        }
+        if ((size_t) snprintf(path, sizeof(path), "%s/%s", ov->export_path, ovl_relative(ov, node)) >= sizeof(path)) {
+            err = -1;
+            continue;
+        }
+        if (node->type == HOSTFS_OVL_DIR) {
+            err |= ovl_mkdir_parents(path);
+            continue;
+        }
+        /* Create the parent directories of the file */
+        char *sep = strrchr(path, '/');
+        *sep = '\0';
+        err |= ovl_mkdir_parents(path);
+        *sep = '/';
+
+        FILE *out = fopen(path, "w" FOPEN_BINARY);
+        if (out == NULL) {
+            err = -1;
+            continue;
+        }
+        err |= ovl_export_content(node, out);
+        if (fclose(out) != 0) {
+            err = -1;
+        }
+    }
+
+    if (err) {
+        log_err_printf("[HostFS] Some overlay entries could not be exported to %s\n", ov->export_path);
+    }
+    return err;
+}
+
+
+static int ovl_node_compare(const void *a, const void *b)
+{
+    const hostfs_ovl_node_t *na = *(const hostfs_ovl_node_t* const*) a;
+    const hostfs_ovl_node_t *nb = *(const hostfs_ovl_node_t* const*) b;
+    return strcmp(na->path, nb->path);
+}
+
+
+void hostfs_ovl_deinit(hostfs_overlay_t* ov)
+{
+    if (!ov->enabled) {
+        return;
+    }
+
+    if (ov->export_path != NULL && ov->root_path != NULL) {
+        /* Sorting the paths makes parent directories come before their content */
+        qsort(ov->nodes, ov->count, sizeof(hostfs_ovl_node_t*), ovl_node_compare);
+        const size_t length = strlen(ov->export_path);
+        const bool tar = length >= 4 && strcmp(ov->export_path + length - 4, ".tar") == 0;
+        if ((tar ? ovl_export_tar(ov) : ovl_export_dir(ov)) == 0) {
+            log_printf("[HostFS] Overlay exported to %s\n", ov->export_path);
+        }
+        for (int i = 0; i < ov->count; i++) {
+            if (!ov->nodes[i]->detached && ov->nodes[i]->type == HOSTFS_OVL_WHITEOUT) {
+                log_printf("[HostFS] Overlay removed %s\n", ovl_relative(ov, ov->nodes[i]));
+            }
+        }
+    }
+
+    for (int i = 0; i < ov->count; i++) {
+        ovl_free_node(ov->nodes[i]);
+    }
+    free(ov->nodes);
+    memset(ov, 0, sizeof(*ov));
+}
@@ -8,12 +8,52 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include "utils/log.h"
+#include "utils/helpers.h"
+#include "utils/pages.h"
+#include "utils/paths.h"
 #include "hw/i2c/at24c512.h"
 
 // #define debug log_printf
 #define debug(...)
 
+/* Delay without any page written after which the modified pages are written back, in T-states */
+#define AT24C512_SYNC_PERIOD    CPUFREQ
+
+
+static bool at24c512_page_dirty(const at24c512_t* eeprom, int page)
+{
+    return (eeprom->dirty[page / 32] >> (page % 32)) & 1;
+}
+
+
+/**
+ * @brief Write the modified pages back to the file, the consecutive ones with a single call
+ */
+static void at24c512_sync(at24c512_t* eeprom)
+{
+    for (int page = 0; page < AT24C512_PAGES; ) {
+        if (!at24c512_page_dirty(eeprom, page)) {
+            page++;
+            continue;
+        }
+        int end = page + 1;
+        while (end < AT24C512_PAGES && at24c512_page_dirty(eeprom, end)) {
+            end++;
+        }
+        const size_t length = (size_t) (end - page) * AT24C512_PAGE;
+        debug("[EEPROM] Writing back pages 0x%x-0x%x to file\n", page, end - 1);
+        if (os_pwrite(eeprom->fd, &eeprom->data[page * AT24C512_PAGE], length, page * AT24C512_PAGE) != (ssize_t) length) {
+            log_perror("[EEPROM] Could not write back the image");
+        }
+        page = end;
+    }
+    memset(eeprom->dirty, 0, sizeof(eeprom->dirty));
+    eeprom->dirty_any = false;
+}
+
 static uint8_t at24c512_read(i2c_device_t* dev) {
     at24c512_t* eeprom = (at24c512_t*)dev;
     const uint8_t byte = eeprom->data[eeprom->address];
@@ -56,16 +96,16 @@ static void at24c512_start(i2c_device_t* dev) {
 
 static void at24c512_stop(i2c_device_t* dev) {
     at24c512_t* eeprom = (at24c512_t*)dev;
-    if (eeprom->writing && eeprom->file) {
-        const int page_start = eeprom->sector_written * AT24C512_PAGE;
-        fseek(eeprom->file, page_start, SEEK_SET);
-        debug("[EEPROM] Writing back sector 0x%x to file\n", eeprom->sector_written);
-        fwrite(&eeprom->data[page_start], 1, AT24C512_PAGE, eeprom->file);
+    if (eeprom->writing && eeprom->fd >= 0) {
+        const int page = eeprom->sector_written;
+        eeprom->dirty[page / 32] |= 1u << (page % 32);
+        eeprom->dirty_any = true;
+        eeprom->sync_countdown = AT24C512_SYNC_PERIOD;
     }
     eeprom->writing = false;
 }
 
-int at24c512_init(at24c512_t* eeprom, const char* filename)
+int at24c512_init(at24c512_t* eeprom, const char* filename, bool is_volatile)
 {
     if (eeprom == NULL) {
         return 1;
@@ -78,18 +118,28 @@ int at24c512_init(at24c512_t* eeprom, const char* filename)
     eeprom->parent.stop = at24c512_stop;
     eeprom->count = 0;
     eeprom->writing = false;
-    eeprom->file = NULL;
-    memset(eeprom->data, 0, AT24C512_SIZE);
+    eeprom->fd = -1;
+    eeprom->dirty_any = false;
+    memset(eeprom->dirty, 0, sizeof(eeprom->dirty));
+    eeprom->data = pages_alloc(AT24C512_SIZE);
+    if (eeprom->data == NULL) {
+        log_err_printf("[EEPROM] ERROR: could not allocate enough memory for the EEPROM\n");
+        return 2;
+    }
 
     if (filename) {
-        FILE* file = fopen(filename, "rb+");
-        if (file) {
-            size_t count = fread(eeprom->data, 1, AT24C512_SIZE, file);
-            log_printf("[EEPROM] Loaded from %s\n", filename);
+        int fd = open(filename, (is_volatile ? O_RDONLY : O_RDWR) | OPEN_BINARY);
+        if (fd >= 0) {
+            ssize_t count = read(fd, eeprom->data, AT24C512_SIZE);
+            log_printf("[EEPROM] Loaded from %s%s\n", filename, is_volatile ? " (volatile)" : "");
             if (count < AT24C512_SIZE) {
                 log_err_printf("[EEPROM] Warning: image size is smaller than EEPROM size\n");
             }
-            eeprom->file = file;
+            if (is_volatile) {
+                close(fd);
+            } else {
+                eeprom->fd = fd;
+            }
         } else {
             log_err_printf("[EEPROM] Could not open image %s\n", filename);
         }
@@ -99,11 +149,30 @@ int at24c512_init(at24c512_t* eeprom, const char* filename)
 }
 
 
+void at24c512_tick(at24c512_t* eeprom, int elapsed_tstates)
+{
+    if (!eeprom->dirty_any) {
+        return;
+    }
+    eeprom->sync_countdown -= elapsed_tstates;
+    if (eeprom->sync_countdown <= 0) {
+        at24c512_sync(eeprom);
+    }
+}
+
+
 void at24c512_deinit(at24c512_t* eeprom)
 {
-    if (eeprom == NULL || eeprom->file == NULL) {
+    if (eeprom == NULL) {
         return;
     }
-    fflush(eeprom->file);
-    fclose(eeprom->file);
+    if (eeprom->fd >= 0) {
+        if (eeprom->dirty_any) {
+            at24c512_sync(eeprom);
+        }
+        close(eeprom->fd);
+        eeprom->fd = -1;
+    }
+    pages_free(eeprom->data, AT24C512_SIZE);
+    eeprom->data = NULL;
 }
@@ -48,7 +48,9 @@ int main(int argc, char* argv[])
     }
 
     if (config.arguments.tf_filename != NULL &&
-        zvb_spi_load_tf_image(&machine.zvb.spi, config.arguments.tf_filename)) {
+        zvb_spi_load_tf_image(&machine.zvb.spi, config.arguments.tf_filename,
+                              config.arguments.tf_delta, config.arguments.discard_disks,
+                              config.storage.disk_durability, !machine.headless)) {
         goto deinit;
     }
 
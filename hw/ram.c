@@ -10,6 +10,7 @@
 #include <string.h>
 #include <stdint.h>
 #include "hw/ram.h"
+#include "utils/pages.h"
 #include "utils/log.h"
 
 
@@ -33,6 +34,19 @@ static void ram_write(device_t* dev, uint32_t addr, uint8_t data) {
 }
 
 
+static uint8_t* ram_direct(device_t* dev, uint32_t addr, bool write, uint32_t* size) {
+    ram_t* r = (ram_t*)dev;
+    (void) write;
+    if(addr >= r->size) {
+        return NULL;
+    }
+    if(*size > r->size - addr) {
+        *size = r->size - addr;
+    }
+    return &r->data[addr];
+}
+
+
 int ram_init(ram_t *r) {
     if(r == NULL) {
         return 1;
@@ -40,15 +54,13 @@ int ram_init(ram_t *r) {
 
     memset(r, 0, sizeof(*r));
     r->size = RAM_SIZE_KB;
-
-#if CONFIG_RAM_DYNAMIC_ARRAY
-    r->data = malloc(r->size);
+    r->data = pages_alloc(r->size);
     if (r->data == NULL) {
         log_err_printf("[RAM] ERROR: could not allocate enough memory for the RAM\n");
         return 2;
     }
-#endif
 
     device_init_mem(DEVICE(r), "ram_dev", ram_read, ram_write, r->size);
+    device_register_direct(DEVICE(r), ram_direct);
     return 0;
 }
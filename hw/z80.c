@@ -691,6 +691,44 @@ static void ini(z80* const z)
     z->mem_ptr  = get_bc(z) + 1;
 }
 
+// maximum number of repetitions performed by a single step of the fast path, about 700 T-states,
+// so that interrupts and device ticks are not delayed by a whole 256-byte block
+#define BLOCK_IO_MAX_COUNT 32
+
+// fast path for inir/otir: moves as many bytes as the machine accepts at once, with the same
+// result and timing as repeating the instruction. Returns false if nothing could be transferred.
+static bool block_io(z80* const z, bool out)
+{
+    unsigned (*transfer)(void*, uint16_t, uint16_t, unsigned) = out ? z->port_out_block : z->port_in_block;
+    unsigned count = z->b == 0 ? 256 : z->b;
+    if (count > BLOCK_IO_MAX_COUNT) {
+        count = BLOCK_IO_MAX_COUNT;
+    }
+
+    if (transfer == NULL || count < 2) {
+        return false;
+    }
+    const unsigned done = transfer(z->userdata, get_bc(z), get_hl(z), count);
+    if (done == 0) {
+        return false;
+    }
+
+    set_hl(z, get_hl(z) + done);
+    z->b       -= done;
+    z->zf       = z->b == 0;
+    z->nf       = 1;
+    z->mem_ptr  = get_bc(z) + 1;
+    // each repetition takes 21 cycles and the last one 16, the first 16 are already counted
+    z->cyc     += 21 * (done - 1);
+    // each repetition fetches the ED prefix and the opcode again, the first fetch is already counted
+    z->r        = (z->r & 0x80) | ((z->r + 2 * (done - 1)) & 0x7f);
+    if (z->b > 0) {
+        z->pc  -= 2;
+        z->cyc += 5;
+    }
+    return true;
+}
+
 static void ind(z80* const z)
 {
     ini(z);
@@ -822,6 +860,8 @@ void z80_init(z80* const z)
     z->write_byte = NULL;
     z->port_in    = NULL;
     z->port_out   = NULL;
+    z->port_in_block  = NULL;
+    z->port_out_block = NULL;
     z->userdata   = NULL;
 
     z->cyc = 0;
@@ -1783,6 +1823,9 @@ void exec_opcode_ed(z80* const z, uint8_t opcode)
 
         case 0xA2: ini(z); break; // ini
         case 0xB2:
+            if (block_io(z, false)) {
+                break;
+            }
             ini(z);
             if (z->b > 0) {
                 z->pc  -= 2;
@@ -1812,6 +1855,9 @@ void exec_opcode_ed(z80* const z, uint8_t opcode)
 
         case 0xA3: outi(z); break; // outi
         case 0xB3: {
+            if (block_io(z, true)) {
+                break;
+            }
             outi(z);
             if (z->b > 0) {
                 z->pc  -= 2;
@@ -59,6 +59,26 @@ bool show_fps = false;
 #endif
 
 
+/**
+ * @brief Draw the FPS overlay, including the frame skipping statistics
+ */
+static void zeal_draw_fps(zeal_t* machine)
+{
+    zvb_sound_stats_t stats;
+
+    DrawFPS(10, 10);
+    DrawText(frameskip_describe(&machine->frameskip), 10, 32, 20, LIME);
+
+    zvb_sound_get_stats(&machine->zvb.sound, &stats);
+    if (stats.target_us != 0) {
+        DrawText(TextFormat("Audio %u/%u ms, rate %+.2f%%, %u under, %u over",
+                            stats.fill_us / 1000, stats.target_us / 1000, stats.rate_ppm / 10000.0f,
+                            stats.underruns, stats.overruns),
+                 10, 54, 20, LIME);
+    }
+}
+
+
 /**
  * @brief Callback invoked when the CPU tries to read a byte in memory space
  */
@@ -160,6 +180,49 @@ static void zeal_phys_mem_write(void* opaque, uint32_t phys_addr, uint8_t data)
     }
 }
 
+/**
+ * @brief Get a host pointer to the memory backing the given physical address, limited to its page
+ */
+static uint8_t* zeal_phys_mem_direct(void* opaque, uint32_t phys_addr, bool write, uint32_t* size)
+{
+    if (phys_addr >= MEM_SPACE_SIZE) {
+        return NULL;
+    }
+    const zeal_t* machine    = (zeal_t*) opaque;
+    const map_entry_t* entry = &machine->mem_mapping[phys_addr / MMU_PAGE_SIZE];
+    device_t* device         = entry->dev;
+    const int start_addr     = entry->page_from * MMU_PAGE_SIZE;
+
+    if (device == NULL || device->mem_region.direct == NULL) {
+        return NULL;
+    }
+
+    const uint32_t page_remaining = MMU_PAGE_SIZE - (phys_addr % MMU_PAGE_SIZE);
+    *size = MIN(*size, page_remaining);
+    return device->mem_region.direct(device, phys_addr - start_addr, write, size);
+}
+
+/**
+ * @brief Get a host pointer to the memory backing the given virtual address, limited to its page
+ */
+static uint8_t* zeal_mem_direct(void* opaque, uint16_t virt_addr, bool write, uint32_t* size)
+{
+    const zeal_t* machine = (zeal_t*) opaque;
+    const uint32_t page_remaining = MMU_PAGE_SIZE - (virt_addr % MMU_PAGE_SIZE);
+    *size = MIN(*size, page_remaining);
+    return zeal_phys_mem_direct(opaque, mmu_get_phys_addr(&machine->mmu, virt_addr), write, size);
+}
+
+/**
+ * @brief A bus master is holding the bus, the CPU is stalled for the given amount of T-states.
+ * Since the cycles are added to the current instruction, all the devices will be ticked accordingly.
+ */
+static void zeal_bus_stall(void* opaque, unsigned long tstates)
+{
+    zeal_t* machine = (zeal_t*) opaque;
+    machine->cpu.cyc += tstates;
+}
+
 static uint8_t zeal_io_read(void* opaque, uint16_t addr)
 {
     zeal_t* machine          = (zeal_t*) opaque;
@@ -190,6 +253,77 @@ static void zeal_io_write(void* opaque, uint16_t addr, uint8_t data)
     }
 }
 
+static memory_op_t s_ops = {
+    .read_byte = zeal_mem_read,
+    .write_byte = zeal_mem_write,
+    .phys_read_byte = zeal_phys_mem_read,
+    .phys_write_byte = zeal_phys_mem_write,
+    .phys_direct = zeal_phys_mem_direct,
+    .direct = zeal_mem_direct,
+    .bus_stall = zeal_bus_stall,
+};
+
+
+/**
+ * @brief Copy bytes between the virtual address space and `data`, going through the MMU one page at a time
+ */
+static void zeal_virt_mem_copy(zeal_t* machine, uint16_t virt_addr, uint8_t* data, unsigned count, bool write)
+{
+    while (count > 0) {
+        const unsigned size = MIN(count, (unsigned) (MMU_PAGE_SIZE - (virt_addr % MMU_PAGE_SIZE)));
+        const uint32_t phys_addr = mmu_get_phys_addr(&machine->mmu, virt_addr);
+        if (write) {
+            memory_phys_write_bytes(&s_ops, phys_addr, data, size);
+        } else {
+            memory_phys_read_bytes(&s_ops, phys_addr, data, size);
+        }
+        virt_addr += size;
+        data += size;
+        count -= size;
+    }
+}
+
+/**
+ * @brief Callback invoked by INIR to read several bytes from the same I/O port at once,
+ * only for the devices that support block transfers.
+ */
+static unsigned zeal_io_read_block(void* opaque, uint16_t addr, uint16_t virt_addr, unsigned count)
+{
+    zeal_t* machine          = (zeal_t*) opaque;
+    const int low            = addr & 0xff;
+    const map_entry_t* entry = &machine->io_mapping[low];
+    device_t* device         = entry->dev;
+    uint8_t buffer[256];
+
+    if (device == NULL || device->io_region.block == NULL) {
+        return 0;
+    }
+    device->io_region.upper_addr = addr >> 8;
+    count = device->io_region.block(device, low - entry->page_from, false, buffer, MIN(count, sizeof(buffer)));
+    zeal_virt_mem_copy(machine, virt_addr, buffer, count, true);
+    return count;
+}
+
+/**
+ * @brief Callback invoked by OTIR to write several bytes to the same I/O port at once,
+ * only for the devices that support block transfers.
+ */
+static unsigned zeal_io_write_block(void* opaque, uint16_t addr, uint16_t virt_addr, unsigned count)
+{
+    zeal_t* machine          = (zeal_t*) opaque;
+    const int low            = addr & 0xff;
+    const map_entry_t* entry = &machine->io_mapping[low];
+    device_t* device         = entry->dev;
+    uint8_t buffer[256];
+
+    if (device == NULL || device->io_region.block == NULL) {
+        return 0;
+    }
+    count = MIN(count, sizeof(buffer));
+    zeal_virt_mem_copy(machine, virt_addr, buffer, count, false);
+    return device->io_region.block(device, low - entry->page_from, true, buffer, count);
+}
+
 /**
  * @brief Initialize the CPU and set the callbacks for the memory and I/O buses access.
  */
@@ -201,6 +335,8 @@ static void zeal_init_cpu(zeal_t* machine)
     machine->cpu.write_byte = zeal_mem_write;
     machine->cpu.port_in    = zeal_io_read;
     machine->cpu.port_out   = zeal_io_write;
+    machine->cpu.port_in_block  = zeal_io_read_block;
+    machine->cpu.port_out_block = zeal_io_write_block;
 }
 
 
@@ -328,13 +464,6 @@ static void zeal_read_keyboard(zeal_t* machine, int delta)
 }
 
 
-static memory_op_t s_ops = {
-    .read_byte = zeal_mem_read,
-    .write_byte = zeal_mem_write,
-    .phys_read_byte = zeal_phys_mem_read,
-    .phys_write_byte = zeal_phys_mem_write,
-};
-
 int zeal_reset(zeal_t* machine)
 {
     zeal_init_cpu(machine);
@@ -409,6 +538,7 @@ int zeal_init(zeal_t* machine)
 
         /* Since we want to enable scaling, make the ZVB output always go to a texture first */
         machine->zvb_out = LoadRenderTexture(ZVB_MAX_RES_WIDTH, ZVB_MAX_RES_HEIGHT);
+        frameskip_init(&machine->frameskip, config.video.frameskip, ZVB_FRAME_US / 1000000.0);
 
 #if CONFIG_ENABLE_DEBUGGER
         config_window_set(machine->dbg_enabled);
@@ -431,7 +561,7 @@ int zeal_init(zeal_t* machine)
     CHECK_ERR(err);
 
     // const rom = new ROM(this);
-    err = flash_init(&machine->rom);
+    err = flash_init(&machine->rom, config.arguments.rom_readonly);
     CHECK_ERR(err);
 
     // const ram = new RAM(512*KB);
@@ -467,11 +597,15 @@ int zeal_init(zeal_t* machine)
 
     // /* Extensions */
     // const compactflash = new CompactFlash(this);
-    const int cf_err = compactflash_init(&machine->compactflash, config.arguments.cf_filename);
+    /* Without GUI, the write backs are synchronous so that FLUSH CACHE always takes the same time */
+    const int cf_err = compactflash_init(&machine->compactflash, config.arguments.cf_filename,
+                                          config.arguments.cf_delta, config.arguments.discard_disks,
+                                          config.storage.cf_sync, config.storage.cf_sync_period,
+                                          config.storage.disk_durability, !machine->headless);
 
     // /* We could pass an initial content to the EEPROM, but set it to null for the moment */
     // const eeprom = new I2C_EEPROM(this, i2c, null);
-    err = at24c512_init(&machine->eeprom, config.arguments.eeprom_filename);
+    err = at24c512_init(&machine->eeprom, config.arguments.eeprom_filename, config.arguments.eeprom_volatile);
     CHECK_ERR(err);
 
     err = i2c_connect(&machine->i2c_bus, &machine->eeprom.parent);
@@ -479,8 +613,12 @@ int zeal_init(zeal_t* machine)
 
     // /* Create a HostFS to ease the file and directory access for the VM */
     // const hostfs = new HostFS(this.mem_read, this.mem_write);
-    err = hostfs_init(&machine->hostfs, &s_ops);
+    /* Headless runs keep the operations synchronous so that they stay reproducible */
+    err = hostfs_init(&machine->hostfs, &s_ops, !machine->headless, config.storage.hostfs_cache);
     CHECK_ERR(err);
+    if (config.arguments.hostfs_overlay) {
+        hostfs_enable_overlay(&machine->hostfs, config.arguments.hostfs_export);
+    }
 
     /* Initialize the semihosting device with CPU pointer for register access */
     err = semihost_init(&machine->semihost, &machine->cpu);
@@ -497,6 +635,9 @@ int zeal_init(zeal_t* machine)
     const zvb_config_t zvb_config = {
         .flipped_y = false,
         .rendering_enabled = !machine->headless,
+        .audio_sync = config.audio.sync,
+        .audio_output = config.arguments.wav_filename,
+        .audio_sums = config.arguments.wav_sums_filename,
     };
     err = zvb_init(&machine->zvb, &zvb_config, &s_ops);
     CHECK_ERR(err);
@@ -531,6 +672,22 @@ int zeal_init(zeal_t* machine)
     return 0;
 }
 
+/**
+ * @brief Go through all the devices that have a tick function. The DMA may stall the CPU from
+ * zvb_tick, the other devices must see these T-states too to stay in sync with the CPU.
+ */
+static void zeal_tick_devices(zeal_t* machine, int elapsed_tstates)
+{
+    const unsigned long cycles = machine->cpu.cyc;
+    zvb_tick(&machine->zvb, elapsed_tstates);
+    elapsed_tstates += (int) (machine->cpu.cyc - cycles);
+
+    keyboard_tick(&machine->keyboard, &machine->pio, elapsed_tstates);
+    flash_tick(&machine->rom, elapsed_tstates);
+    compactflash_tick(&machine->compactflash, elapsed_tstates);
+    at24c512_tick(&machine->eeprom, elapsed_tstates);
+}
+
 /**
  * @brief Run Zeal 8-bit Computer VM in headless mode (no window/input/presentation)
  */
@@ -544,9 +701,7 @@ static int zeal_headless_mode_run(zeal_t* machine)
         return 0;
     }
 
-    zvb_tick(&machine->zvb, elapsed_tstates);
-    keyboard_tick(&machine->keyboard, &machine->pio, elapsed_tstates);
-    flash_tick(&machine->rom, elapsed_tstates);
+    zeal_tick_devices(machine, elapsed_tstates);
     return 0;
 }
 
@@ -598,21 +753,50 @@ void zeal_debug_toggle(dbg_t *dbg)
     }
 }
 
+/**
+ * @brief Check whether the VRAM debug views can be refreshed. While the CPU is running, the refresh
+ * rate is limited by the configuration, when paused, the views are refreshed immediately.
+ */
+static bool zeal_dbg_vram_refresh_due(zeal_t* machine)
+{
+    const int rate = config.debugger.vram_refresh_rate;
+    if (machine->dbg_state == ST_PAUSED || rate <= 0) {
+        return true;
+    }
+
+    const double now = GetTime();
+    if (now - machine->dbg_vram_refresh < 1.0 / rate) {
+        return false;
+    }
+    machine->dbg_vram_refresh = now;
+    return true;
+}
+
 /**
  * Returns 1 if rendered, 0 else
  */
 static int zeal_dbg_mode_display(zeal_t* machine)
 {
+    /* If the host can't keep up with the emulation, drop the frame, including the debugger UI */
+    if (machine->dbg_state != ST_PAUSED && zvb_frame_ready(&machine->zvb) &&
+        frameskip_next(&machine->frameskip))
+    {
+        zvb_skip_frame(&machine->zvb);
+        return 0;
+    }
+
     /**
      * Prepare the rendering, if the returned value is true, we can
      * proceed to rendering, else, we don't need to update the view.
      * However, if the CPU is paused (breakpoint/step), force the rendering.
      */
     if (zvb_prepare_render(&machine->zvb)) {
-        /* Display all the devices that have a render function */
-        BeginTextureMode(machine->zvb_out);
-            zvb_render(&machine->zvb);
-        EndTextureMode();
+        /* Display all the devices that have a render function, if anything changed since the last frame */
+        if (zvb_content_changed(&machine->zvb)) {
+            BeginTextureMode(machine->zvb_out);
+                zvb_render(&machine->zvb);
+            EndTextureMode();
+        }
     } else if (machine->dbg_state == ST_PAUSED) {
         /* No need for `prepare` in this case */
         BeginTextureMode(machine->zvb_out);
@@ -623,9 +807,10 @@ static int zeal_dbg_mode_display(zeal_t* machine)
         return 0;
     }
 
-    /* Generate VRAM debug textures if the VRAM debugging window is opened */
-    if (debugger_ui_vram_panel_opened(machine->dbg_ui)) {
-        zvb_render_debug_textures(&machine->zvb);
+    /* Generate the VRAM debug textures that are visible in the VRAM debugging window */
+    const uint32_t vram_views = debugger_ui_vram_visible_views(machine->dbg_ui);
+    if (vram_views != 0 && zeal_dbg_vram_refresh_due(machine)) {
+        zvb_render_debug_textures(&machine->zvb, vram_views);
     }
 
     debugger_ui_prepare_render(machine->dbg_ui, &machine->dbg);
@@ -635,7 +820,7 @@ static int zeal_dbg_mode_display(zeal_t* machine)
         debugger_ui_render(machine->dbg_ui, &machine->dbg);
         notif_render(GetScreenWidth() - notif_estimate_width() - 20, 10);
         if(show_fps == true) {
-            DrawFPS(10, 10);
+            zeal_draw_fps(machine);
         }
 
     EndDrawing();
@@ -668,9 +853,7 @@ static int zeal_dbg_mode_run(zeal_t* machine)
         }
 
         /* Go through all the devices that have a tick function */
-        zvb_tick(&machine->zvb, elapsed_tstates);
-        keyboard_tick(&machine->keyboard, &machine->pio, elapsed_tstates);
-        flash_tick(&machine->rom, elapsed_tstates);
+        zeal_tick_devices(machine, elapsed_tstates);
 
         /* Check if we reached a breakpoint or if we have to do a single step */
         if (machine->dbg_state == ST_REQ_STEP ||
@@ -720,11 +903,12 @@ static int zeal_normal_mode_run(zeal_t* machine)
     }
 
     /* Go through all the devices that have a tick function */
-    zvb_tick(&machine->zvb, elapsed_tstates);
-    keyboard_tick(&machine->keyboard, &machine->pio, elapsed_tstates);
-    flash_tick(&machine->rom, elapsed_tstates);
+    zeal_tick_devices(machine, elapsed_tstates);
 
-    if (zvb_prepare_render(&machine->zvb)) {
+    if (zvb_frame_ready(&machine->zvb) && frameskip_next(&machine->frameskip)) {
+        /* The host can't keep up with the emulation, don't prepare nor present this frame */
+        zvb_skip_frame(&machine->zvb);
+    } else if (zvb_prepare_render(&machine->zvb)) {
         rendered = 1;
         const int screen_w = GetScreenWidth();
         const int screen_h = GetScreenHeight();
@@ -749,9 +933,12 @@ static int zeal_normal_mode_run(zeal_t* machine)
             pos_x = (screen_w - draw_w) / 2;
         }
 
-        BeginTextureMode(machine->zvb_out);
-            zvb_render(&machine->zvb);
-        EndTextureMode();
+        /* When the video board content didn't change, present the previous frame again */
+        if (zvb_content_changed(&machine->zvb)) {
+            BeginTextureMode(machine->zvb_out);
+                zvb_render(&machine->zvb);
+            EndTextureMode();
+        }
 
         BeginDrawing();
             ClearBackground(DARKGRAY);
@@ -764,7 +951,7 @@ static int zeal_normal_mode_run(zeal_t* machine)
             /* Show notifications on the top-right of the visible content */
             notif_render(pos_x + draw_w - notif_estimate_width() - 20, pos_y + 10);
             if(show_fps == true) {
-                DrawFPS(10, 10);
+                zeal_draw_fps(machine);
             }
         EndDrawing();
     }
@@ -816,6 +1003,10 @@ static void zeal_run_headless(zeal_t* machine)
 
     snes_adapter_detach(&machine->snes_adapter);
     zvb_deinit(&machine->zvb);
+    flash_deinit(&machine->rom);
+    compactflash_deinit(&machine->compactflash);
+    at24c512_deinit(&machine->eeprom);
+    hostfs_deinit(&machine->hostfs);
 }
 
 void zeal_exit(zeal_t* machine)
@@ -857,6 +1048,10 @@ int zeal_run(zeal_t* machine)
 
     snes_adapter_detach(&machine->snes_adapter);
     zvb_deinit(&machine->zvb);
+    flash_deinit(&machine->rom);
+    compactflash_deinit(&machine->compactflash);
+    at24c512_deinit(&machine->eeprom);
+    hostfs_deinit(&machine->hostfs);
     CloseWindow();
 
     return ret;
@@ -29,8 +29,6 @@
 
 
 #define ZVB_IO_SIZE         (3 * 16)
-/* The video board occupies 128KB of memory, but the VRAM is not that big  */
-#define ZVB_MEM_SIZE        (128 * 1024)
 
 /* Mapping for all the different types of memory, relative to the VRAM */
 #define LAYER0_ADDR_START         (0x00000U)
@@ -51,6 +49,19 @@
 #define TILESET_ADDR_START        (0x10000U)
 #define TILESET_ADDR_END          (0x20000U)
 
+/**
+ * @brief Sub-blocks that can be found in the memory window
+ */
+typedef enum {
+    REGION_NONE = 0,
+    REGION_LAYER0,
+    REGION_LAYER1,
+    REGION_PALETTE,
+    REGION_SPRITES,
+    REGION_FONT,
+    REGION_TILESET,
+} zvb_region_t;
+
 /**
  * @brief Calculate the size (width or height) counting a grid
  */
@@ -83,15 +94,17 @@ static void zvb_reset(device_t* dev);
 
 static const long s_tstates_remaining[STATE_COUNT] = {
     /* The raster spends 15.253 ms in the visible area */
-    [STATE_IDLE]         = US_TO_TSTATES(15253),
+    [STATE_IDLE]         = US_TO_TSTATES(ZVB_VISIBLE_US),
     /* The raster stays in V-Blank during 1.430ms  */
-    [STATE_VBLANK]       = US_TO_TSTATES(1430),
+    [STATE_VBLANK]       = US_TO_TSTATES(ZVB_VBLANK_US),
 };
 
 
-static uint8_t zvb_mem_read(device_t* dev, uint32_t addr)
+/**
+ * @brief Read a byte from a block that cannot be accessed directly
+ */
+static uint8_t zvb_mem_read_slow(zvb_t* zvb, uint32_t addr)
 {
-    zvb_t* zvb = (zvb_t*) dev;
     /* Prevent a compilation warning, since LAYER0_ADDR_START is 0 */
     if (addr < LAYER0_ADDR_END) {
         return zvb_tilemap_read(&zvb->layers, 0, addr);
@@ -110,9 +123,11 @@ static uint8_t zvb_mem_read(device_t* dev, uint32_t addr)
 }
 
 
-static void zvb_mem_write(device_t* dev, uint32_t addr, uint8_t data)
+/**
+ * @brief Write a byte to a block that cannot be accessed directly (latched registers, partial blocks)
+ */
+static void zvb_mem_write_slow(zvb_t* zvb, uint32_t addr, uint8_t data)
 {
-    zvb_t* zvb = (zvb_t*) dev;
     /* Prevent a compilation warning, since LAYER0_ADDR_START is 0 */
     if (addr < LAYER0_ADDR_END) {
         zvb_tilemap_write(&zvb->layers, 0, addr, data);
@@ -130,6 +145,149 @@ static void zvb_mem_write(device_t* dev, uint32_t addr, uint8_t data)
 }
 
 
+static inline void zvb_mark_block_dirty(zvb_t* zvb, uint32_t block)
+{
+    zvb->dirty_blocks[block / 32] |= 1U << (block % 32);
+}
+
+
+static uint8_t zvb_mem_read(device_t* dev, uint32_t addr)
+{
+    zvb_t* zvb = (zvb_t*) dev;
+    const zvb_mem_block_t* block = &zvb->mem_blocks[addr / ZVB_MEM_BLOCK_SIZE];
+
+    if (block->rd != NULL) {
+        return block->rd[addr % ZVB_MEM_BLOCK_SIZE];
+    }
+    return zvb_mem_read_slow(zvb, addr);
+}
+
+
+static void zvb_mem_write(device_t* dev, uint32_t addr, uint8_t data)
+{
+    zvb_t* zvb = (zvb_t*) dev;
+    const zvb_mem_block_t* block = &zvb->mem_blocks[addr / ZVB_MEM_BLOCK_SIZE];
+    zvb->generation++;
+
+    if (block->wr != NULL) {
+        block->wr[addr % ZVB_MEM_BLOCK_SIZE] = data;
+        zvb_mark_block_dirty(zvb, addr / ZVB_MEM_BLOCK_SIZE);
+    } else {
+        zvb_mem_write_slow(zvb, addr, data);
+    }
+}
+
+
+/**
+ * @brief Get a direct pointer to the VRAM, for bulk accesses. Writes are marked as dirty immediately.
+ */
+static uint8_t* zvb_mem_direct(device_t* dev, uint32_t addr, bool write, uint32_t* size)
+{
+    zvb_t* zvb = (zvb_t*) dev;
+    uint32_t block = addr / ZVB_MEM_BLOCK_SIZE;
+    const zvb_mem_block_t* entry = &zvb->mem_blocks[block];
+    uint8_t* ptr = write ? entry->wr : entry->rd;
+
+    if (ptr == NULL || *size == 0) {
+        return NULL;
+    }
+    ptr += addr % ZVB_MEM_BLOCK_SIZE;
+
+    /* Merge the following blocks as long as they are contiguous in the host memory */
+    uint32_t available = ZVB_MEM_BLOCK_SIZE - addr % ZVB_MEM_BLOCK_SIZE;
+    while (available < *size && block + 1 < ZVB_MEM_BLOCK_COUNT) {
+        const zvb_mem_block_t* next = &zvb->mem_blocks[block + 1];
+        const uint8_t* next_ptr = write ? next->wr : next->rd;
+        if (next_ptr != ptr + available) {
+            break;
+        }
+        available += ZVB_MEM_BLOCK_SIZE;
+        block++;
+    }
+    *size = MIN(*size, available);
+
+    if (write) {
+        zvb->generation++;
+        const uint32_t last = (addr + *size - 1) / ZVB_MEM_BLOCK_SIZE;
+        for (uint32_t i = addr / ZVB_MEM_BLOCK_SIZE; i <= last; i++) {
+            zvb_mark_block_dirty(zvb, i);
+        }
+    }
+    return ptr;
+}
+
+
+/**
+ * @brief Register a sub-block in the memory decoding table.
+ *
+ * @param raw Memory backing the sub-block, NULL if it must always go through the slow path
+ * @param writable Whether writes can be performed directly on `raw` (no side effect)
+ */
+static void zvb_mem_map_region(zvb_t* zvb, zvb_region_t region, uint32_t start, uint32_t end,
+                               uint8_t* raw, bool writable)
+{
+    for (uint32_t addr = start & ~(ZVB_MEM_BLOCK_SIZE - 1); addr < end; addr += ZVB_MEM_BLOCK_SIZE) {
+        zvb_mem_block_t* block = &zvb->mem_blocks[addr / ZVB_MEM_BLOCK_SIZE];
+        block->region = region;
+        /* Blocks partially covered by the region must go through the slow path to check the bounds */
+        if (raw != NULL && addr >= start && addr + ZVB_MEM_BLOCK_SIZE <= end) {
+            block->rd = raw + (addr - start);
+            block->wr = writable ? block->rd : NULL;
+        }
+    }
+}
+
+
+static void zvb_mem_init_table(zvb_t* zvb)
+{
+    memset(zvb->mem_blocks, 0, sizeof(zvb->mem_blocks));
+    memset(zvb->dirty_blocks, 0, sizeof(zvb->dirty_blocks));
+    zvb_mem_map_region(zvb, REGION_LAYER0,  LAYER0_ADDR_START,  LAYER0_ADDR_END,  zvb->layers.raw_layer0, true);
+    zvb_mem_map_region(zvb, REGION_LAYER1,  LAYER1_ADDR_START,  LAYER1_ADDR_END,  zvb->layers.raw_layer1, true);
+    /* Palette and sprites writes are latched, they can only be read directly */
+    zvb_mem_map_region(zvb, REGION_PALETTE, PALETTE_ADDR_START, PALETTE_ADDR_END, zvb->palette.raw_palette, false);
+    zvb_mem_map_region(zvb, REGION_SPRITES, SPRITES_ADDR_START, SPRITES_ADDR_END, (uint8_t*) zvb->sprites.data, false);
+    zvb_mem_map_region(zvb, REGION_FONT,    FONT_ADDR_START,    FONT_ADDR_END,    zvb->font.raw_font, true);
+    zvb_mem_map_region(zvb, REGION_TILESET, TILESET_ADDR_START, TILESET_ADDR_END, zvb->tileset.raw, true);
+}
+
+
+/**
+ * @brief Notify the sub-blocks about the blocks that were written directly
+ */
+static void zvb_mem_flush_dirty(zvb_t* zvb)
+{
+    for (uint32_t word = 0; word < DIM(zvb->dirty_blocks); word++) {
+        uint32_t bits = zvb->dirty_blocks[word];
+        zvb->dirty_blocks[word] = 0;
+
+        for (uint32_t i = 0; bits != 0; i++, bits >>= 1) {
+            if ((bits & 1) == 0) {
+                continue;
+            }
+            const uint32_t start = (word * 32 + i) * ZVB_MEM_BLOCK_SIZE;
+            const uint32_t end = start + ZVB_MEM_BLOCK_SIZE;
+            switch (zvb->mem_blocks[word * 32 + i].region) {
+                case REGION_LAYER0:
+                    zvb_tilemap_mark_dirty(&zvb->layers, start - LAYER0_ADDR_START, end - LAYER0_ADDR_START);
+                    break;
+                case REGION_LAYER1:
+                    zvb_tilemap_mark_dirty(&zvb->layers, start - LAYER1_ADDR_START, end - LAYER1_ADDR_START);
+                    break;
+                case REGION_FONT:
+                    zvb_font_mark_dirty(&zvb->font, start - FONT_ADDR_START, end - FONT_ADDR_START);
+                    break;
+                case REGION_TILESET:
+                    zvb_tileset_mark_dirty(&zvb->tileset, start - TILESET_ADDR_START, end - TILESET_ADDR_START);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+
 static uint8_t zvb_io_read_control(zvb_t* zvb, uint32_t addr)
 {
     switch(addr) {
@@ -193,6 +351,7 @@ static void zvb_io_write_control(zvb_t* zvb, uint32_t addr, uint8_t value)
 {
     /* We may need to interpret the data as a status below */
     const zvb_status_t status = { .raw = value };
+    zvb->generation++;
 
     switch(addr) {
         case ZVB_IO_CONFIG_L0_SCR_Y_LOW:
@@ -248,6 +407,7 @@ static void zvb_io_write(device_t* dev, uint32_t addr, uint8_t data)
         switch (zvb->io_bank) {
             case ZVB_IO_MAPPING_TEXT:
                 zvb_text_write(&zvb->text, subaddr, data, &zvb->layers);
+                zvb->generation++;
                 break;
             case ZVB_IO_MAPPING_SPI:
                 zvb_spi_write(&zvb->spi, subaddr, data);
@@ -338,6 +498,7 @@ int zvb_init(zvb_t* dev, const zvb_config_t* config, const memory_op_t* ops)
     memset(dev, 0, sizeof(zvb_t));
     device_init_mem(DEVICE(dev), "zvb_dev", zvb_mem_read, zvb_mem_write, ZVB_MEM_SIZE);
     device_init_io(DEVICE(dev),  "zvb_dev", zvb_io_read, zvb_io_write, ZVB_IO_SIZE);
+    device_register_direct(DEVICE(dev), zvb_mem_direct);
     device_register_reset(DEVICE(dev), zvb_reset);
     dev->mode = MODE_DEFAULT;
     dev->rendering_enabled = rendering_enabled;
@@ -345,13 +506,23 @@ int zvb_init(zvb_t* dev, const zvb_config_t* config, const memory_op_t* ops)
     zvb_palette_init(&dev->palette, rendering_enabled);
     zvb_font_init(&dev->font, rendering_enabled);
     zvb_tilemap_init(&dev->layers, rendering_enabled);
-    zvb_tileset_init(&dev->tileset, rendering_enabled);
+    if (zvb_tileset_init(&dev->tileset, rendering_enabled) != 0) {
+        log_err_printf("[ZVB] ERROR: could not allocate the tileset\n");
+        return 1;
+    }
     zvb_text_init(&dev->text);
     zvb_sprites_init(&dev->sprites, rendering_enabled);
     zvb_spi_init(&dev->spi);
     zvb_crc32_init(&dev->peri_crc32);
-    zvb_sound_init(&dev->sound, rendering_enabled);
-    zvb_dma_init(&dev->dma, ops);
+    if (config->audio_output != NULL) {
+        if (zvb_sound_init_offline(&dev->sound, config->audio_output, config->audio_sums) != 0) {
+            return 1;
+        }
+    } else {
+        zvb_sound_init(&dev->sound, rendering_enabled, config->audio_sync);
+    }
+    zvb_dma_init(&dev->dma, ops, &dev->sound);
+    zvb_mem_init_table(dev);
 
     if (rendering_enabled) {
         dev->tex_dummy = LoadRenderTexture(ZVB_MAX_RES_WIDTH, ZVB_MAX_RES_HEIGHT);
@@ -372,6 +543,8 @@ int zvb_init(zvb_t* dev, const zvb_config_t* config, const memory_op_t* ops)
     /* Enable the screen by default */
     dev->status.vid_ena = 1;
     dev->need_render = false;
+    /* Make sure the very first frame is rendered */
+    dev->generation = 1;
 
     /* For the debugger */
     dev->flipped_y = config->flipped_y;
@@ -381,6 +554,7 @@ int zvb_init(zvb_t* dev, const zvb_config_t* config, const memory_op_t* ops)
 static void zvb_reset(device_t* dev)
 {
     zvb_t* zvb = (zvb_t*) dev;
+    zvb->generation++;
     zvb_text_reset(&zvb->text);
     zvb_spi_reset(&zvb->spi);
     zvb_crc32_reset(&zvb->peri_crc32);
@@ -451,11 +625,18 @@ static void zvb_render_text_mode(zvb_t* zvb)
 }
 
 /**
- * @brief Render the debug textures when we are in text mode.
+ * @brief Render the requested debug textures when we are in text mode.
  * The `zvb_render` function must be called first.
+ *
+ * @param views Bitmap of the `ZVB_DBG_VIEW` to render
  */
-static void zvb_render_debug_text_mode(zvb_t* zvb)
+static void zvb_render_debug_text_mode(zvb_t* zvb, uint32_t views)
 {
+    static const int s_views[][2] = {
+        { DBG_TILEMAP_LAYER0, TEXT_DEBUG_LAYER0_MODE },
+        { DBG_TILEMAP_LAYER1, TEXT_DEBUG_LAYER1_MODE },
+        { DBG_FONT,           TEXT_DEBUG_FONT_MODE },
+    };
     /* Since we want to generate a debug texture, we only need to set it to debug mode */
     zvb_shader_t* st_shader = &zvb->shaders[SHADER_TEXT_DEBUG];
     const Shader shader = st_shader->shader;
@@ -469,51 +650,34 @@ static void zvb_render_debug_text_mode(zvb_t* zvb)
     const int width = TEXT_MAXIMUM_COLUMNS * (TEXT_CHAR_WIDTH + grid_thickness) + 1;
     const int height = TEXT_MAXIMUM_LINES * (TEXT_CHAR_HEIGHT + grid_thickness) + 1;
 
-    /* Tilemap mode */
-    int dbg_mode = TEXT_DEBUG_LAYER0_MODE;
-    BeginTextureMode(zvb->debug_tex[DBG_TILEMAP_LAYER0]);
-        BeginShaderMode(shader);
+    for (size_t i = 0; i < DIM(s_views); i++) {
+        const int view = s_views[i][0];
+        if ((views & ZVB_DBG_VIEW(view)) == 0) {
+            continue;
+        }
+
+        RenderTexture* texture = &zvb->debug_tex[view];
+        Rectangle rect = { 0, 0, texture->texture.width, texture->texture.height };
+        Vector2 position = { 0, 0 };
+        if (view != DBG_FONT) {
+            /* Since the texture is bigger than the content, render the content at the top left */
+            rect = (Rectangle){ 0, 0, width, height };
+            position = (Vector2){ 0, ZVB_DBG_RES_HEIGHT - height };
+        }
+
+        BeginTextureMode(*texture);
             ClearBackground(BLANK);
-            /* Transfer all the texture to the GPU */
-            SetShaderValue(shader, dbg_mode_idx, &dbg_mode, SHADER_UNIFORM_INT);
-            SetShaderValue(shader, mode_idx, &zvb->mode, SHADER_UNIFORM_INT);
-            SetShaderValueTexture(shader, palette_idx, zvb_pal_texture(&zvb->palette));
-            SetShaderValueTexture(shader, tilemaps_idx, *zvb_tilemap_texture(&zvb->layers));
-            SetShaderValueTexture(shader, font_idx, zvb_font_texture(&zvb->font));
-            DrawTextureRec(zvb->tex_dummy.texture,
-                            (Rectangle){ 0, 0, width, height },
-                            /* Since the texture is bigger than the content, render the content at the top left */
-                            (Vector2){ 0, ZVB_DBG_RES_HEIGHT-height },
-                            WHITE);
-        EndShaderMode();
-    EndTextureMode();
-
-    /* Font mode, no need to reload all the textures, they are all in the shaders already */
-    dbg_mode = TEXT_DEBUG_LAYER1_MODE;
-    BeginTextureMode(zvb->debug_tex[DBG_TILEMAP_LAYER1]);
-        ClearBackground(BLANK);
-        BeginShaderMode(shader);
-            SetShaderValue(shader, dbg_mode_idx, &dbg_mode, SHADER_UNIFORM_INT);
-            DrawTextureRec(zvb->tex_dummy.texture,
-                            (Rectangle){ 0, 0, width, height },
-                            /* Since the texture is bigger than the content, render the content at the top left */
-                            (Vector2){ 0, ZVB_DBG_RES_HEIGHT-height },
-                            WHITE);
-        EndShaderMode();
-    EndTextureMode();
-
-    dbg_mode = TEXT_DEBUG_FONT_MODE;
-    RenderTexture* texture = &zvb->debug_tex[DBG_FONT];
-    BeginTextureMode(*texture);
-        ClearBackground(BLANK);
-        BeginShaderMode(shader);
-            SetShaderValue(shader, dbg_mode_idx, &dbg_mode, SHADER_UNIFORM_INT);
-            DrawTextureRec(zvb->tex_dummy.texture,
-                            (Rectangle){ 0, 0, texture->texture.width, texture->texture.height },
-                            (Vector2){ 0, 0 },
-                            WHITE);
-        EndShaderMode();
-    EndTextureMode();
+            BeginShaderMode(shader);
+                /* Any view may be the first one rendered, transfer all the textures to the GPU */
+                SetShaderValue(shader, dbg_mode_idx, &s_views[i][1], SHADER_UNIFORM_INT);
+                SetShaderValue(shader, mode_idx, &zvb->mode, SHADER_UNIFORM_INT);
+                SetShaderValueTexture(shader, palette_idx, zvb_pal_texture(&zvb->palette));
+                SetShaderValueTexture(shader, tilemaps_idx, *zvb_tilemap_texture(&zvb->layers));
+                SetShaderValueTexture(shader, font_idx, zvb_font_texture(&zvb->font));
+                DrawTextureRec(zvb->tex_dummy.texture, rect, position, WHITE);
+            EndShaderMode();
+        EndTextureMode();
+    }
 }
 
 static void zvb_prepare_render_gfx_mode(zvb_t* zvb)
@@ -597,8 +761,20 @@ static void zvb_render_gfx_mode(zvb_t* zvb)
 }
 
 
-static void zvb_render_debug_gfx_mode(zvb_t* zvb)
+/**
+ * @brief Render the requested debug textures when we are in graphics mode.
+ *
+ * @param views Bitmap of the `ZVB_DBG_VIEW` to render
+ */
+static void zvb_render_debug_gfx_mode(zvb_t* zvb, uint32_t views)
 {
+    static const int s_views[][2] = {
+        { DBG_TILEMAP_LAYER0, GFX_DEBUG_LAYER0_MODE },
+        { DBG_TILEMAP_LAYER1, GFX_DEBUG_LAYER1_MODE },
+        /* In the case of the tileset, we have 16x32 tiles at most */
+        { DBG_TILESET,        GFX_DEBUG_TILESET_MODE },
+        { DBG_PALETTE,        GFX_DEBUG_PALETTE_MODE },
+    };
     /* Since we want to generate a debug texture, we only need to set it to debug mode */
     zvb_shader_t* st_shader = &zvb->shaders[SHADER_GFX_DEBUG];
     const Shader shader = st_shader->shader;
@@ -608,65 +784,29 @@ static void zvb_render_debug_gfx_mode(zvb_t* zvb)
     const int tileset_idx  = st_shader->objects[GFX_SHADER_TILESET_IDX];
     const int palette_idx  = st_shader->objects[GFX_SHADER_PALETTE_IDX];
 
-    int dbg_mode = GFX_DEBUG_LAYER0_MODE;
-    RenderTexture* texture = &zvb->debug_tex[DBG_TILEMAP_LAYER0];
-
-    BeginTextureMode(*texture);
-        BeginShaderMode(shader);
-            /* Transfer all the texture to the GPU */
-            SetShaderValue(shader, mode_idx, &zvb->mode, SHADER_UNIFORM_INT);
-            SetShaderValue(shader, dbg_mode_idx, &dbg_mode, SHADER_UNIFORM_INT);
-            SetShaderValueTexture(shader, palette_idx, zvb_pal_texture(&zvb->palette));
-            SetShaderValueTexture(shader, tilemaps_idx, *zvb_tilemap_texture(&zvb->layers));
-            SetShaderValueTexture(shader, tileset_idx, *zvb_tileset_texture(&zvb->tileset));
-
-            DrawTextureRec(zvb->tex_dummy.texture,
-                            (Rectangle){ 0, 0, texture->texture.width, texture->texture.height },
-                            (Vector2){ 0, 0 },
-                            WHITE);
-        EndShaderMode();
-    EndTextureMode();
-
-    /* Debug layer 1, tell the shader to debug layer 1 in the mode (bit 30) */
-    dbg_mode = GFX_DEBUG_LAYER1_MODE;
-    texture = &zvb->debug_tex[DBG_TILEMAP_LAYER1];
-    BeginTextureMode(*texture);
-        BeginShaderMode(shader);
-            SetShaderValue(shader, dbg_mode_idx, &dbg_mode, SHADER_UNIFORM_INT);
-            DrawTextureRec(zvb->tex_dummy.texture,
-                            (Rectangle){ 0, 0, texture->texture.width, texture->texture.height },
-                            (Vector2){ 0, 0 },
-                            WHITE);
-        EndShaderMode();
-    EndTextureMode();
-
-    /* Debug the tileset, in this case, we have 16x32 tiles at most */
-    dbg_mode = GFX_DEBUG_TILESET_MODE;
-    texture = &zvb->debug_tex[DBG_TILESET];
-    BeginTextureMode(*texture);
-        ClearBackground(BLANK);
-        BeginShaderMode(shader);
-            SetShaderValue(shader, dbg_mode_idx, &dbg_mode, SHADER_UNIFORM_INT);
-            DrawTextureRec(zvb->tex_dummy.texture,
-                            (Rectangle){ 0, 0, texture->texture.width, texture->texture.height },
-                            (Vector2){ 0, 0 },
-                            WHITE);
-        EndShaderMode();
-    EndTextureMode();
-
-    /* Palette mode */
-    dbg_mode = GFX_DEBUG_PALETTE_MODE;
-    texture = &zvb->debug_tex[DBG_PALETTE];
-    BeginTextureMode(*texture);
-        ClearBackground(BLANK);
-        BeginShaderMode(shader);
-            SetShaderValue(shader, dbg_mode_idx, &dbg_mode, SHADER_UNIFORM_INT);
-            DrawTextureRec(zvb->tex_dummy.texture,
-                            (Rectangle){ 0, 0, texture->texture.width, texture->texture.height },
-                            (Vector2){ 0, 0 },
-                            WHITE);
-        EndShaderMode();
-    EndTextureMode();
+    for (size_t i = 0; i < DIM(s_views); i++) {
+        const int view = s_views[i][0];
+        if ((views & ZVB_DBG_VIEW(view)) == 0) {
+            continue;
+        }
+
+        RenderTexture* texture = &zvb->debug_tex[view];
+        BeginTextureMode(*texture);
+            ClearBackground(BLANK);
+            BeginShaderMode(shader);
+                /* Any view may be the first one rendered, transfer all the textures to the GPU */
+                SetShaderValue(shader, mode_idx, &zvb->mode, SHADER_UNIFORM_INT);
+                SetShaderValue(shader, dbg_mode_idx, &s_views[i][1], SHADER_UNIFORM_INT);
+                SetShaderValueTexture(shader, palette_idx, zvb_pal_texture(&zvb->palette));
+                SetShaderValueTexture(shader, tilemaps_idx, *zvb_tilemap_texture(&zvb->layers));
+                SetShaderValueTexture(shader, tileset_idx, *zvb_tileset_texture(&zvb->tileset));
+                DrawTextureRec(zvb->tex_dummy.texture,
+                                (Rectangle){ 0, 0, texture->texture.width, texture->texture.height },
+                                (Vector2){ 0, 0 },
+                                WHITE);
+            EndShaderMode();
+        EndTextureMode();
+    }
 }
 
 
@@ -683,6 +823,15 @@ bool zvb_prepare_render(zvb_t* zvb)
         return false;
     }
 
+    zvb->need_render = false;
+
+    /* Nothing changed since the last frame, the textures are already up to date */
+    if (!zvb_content_changed(zvb)) {
+        return true;
+    }
+
+    zvb_mem_flush_dirty(zvb);
+
     switch (zvb->mode) {
         case MODE_TEXT_640:
         case MODE_TEXT_320:
@@ -702,16 +851,28 @@ bool zvb_prepare_render(zvb_t* zvb)
     return true;
 }
 
-void zvb_render_debug_textures(zvb_t* zvb)
+void zvb_render_debug_textures(zvb_t* zvb, uint32_t views)
 {
     if (!zvb->rendering_enabled) {
         return;
     }
 
+    /* If the VRAM was modified since the last debug render, all the views are outdated,
+     * else, only render the views that were not visible at that time */
+    if (zvb->debug_generation != zvb->generation) {
+        zvb->debug_generation = zvb->generation;
+        zvb->debug_views = 0;
+    }
+    views &= ~zvb->debug_views;
+    if (views == 0) {
+        return;
+    }
+    zvb->debug_views |= views;
+
     switch (zvb->mode) {
         case MODE_TEXT_640:
         case MODE_TEXT_320:
-            zvb_render_debug_text_mode(zvb);
+            zvb_render_debug_text_mode(zvb, views);
             break;
 
         case MODE_BITMAP_256:
@@ -720,7 +881,7 @@ void zvb_render_debug_textures(zvb_t* zvb)
             break;
 
         default:
-            zvb_render_debug_gfx_mode(zvb);
+            zvb_render_debug_gfx_mode(zvb, views);
             break;
     }
 }
@@ -728,15 +889,10 @@ void zvb_render_debug_textures(zvb_t* zvb)
 void zvb_render(zvb_t* zvb)
 {
     if (!zvb->rendering_enabled) {
-        zvb->need_render = false;
         return;
     }
 
-    if (zvb->need_render == false) {
-        return;
-    }
-
-    zvb->need_render = false;
+    zvb->rendered_generation = zvb->generation;
 
 #if BENCHMARK
     double startTime = GetTime();
@@ -788,18 +944,28 @@ void zvb_force_render(zvb_t* zvb)
 }
 
 
-void zvb_tick(zvb_t* zvb, const int tstates)
+void zvb_tick(zvb_t* zvb, int tstates)
 {
+    /* The DMA streaming in the background stalls the CPU between two instructions */
+    tstates += (int) zvb_dma_tick(&zvb->dma);
+
     zvb->tstates_counter -= tstates;
+    zvb_sound_tick(&zvb->sound, tstates);
+    zvb_spi_tick(&zvb->spi, tstates);
 
-    if (zvb->tstates_counter <= 0) {
+    /* A long CPU stall (DMA transfer) may cover more than a single state */
+    while (zvb->tstates_counter <= 0) {
         /* Go to the next state */
         zvb->state = (zvb->state + 1) % STATE_COUNT;
-        zvb->tstates_counter = s_tstates_remaining[zvb->state];
+        zvb->tstates_counter += s_tstates_remaining[zvb->state];
         /* If the new state is V-blank (i.e. we reached blank), render the screen */
         if (zvb->state == STATE_VBLANK) {
             zvb->status.v_blank = 1;
             zvb->need_render = true;
+            /* The cursor blinks according to the number of frames elapsed */
+            if (zvb_is_text_mode(zvb) && zvb_text_vblank(&zvb->text)) {
+                zvb->generation++;
+            }
         } else {
             zvb->status.v_blank = 0;
         }
@@ -809,6 +975,10 @@ void zvb_tick(zvb_t* zvb, const int tstates)
 
 void zvb_deinit(zvb_t* zvb)
 {
+    /* Make sure the offline audio rendering and the TF card image are complete before the emulator exits */
+    zvb_sound_deinit(&zvb->sound);
+    zvb_spi_deinit(&zvb->spi);
+
     if (!zvb->rendering_enabled) {
         return;
     }
@@ -10,19 +10,150 @@
 #include <stdlib.h>
 #include <string.h>
 #include "utils/log.h"
+#include "utils/helpers.h"
+#include "hw/mmu.h"
 #include "hw/zvb/zvb_dma.h"
 
 #define DEBUG_DMA   0
 
-static void dma_start_transfer(zvb_dma_t* dma)
+/**
+ * @brief Get the address increment for a read or write operation, any other operation keeps the address fixed
+ */
+static inline int dma_op_step(int op)
+{
+    if (op == DMA_OP_INC) return 1;
+    if (op == DMA_OP_DEC) return -1;
+    return 0;
+}
+
+
+/**
+ * @brief Resolve the host memory span that will be accessed from `addr` when moving by `step`.
+ *
+ * @param count Maximum number of bytes to access, updated with the number of bytes reachable from
+ *              the returned pointer. Left untouched for fixed addresses.
+ *
+ * @returns Pointer to the byte at `addr`, the following bytes are at `ptr[i * step]`. NULL if the
+ *          memory must be accessed byte per byte (side effects, unmapped).
+ */
+static uint8_t* dma_resolve(const zvb_dma_t* dma, uint32_t addr, int step, bool write, uint32_t* count)
+{
+    if (step > 0) {
+        return memory_phys_direct(dma->ops, addr, write, count);
+    }
+
+    if (step == 0) {
+        uint32_t size = 1;
+        return memory_phys_direct(dma->ops, addr, write, &size);
+    }
+
+    /* Decrementing address, the span ends at `addr`, don't go below the beginning of its page */
+    const uint32_t below = MIN(*count - 1, addr % MMU_PAGE_SIZE);
+    uint32_t size = below + 1;
+    uint8_t* ptr = memory_phys_direct(dma->ops, addr - below, write, &size);
+    if (ptr == NULL || size != below + 1) {
+        return NULL;
+    }
+    *count = size;
+    return ptr + below;
+}
+
+
+/**
+ * @brief Copy `count` bytes between two host spans, with the same result as a byte per byte transfer
+ */
+static void dma_copy(uint8_t* dst, int wr_step, const uint8_t* src, int rd_step, uint32_t count)
+{
+    const int last = (int) count - 1;
+    const uint8_t* src_lo = rd_step < 0 ? src - last : src;
+    const uint8_t* src_hi = rd_step > 0 ? src + last : src;
+    uint8_t* dst_lo = wr_step < 0 ? dst - last : dst;
+    uint8_t* dst_hi = wr_step > 0 ? dst + last : dst;
+    const bool overlap = dst_lo <= src_hi && src_lo <= dst_hi;
+
+    if (rd_step == 0 && wr_step == 0) {
+        /* Both addresses are fixed, the spans are a single byte, copying it once is enough */
+        *dst = *src;
+    } else if (rd_step == 0) {
+        /* Fixed source: even if it is part of the destination, the same value is written everywhere */
+        memset(dst_lo, *src, count);
+    } else if (!overlap && wr_step == 0) {
+        /* Fixed destination: only the last byte read remains */
+        *dst = src[rd_step * last];
+    } else if (rd_step == wr_step && (!overlap || (rd_step > 0 ? dst <= src : dst >= src))) {
+        /* Same direction, memmove behaves like the byte per byte copy as long as the copy
+         * doesn't read back bytes it has just written */
+        memmove(dst_lo, src_lo, count);
+    } else {
+        for (int i = 0; i <= last; i++) {
+            dst[wr_step * i] = src[rd_step * i];
+        }
+    }
+}
+
+
+static void dma_transfer(zvb_dma_t* dma, zvb_dma_descriptor_t* desc)
+{
+    const int rd_step = dma_op_step(desc->flags.rd_op);
+    const int wr_step = dma_op_step(desc->flags.wr_op);
+    uint32_t remaining = desc->length;
+
+    while (remaining > 0) {
+        uint32_t rd_count = remaining;
+        uint32_t wr_count = remaining;
+        const uint8_t* src = dma_resolve(dma, desc->rd_addr, rd_step, false, &rd_count);
+        uint8_t* dst = dma_resolve(dma, desc->wr_addr, wr_step, true, &wr_count);
+        uint32_t count = 1;
+
+        if (src != NULL && dst != NULL) {
+            count = MIN(rd_count, wr_count);
+            dma_copy(dst, wr_step, src, rd_step, count);
+#if DEBUG_DMA
+            log_printf("Transfer: src=0x%08X, dst=0x%08X, %u bytes\n", desc->rd_addr, desc->wr_addr, count);
+#endif
+        } else {
+            /* At least one side has side effects, go through the device callbacks */
+            const uint8_t data = memory_phys_read_byte(dma->ops, desc->rd_addr);
+            memory_phys_write_byte(dma->ops, desc->wr_addr, data);
+#if DEBUG_DMA
+            log_printf("Transfer: src=0x%08X, dst=0x%08X, byte=0x%02X\n", desc->rd_addr, desc->wr_addr, data);
+#endif
+        }
+
+        /* The addresses are 24-bit wide, the bitfields take care of the wrapping */
+        desc->rd_addr += (uint32_t) (rd_step * (int) count);
+        desc->wr_addr += (uint32_t) (wr_step * (int) count);
+        remaining -= count;
+    }
+}
+
+
+/**
+ * @brief Get the number of T-states the DMA needs to transfer `count` bytes.
+ * Each byte is read, then written, taking the number of cycles configured in the clock register.
+ */
+static unsigned long dma_transfer_tstates(const zvb_dma_t* dma, unsigned long count)
+{
+    /* A null divider still needs one cycle per access */
+    const unsigned long rd_cycle = MAX(dma->clk.rd_cycle, 1);
+    const unsigned long wr_cycle = MAX(dma->clk.wr_cycle, 1);
+    return count * (rd_cycle + wr_cycle);
+}
+
+
+/**
+ * @brief Process the descriptors from `desc_addr` until the last one, or until a descriptor targeting
+ * the sound FIFO is reached. That one is streamed in the background, see `zvb_dma_tick`.
+ *
+ * @returns Number of T-states during which the DMA held the bus, descriptors fetching included
+ */
+static unsigned long dma_run(zvb_dma_t* dma)
 {
-    /* Grab the first descriptor from memory */
     zvb_dma_descriptor_t desc = { 0 };
+    unsigned long tstates = 0;
 
     do {
         memory_phys_read_bytes(dma->ops, dma->desc_addr, (void*) &desc, sizeof(zvb_dma_descriptor_t));
-        const int rd_ops = desc.flags.rd_op;
-        const int wr_ops = desc.flags.wr_op;
 
 #if DEBUG_DMA
         log_printf("Descriptor @ %08x:\n", dma->desc_addr);
@@ -32,39 +163,102 @@ static void dma_start_transfer(zvb_dma_t* dma)
         log_printf("  Flags:\n");
         log_printf("    Read Operation: %d\n", desc.flags.rd_op);
         log_printf("    Write Operation: %d\n", desc.flags.wr_op);
+        log_printf("    Sound FIFO: %d\n", desc.flags.sound);
         log_printf("    Last: %d\n", desc.flags.last);
 #endif
 
+        /* Make the descriptor pointer go to the next descriptor */
+        dma->desc_addr += sizeof(zvb_dma_descriptor_t);
+        tstates += sizeof(zvb_dma_descriptor_t) * MAX(dma->clk.rd_cycle, 1);
+
+        if (desc.flags.sound) {
+            dma->stream = desc;
+            dma->streaming = true;
+            break;
+        }
+
         /* Descriptor is ready, perform the copy */
-        for (int i = 0; i < desc.length; i++) {
-            const uint8_t data = memory_phys_read_byte(dma->ops, desc.rd_addr);
-            memory_phys_write_byte(dma->ops, desc.wr_addr, data);
+        dma_transfer(dma, &desc);
+        tstates += dma_transfer_tstates(dma, desc.length);
+    } while (!desc.flags.last);
 
-#if DEBUG_DMA
-            log_printf("Transfer: src=0x%08X, dst=0x%08X, byte=0x%02X\n", desc.rd_addr, desc.wr_addr, data);
-#endif
+    return tstates;
+}
 
-            /* Check if we have to modify the addresses */
-            if (rd_ops == DMA_OP_INC)      desc.rd_addr++;
-            else if (rd_ops == DMA_OP_DEC) desc.rd_addr--;
 
-            if (wr_ops == DMA_OP_INC)      desc.wr_addr++;
-            else if (wr_ops == DMA_OP_DEC) desc.wr_addr--;
+/**
+ * @brief Move up to `room` bytes of the streamed descriptor to the sound FIFO, continue with the
+ * next descriptors once it is complete.
+ *
+ * @returns Number of T-states during which the DMA held the bus
+ */
+static unsigned long dma_stream(zvb_dma_t* dma, uint32_t room)
+{
+    zvb_dma_descriptor_t* desc = &dma->stream;
+    const int rd_step = dma_op_step(desc->flags.rd_op);
+    const uint32_t count = MIN(room, desc->length);
+    uint8_t buffer[SAMPLE_FIFO_SIZE];
+
+    if (rd_step > 0) {
+        memory_phys_read_bytes(dma->ops, desc->rd_addr, buffer, count);
+    } else {
+        for (uint32_t i = 0; i < count; i++) {
+            buffer[i] = memory_phys_read_byte(dma->ops, (desc->rd_addr + rd_step * (int) i) & 0xffffff);
         }
-        /* Make the descriptor pointer go to the next descriptor */
-        dma->desc_addr += sizeof(zvb_dma_descriptor_t);
-    } while (!desc.flags.last);
+    }
+    zvb_sound_fifo_push(dma->sound, buffer, count);
+
+    desc->rd_addr += (uint32_t) (rd_step * (int) count);
+    desc->length -= count;
+    unsigned long tstates = dma_transfer_tstates(dma, count);
+
+    if (desc->length == 0) {
+        dma->streaming = false;
+        if (!desc->flags.last) {
+            tstates += dma_run(dma);
+        }
+    }
+    return tstates;
+}
+
+
+static void dma_start_transfer(zvb_dma_t* dma)
+{
+    /* Starting a new transfer aborts the current streaming, if any */
+    dma->streaming = false;
+
+    /* The CPU cannot access the bus while the DMA is transferring, stall it for the whole transfer */
+    memory_bus_stall(dma->ops, dma_run(dma));
+}
+
+
+unsigned long zvb_dma_tick(zvb_dma_t* dma)
+{
+    if (!dma->streaming) {
+        return 0;
+    }
+
+    /* Refill the FIFO by chunks of half its size to limit the work done per instruction */
+    const uint32_t room = zvb_sound_fifo_room(dma->sound);
+    if (room < SAMPLE_FIFO_SIZE / 2 && room < dma->stream.length) {
+        return 0;
+    }
 
-    /* TODO: add number of elapsed T-states to the CPU? */
+    /* The CPU is stalled while the DMA holds the bus to fetch the samples */
+    const unsigned long tstates = dma_stream(dma, room);
+    memory_bus_stall(dma->ops, tstates);
+    return tstates;
 }
 
 
-void zvb_dma_init(zvb_dma_t* dma, const memory_op_t* ops)
+void zvb_dma_init(zvb_dma_t* dma, const memory_op_t* ops, zvb_sound_t* sound)
 {
     dma->clk.rd_cycle = 1;
     dma->clk.wr_cycle = 1;
     dma->desc_addr = 0;
     dma->ops = ops;
+    dma->streaming = false;
+    dma->sound = sound;
 }
 
 void zvb_dma_reset(zvb_dma_t* dma)
@@ -72,6 +266,7 @@ void zvb_dma_reset(zvb_dma_t* dma)
     /* Different than boot values */
     dma->clk.rd_cycle = 6;
     dma->clk.wr_cycle = 5;
+    dma->streaming = false;
     /* Descriptor address unchanged on reset */
 }
 
@@ -79,6 +274,7 @@ void zvb_dma_reset(zvb_dma_t* dma)
 uint8_t zvb_dma_read(zvb_dma_t* dma, uint32_t port)
 {
     switch (port) {
+        case DMA_REG_CTRL:       return dma->streaming ? DMA_CTRL_STREAM : 0;
         case DMA_REG_DESC_ADDR0: return dma->desc_addr0;
         case DMA_REG_DESC_ADDR1: return dma->desc_addr1;
         case DMA_REG_DESC_ADDR2: return dma->desc_addr2;
@@ -94,6 +290,8 @@ void zvb_dma_write(zvb_dma_t* dma, uint32_t port, uint8_t value)
         case DMA_REG_CTRL:
             if ((value & DMA_CTRL_START) != 0) {
                 dma_start_transfer(dma);
+            } else if ((value & DMA_CTRL_STREAM) != 0) {
+                dma->streaming = false;
             }
             break;
         case DMA_REG_DESC_ADDR0:
@@ -10,7 +10,15 @@
 #include <string.h>
 #include "hw/zvb/zvb_font.h"
 
-static void font_update_img(zvb_font_t* font, uint32_t addr, uint_fast8_t data);
+static void font_update_img(zvb_font_t* font, uint32_t addr);
+
+
+static void font_clear_dirty(zvb_font_t* font)
+{
+    font->dirty = 0;
+    font->dirty_min = ZVB_FONT_CHAR_COUNT;
+    font->dirty_max = -1;
+}
 
 /* Make sure the default font has the correct size */
 _Static_assert(sizeof(default_font) == DEFAULT_FONT_SIZE, "Default font has to have the same size as the font area in VRAM");
@@ -21,9 +29,9 @@ void zvb_font_init(zvb_font_t* font, bool rendering_enabled)
 
     /* Load the default font in memory */
     memcpy(font->raw_font, default_font, sizeof(font->raw_font));
+    font_clear_dirty(font);
 
     if (!rendering_enabled) {
-        font->dirty = 0;
         return;
     }
 
@@ -32,20 +40,17 @@ void zvb_font_init(zvb_font_t* font, bool rendering_enabled)
 
     /* Trigger an update to update the Image */
     for (size_t i = 0; i < sizeof(font->raw_font); i++) {
-        font_update_img(font, i, font->raw_font[i]);
+        font_update_img(font, i);
     }
 
     font->tex_font = LoadTextureFromImage(font->img_font);
-    font->dirty = 0;
 }
 
 
 void zvb_font_write(zvb_font_t* font, uint32_t addr, uint8_t data)
 {
     font->raw_font[addr] = data;
-    if (font->img_font.data != NULL) {
-        font_update_img(font, addr, data);
-    }
+    zvb_font_mark_dirty(font, addr, addr + 1);
 }
 
 
@@ -55,11 +60,33 @@ uint8_t zvb_font_read(zvb_font_t* font, uint32_t addr)
 }
 
 
+void zvb_font_mark_dirty(zvb_font_t* font, uint32_t from, uint32_t to)
+{
+    const int first = from / ZVB_FONT_CHAR_SIZE;
+    const int last = (to - 1) / ZVB_FONT_CHAR_SIZE;
+
+    font->dirty = 1;
+    if (first < font->dirty_min) {
+        font->dirty_min = first;
+    }
+    if (last > font->dirty_max) {
+        font->dirty_max = last;
+    }
+}
+
+
 void zvb_font_update(zvb_font_t* font)
 {
     if (font->dirty != 0 && font->tex_font.id != 0) {
+        /* Convert the modified characters only. Since they are organized from left to right in the image,
+         * a range of characters is not contiguous in memory, upload the whole texture. */
+        const uint32_t from = font->dirty_min * ZVB_FONT_CHAR_SIZE;
+        const uint32_t to = (font->dirty_max + 1) * ZVB_FONT_CHAR_SIZE;
+        for (uint32_t i = from; i < to; i++) {
+            font_update_img(font, i);
+        }
         UpdateTexture(font->tex_font, font->img_font.data);
-        font->dirty = 0;
+        font_clear_dirty(font);
     }
 }
 
@@ -67,8 +94,9 @@ void zvb_font_update(zvb_font_t* font)
 /**
  * @brief Update the image with an incoming byte that must be interpreted as a bitmap
  */
-static void font_update_img(zvb_font_t* font, uint32_t addr, uint_fast8_t data)
+static void font_update_img(zvb_font_t* font, uint32_t addr)
 {
+    const uint_fast8_t data = font->raw_font[addr];
     /* Pixels of the image can be access as an array directly */
     Color *pixels = (Color*) font->img_font.data;
 
@@ -87,6 +115,4 @@ static void font_update_img(zvb_font_t* font, uint32_t addr, uint_fast8_t data)
         int is_white = (data >> (7 - col)) & 1;
         pixels[pixels_idx + col] = is_white ? WHITE : BLACK;
     }
-
-    font->dirty = 1;
 }
@@ -10,60 +10,102 @@
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <math.h>
+#include "utils/log.h"
+#include "utils/pages.h"
 #include "hw/zvb/zvb_sound.h"
 
-#define BIT(i)  (1 << (i))
-#ifndef MAX
-#define MAX(a,b)    ((a) > (b) ? (a) : (b))
+#ifndef M_PI
+#define M_PI    3.14159265358979323846
 #endif
 
-static inline bool sample_table_enabled(zvb_sound_t* sound)
+/* 32-bit FNV-1a parameters, used for the offline rendering checksums */
+#define FNV_OFFSET_BASIS        0x811c9dc5u
+#define FNV_PRIME               0x01000193u
+
+static inline bool sample_table_enabled(const zvb_sound_regs_t* regs)
 {
-    return (sound->enabled_voices & 0x80) != 0;
+    return BIT(regs->enabled_voices, 7);
 }
 
-static inline bool voice_enabled(zvb_sound_t* sound, int i)
+static inline bool voice_enabled(const zvb_sound_regs_t* regs, int i)
 {
-    return (sound->enabled_voices & BIT(i)) != 0;
+    return BIT(regs->enabled_voices, i);
 }
 
-static inline bool voice_held(zvb_sound_t* sound, int i)
+static inline bool voice_held(const zvb_sound_regs_t* regs, int i)
 {
-    return (sound->hold_voices & BIT(i)) != 0;
+    return BIT(regs->hold_voices, i);
 }
 
-static inline bool voice_in_left(zvb_sound_t* sound, int i)
+static inline bool voice_in_left(const zvb_sound_regs_t* regs, int i)
 {
-    return (sound->left_voices & BIT(i)) != 0;
+    return BIT(regs->left_voices, i);
 }
 
-static inline bool voice_in_right(zvb_sound_t* sound, int i)
+static inline bool voice_in_right(const zvb_sound_regs_t* regs, int i)
 {
-    return (sound->right_voices & BIT(i)) != 0;
+    return BIT(regs->right_voices, i);
 }
 
 static void audio_callback(void *buffer, unsigned int frames);
+static void wavetables_init(void);
+static void sound_record(zvb_sound_t* sound, unsigned long until);
+static void sound_record_sum(zvb_sound_recorder_t* rec);
+
+/* RayLib's audio callback doesn't take a context/opaque parameter, this is the sound controller
+ * the audio thread renders. It is set once, before the stream starts, and never modified after. */
+static zvb_sound_t* s_audio_sound;
 
-static zvb_sound_t* g_sound;
 
-void zvb_sound_init(zvb_sound_t* sound, bool enabled)
+static void sound_regs_reset(zvb_sound_regs_t* regs)
+{
+    *regs = (zvb_sound_regs_t) {
+        /* Both channels disabled */
+        .master_volume = 0xc0,
+    };
+    /* The noise generators must never be seeded with 0 */
+    for (int i = 0; i < VOICE_COUNT; i++) {
+        regs->voices[i].lfsr = 0x2545F491u + i;
+    }
+}
+
+
+void zvb_sound_init(zvb_sound_t* sound, bool enabled, bool rate_control)
 {
     assert(sound);
     memset(sound, 0, sizeof(*sound));
     sound->enabled = enabled;
-    sound->left_volume = 0.f;
-    sound->right_volume = 0.f;
-    sound->sample_table.fifo_bytes = 0;
-    sound->sample_table.baud_count = 0;
+    sound_regs_reset(&sound->regs);
+    sound_regs_reset(&sound->synth);
+    atomic_init(&sound->sample_table.fifo_bytes, 0);
+    atomic_init(&sound->queue.head, 0);
+    atomic_init(&sound->queue.tail, 0);
+    atomic_init(&sound->emu_cycles, 0);
+    sound->audio_cycles = -SOUND_LATENCY_CYCLES;
+    sound->sync.rate_control = rate_control;
+    sound->sync.cycles_per_sample = SOUND_CYCLES_PER_SAMPLE;
+    sound->sync.fill = SOUND_LATENCY_CYCLES;
+    atomic_init(&sound->sync.fill_us, 0);
+    atomic_init(&sound->sync.rate_ppm, 0);
+    atomic_init(&sound->sync.underruns, 0);
+    atomic_init(&sound->sync.overruns, 0);
+
+    sound->queue.events = pages_alloc(SOUND_QUEUE_SIZE * sizeof(zvb_sound_event_t));
+    if (sound->queue.events == NULL) {
+        log_err_printf("[SOUND] Could not allocate the register writes queue, sound disabled\n");
+        sound->enabled = false;
+        return;
+    }
 
     if (!enabled) {
         return;
     }
 
+    wavetables_init();
     InitAudioDevice();
 
-    /* Dirty hack but the callback doesn't take a context/opaque parameter... */
-    g_sound = sound;
+    s_audio_sound = sound;
 
     SetMasterVolume(1.0f);
     sound->stream = LoadAudioStream(SAMPLE_RATE, 16, SOUND_CHANNELS);
@@ -71,100 +113,430 @@ void zvb_sound_init(zvb_sound_t* sound, bool enabled)
     PlayAudioStream(sound->stream);
 }
 
-void zvb_sound_reset(zvb_sound_t* sound)
+
+int zvb_sound_init_offline(zvb_sound_t* sound, const char* wav_path, const char* sums_path)
 {
-    /* Master registers */
-    sound->hold_voices    = 0;
-    sound->enabled_voices = 0;
-    sound->left_voices    = 0;
-    sound->right_voices   = 0;
-    /* Both channels disabled */
-    sound->master_volume  = 0xc0;
+    zvb_sound_recorder_t* rec = &sound->recorder;
 
-    /* Voices registers */
-    for (int i = 0; i < VOICE_COUNT; i++) {
-        sound->voices[i] = (zvb_voice_t) { 0 };
+    zvb_sound_init(sound, false, false);
+    if (sound->queue.events == NULL) {
+        return -1;
+    }
+    if (wav_open(&rec->wav, wav_path, SAMPLE_RATE, SOUND_CHANNELS) != 0) {
+        return -1;
+    }
+    if (sums_path != NULL) {
+        rec->sums = fopen(sums_path, "w");
+        if (rec->sums == NULL) {
+            log_perror("[SOUND] Could not create checksums file");
+            wav_close(&rec->wav);
+            return -1;
+        }
     }
-    sound->sample_table.fifo_bytes = 0;
-    sound->sample_table.baud_count = 0;
-    sound->sample_table.is_signed  = false;
-    sound->sample_table.fifo_head  = 0;
-    sound->sample_table.fifo_tail  = 0;
-    sound->sample_table.divider = 0;
-    sound->sample_table.config  = 0;
-    sound->sample_table.is_u8   = false;
-    atomic_store(&sound->sample_table.fifo_bytes, 0);
 
-    /* Internal registers */
-    sound->left_volume = 0.f;
-    sound->right_volume = 0.f;
+    wavetables_init();
+    rec->sum = FNV_OFFSET_BASIS;
+    /* The samples are rendered behind the emulation, no latency is needed */
+    sound->audio_cycles = 0;
+    sound->enabled = true;
+    sound->offline = true;
+    return 0;
 }
 
+
 void zvb_sound_deinit(zvb_sound_t* sound)
 {
     if (sound == NULL || !sound->enabled) {
         return;
     }
+    sound->enabled = false;
+
+    if (sound->offline) {
+        zvb_sound_recorder_t* rec = &sound->recorder;
+        /* Render the samples up to the last emulated cycle */
+        sound_record(sound, sound->cycles);
+        if (rec->sums != NULL) {
+            if (rec->sum_frames != 0) {
+                sound_record_sum(rec);
+            }
+            if (rec->sums != NULL && fclose(rec->sums) != 0) {
+                log_perror("[SOUND] Could not write the checksums file");
+            }
+            rec->sums = NULL;
+        }
+        log_printf("[SOUND] %u frames written to the WAV file\n", rec->wav.frames);
+        wav_close(&rec->wav);
+        sound->offline = false;
+    } else {
+        StopAudioStream(sound->stream);
+        UnloadAudioStream(sound->stream);
+        CloseAudioDevice();
+
+        const unsigned int underruns = atomic_load(&sound->sync.underruns);
+        const unsigned int overruns = atomic_load(&sound->sync.overruns);
+        if (underruns != 0 || overruns != 0) {
+            log_printf("[SOUND] Audio resynchronized %u times (%u underruns, %u overruns)\n",
+                       underruns + overruns, underruns, overruns);
+        }
+    }
 
-    StopAudioStream(sound->stream);
-    UnloadAudioStream(sound->stream);
-    CloseAudioDevice();
+    if (sound->queue.dropped != 0) {
+        log_printf("[SOUND] %u register writes were dropped, the audio thread was too slow\n", sound->queue.dropped);
+    }
 }
 
+
 /**
- * @brief Generate a 16-bit unsigned sample for the current voice
+ * ===========================================================
+ *              REGISTER WRITES QUEUE
+ * ===========================================================
  */
-static int16_t generate_wave(zvb_voice_t* voice) {
-    const int steps = (voice->freq_high << 8) | voice->freq_low;
-    if (steps == 0) {
-        return 0;
+
+/**
+ * @brief Push a register write to the queue, must only be called from the emulation thread
+ */
+static void sound_queue_push(zvb_sound_t* sound, uint16_t port, uint16_t value)
+{
+    zvb_sound_queue_t* queue = &sound->queue;
+    const unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    const unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    if (head - tail >= SOUND_QUEUE_SIZE) {
+        queue->dropped++;
+        return;
     }
 
-    uint_fast16_t sample = 0;
-    /* The duty value represents the upper 3 bits of the 16-bit value */
-    const uint_fast16_t threshold = voice->duty << 13;
+    queue->events[head % SOUND_QUEUE_SIZE] = (zvb_sound_event_t) {
+        .cycle = sound->cycles,
+        .port  = port,
+        .value = value,
+    };
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+}
+
+
+/**
+ * @brief Apply a register write to a registers state, the sample table FIFO is not affected
+ */
+static void sound_regs_write(zvb_sound_regs_t* regs, uint32_t port, uint8_t value)
+{
+    switch (port) {
+        case REG_FREQ_LOW:
+            for (int i = 0; i < VOICE_COUNT; i++) {
+                if (voice_enabled(regs, i)) {
+                    regs->voices[i].freq_low = value;
+                }
+            }
+            break;
+
+        case REG_FREQ_HIGH:
+            for (int i = 0; i < VOICE_COUNT; i++) {
+                if (voice_enabled(regs, i)) {
+                    regs->voices[i].freq_high = value;
+                }
+            }
+
+            if (sample_table_enabled(regs)) {
+                regs->table_divider = value;
+            }
+            break;
+
+        case REG_WAVEFORM:
+            for (int i = 0; i < VOICE_COUNT; i++) {
+                if (voice_enabled(regs, i)) {
+                    regs->voices[i].wave = value & 0x3;
+                    regs->voices[i].duty = value >> REG_WAVEFORM_DUTY_SH;
+                    regs->voices[i].noise = (regs->voices[i].wave == WAVE_NOISE);
+                }
+            }
+            /* Special case for the sample table voice,
+             * Register 2 corresponds to the configuration */
+            if (sample_table_enabled(regs)) {
+                regs->table_config = value & 0x7;
+                regs->table_u8     = (value & 1) != 0;
+                regs->table_signed = (value & 4) != 0;
+            }
+            break;
 
-    switch (voice->wave) {
-        case WAVE_SQUARE:
-            sample = (voice->phase < threshold) ? SAMPLE_MAX : 0;
+        case REG_VOICE_VOL:
+            for (int i = 0; i < VOICE_COUNT; i++) {
+                if (voice_enabled(regs, i)) {
+                    regs->voices[i].voice_volume = value;
+                    regs->voices[i].volume = volume_steps_to_float(value, 2);
+                }
+            }
             break;
-        case WAVE_TRIANGLE:
-            sample = (voice->phase > SAMPLE_MAX / 2) ?
-                        SAMPLE_MAX - voice->phase : voice->phase;
-            sample *= 2;
+
+        case REG_MST_LEFT:
+            regs->left_voices = value;
             break;
-        case WAVE_SAWTOOTH:
-            sample = voice->phase;
+
+        case REG_MST_RIGHT:
+            regs->right_voices = value;
             break;
-        case WAVE_NOISE:
-            sample = rand() % SAMPLE_MAX;
+
+        case REG_MST_HOLD:
+            regs->hold_voices = value;
+            for (int i = 0; i < VOICE_COUNT; i++) {
+                regs->voices[i].hold = voice_held(regs, i);
+            }
+            /* If the wavetable is on hold, it should stop outputting sound */
+            regs->table_hold = voice_held(regs, 7);
             break;
+
+        case REG_MST_VOL:
+            regs->master_volume = value;
+            if (value & 0x80) {
+                regs->right_volume = 0.f;
+            } else {
+                /* We have two bits for volume */
+                regs->right_volume = volume_steps_to_float(value >> 2, 2);
+            }
+            if (value & 0x40) {
+                regs->left_volume = 0.f;
+            } else {
+                regs->left_volume = volume_steps_to_float(value, 2);
+            }
+            break;
+
+        case REG_MST_ENA:
+            regs->enabled_voices = value;
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**
+ * @brief Drop the FIFO bytes written before a reset, must only be called from the audio thread.
+ *
+ * @param head FIFO head at the time of the reset
+ */
+static void sample_table_discard(zvb_sample_table_t* tbl, int head)
+{
+    while (tbl->fifo_tail != head && atomic_load(&tbl->fifo_bytes) > 0) {
+        tbl->fifo_tail = (tbl->fifo_tail + 1) % SAMPLE_FIFO_SIZE;
+        atomic_fetch_sub(&tbl->fifo_bytes, 1);
+    }
+    tbl->baud_count = 0;
+}
+
+
+/**
+ * @brief Replay all the register writes that occurred before the current audio position.
+ *
+ * @param head Snapshot of the queue head, taken at the beginning of the audio buffer
+ */
+static void sound_replay_events(zvb_sound_t* sound, unsigned int head)
+{
+    zvb_sound_queue_t* queue = &sound->queue;
+    const unsigned int first = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    unsigned int tail = first;
+
+    while (tail != head) {
+        const zvb_sound_event_t* event = &queue->events[tail % SOUND_QUEUE_SIZE];
+        if ((double) event->cycle > sound->audio_cycles) {
+            break;
+        }
+
+        if (event->port == SOUND_EVENT_RESET) {
+            sound_regs_reset(&sound->synth);
+            sample_table_discard(&sound->sample_table, event->value);
+        } else {
+            sound_regs_write(&sound->synth, event->port, event->value);
+        }
+        tail++;
     }
 
-    if (!voice->hold) {
-        voice->phase += steps;
+    if (tail != first) {
+        atomic_store_explicit(&queue->tail, tail, memory_order_release);
+    }
+}
+
+
+/**
+ * ===========================================================
+ *                  AUDIO SYNTHESIS
+ * ===========================================================
+ */
+
+/**
+ * @brief Band-limited wavetables, one per waveform and per octave range. Each level only contains the
+ * harmonics below the Nyquist frequency for the highest voice frequency it is used for.
+ */
+#define WAVETABLE_SIZE          1024
+#define WAVETABLE_PHASE_SHIFT   6   // 16-bit phase to table index
+#define WAVETABLE_PHASE_FRAC    ((1 << WAVETABLE_PHASE_SHIFT) - 1)
+#define WAVETABLE_LEVELS        11
+/* Square waves with the 8 duty cycles, then the triangle and sawtooth */
+#define WAVETABLE_TRIANGLE      8
+#define WAVETABLE_SAWTOOTH      9
+#define WAVETABLE_COUNT         10
+
+/* One extra entry at the end of each table to interpolate without wrapping the index */
+static float s_wavetables[WAVETABLE_COUNT][WAVETABLE_LEVELS][WAVETABLE_SIZE + 1];
+static bool s_wavetables_ready;
+
+/* Number of samples generated at once between two register writes */
+#define SOUND_BLOCK_SIZE        256
+
+/* When rendering offline, the samples are generated at least once per block, or earlier when
+ * the register writes queue gets half full */
+#define SOUND_RECORD_CYCLES     ((unsigned long) (SOUND_BLOCK_SIZE * SOUND_CYCLES_PER_SAMPLE))
+
+
+/**
+ * @brief Value of the non-band-limited waveform for the given 16-bit phase, between 0 and SAMPLE_MAX
+ */
+static double wavetable_naive(int table, unsigned int phase)
+{
+    if (table == WAVETABLE_TRIANGLE) {
+        return 2 * ((phase > SAMPLE_MAX / 2) ? SAMPLE_MAX - phase : phase);
+    } else if (table == WAVETABLE_SAWTOOTH) {
+        return phase;
+    }
+    /* The duty value represents the upper 3 bits of the 16-bit value */
+    return (phase < (unsigned int) (table << 13)) ? SAMPLE_MAX : 0;
+}
+
+
+static void wavetables_init(void)
+{
+    static double s_cos[WAVETABLE_SIZE];
+    static double s_sin[WAVETABLE_SIZE];
+    const int max_harmonic = WAVETABLE_SIZE / 2 - 1;
+
+    if (s_wavetables_ready) {
+        return;
+    }
+
+    for (int n = 0; n < WAVETABLE_SIZE; n++) {
+        s_cos[n] = cos(2 * M_PI * n / WAVETABLE_SIZE);
+        s_sin[n] = sin(2 * M_PI * n / WAVETABLE_SIZE);
+    }
+
+    for (int t = 0; t < WAVETABLE_COUNT; t++) {
+        double wave[WAVETABLE_SIZE];
+        double cos_coeff[WAVETABLE_SIZE / 2] = { 0 };
+        double sin_coeff[WAVETABLE_SIZE / 2] = { 0 };
+        double dc = 0;
+
+        /* Get the harmonics of the naive waveform */
+        for (int n = 0; n < WAVETABLE_SIZE; n++) {
+            wave[n] = wavetable_naive(t, n << WAVETABLE_PHASE_SHIFT);
+            dc += wave[n];
+        }
+        dc /= WAVETABLE_SIZE;
+        for (int h = 1; h <= max_harmonic; h++) {
+            for (int n = 0; n < WAVETABLE_SIZE; n++) {
+                cos_coeff[h] += wave[n] * s_cos[(h * n) % WAVETABLE_SIZE];
+                sin_coeff[h] += wave[n] * s_sin[(h * n) % WAVETABLE_SIZE];
+            }
+            cos_coeff[h] *= 2.0 / WAVETABLE_SIZE;
+            sin_coeff[h] *= 2.0 / WAVETABLE_SIZE;
+        }
+
+        /* Each level keeps half the harmonics of the previous one, the last one is silent */
+        for (int level = 0; level < WAVETABLE_LEVELS; level++) {
+            const int harmonics = MIN((WAVETABLE_SIZE / 2) >> level, max_harmonic);
+            float* table = s_wavetables[t][level];
+            double sigma[WAVETABLE_SIZE / 2];
+
+            /* Lanczos sigma factor to attenuate the ringing around the edges */
+            for (int h = 1; h <= harmonics; h++) {
+                const double x = M_PI * h / (harmonics + 1);
+                sigma[h] = sin(x) / x;
+            }
+
+            for (int n = 0; n < WAVETABLE_SIZE; n++) {
+                double value = dc;
+                for (int h = 1; h <= harmonics; h++) {
+                    const int idx = (h * n) % WAVETABLE_SIZE;
+                    value += sigma[h] * (cos_coeff[h] * s_cos[idx] + sin_coeff[h] * s_sin[idx]);
+                }
+                table[n] = (float) value;
+            }
+            table[WAVETABLE_SIZE] = table[0];
+        }
+    }
+
+    s_wavetables_ready = true;
+}
+
+
+/**
+ * @brief Get the wavetable level to use for the given phase step
+ */
+static inline int wavetable_level(int steps)
+{
+    int level = 0;
+    /* The first level is used as long as its harmonics are all below Nyquist frequency */
+    for (int s = steps >> WAVETABLE_PHASE_SHIFT; s != 0; s >>= 1) {
+        level++;
+    }
+    return level;
+}
+
+
+/**
+ * @brief Generate `count` samples for the given voice, in the 16-bit signed range
+ */
+static void voice_render(zvb_voice_t* voice, float* out, int count)
+{
+    const int steps = (voice->freq_high << 8) | voice->freq_low;
+    const float volume = voice->volume;
+
+    if (steps == 0) {
+        memset(out, 0, count * sizeof(*out));
+        return;
     }
-    if (voice->phase > SAMPLE_MAX) {
-        voice->phase = steps;
+
+    if (voice->wave == WAVE_NOISE) {
+        /* xorshift is a linear-feedback shift register, cheap and deterministic */
+        uint32_t lfsr = voice->lfsr;
+        for (int n = 0; n < count; n++) {
+            lfsr ^= lfsr << 13;
+            lfsr ^= lfsr >> 17;
+            lfsr ^= lfsr << 5;
+            out[n] = (lfsr & SAMPLE_MAX) * volume - 0x8000;
+        }
+        voice->lfsr = lfsr;
+        return;
     }
 
-    return (sample * voice->volume) - 0x8000;
+    const int index = (voice->wave == WAVE_TRIANGLE) ? WAVETABLE_TRIANGLE :
+                      (voice->wave == WAVE_SAWTOOTH) ? WAVETABLE_SAWTOOTH :
+                      voice->duty;
+    const float* table = s_wavetables[index][wavetable_level(steps)];
+    const unsigned int increment = voice->hold ? 0 : steps;
+    unsigned int phase = voice->phase;
+
+    for (int n = 0; n < count; n++) {
+        const unsigned int idx = phase >> WAVETABLE_PHASE_SHIFT;
+        const float frac = (phase & WAVETABLE_PHASE_FRAC) * (1.0f / (WAVETABLE_PHASE_FRAC + 1));
+        const float sample = table[idx] + (table[idx + 1] - table[idx]) * frac;
+        out[n] = sample * volume - 0x8000;
+        phase = (phase + increment) & SAMPLE_MAX;
+    }
+    voice->phase = phase;
 }
 
 /**
  * @brief Generate the next sample for the sample-table voice
  */
-static int16_t generate_sample(zvb_sample_table_t* tbl)
+static int16_t generate_sample(zvb_sample_table_t* tbl, const zvb_sound_regs_t* regs)
 {
     int16_t sample = 0;
     int tail = tbl->fifo_tail;
 
-    if (!tbl->is_u8) {
+    if (!regs->table_u8) {
         /* 16-bit samples */
         sample = tbl->fifo[tail];
         tail = (tail + 1) % SAMPLE_FIFO_SIZE;
         sample |= (tbl->fifo[tail] << 8);
-        if (!tbl->is_signed) {
+        if (!regs->table_signed) {
             sample -= 0x8000;
         }
     } else {
@@ -173,9 +545,9 @@ static int16_t generate_sample(zvb_sample_table_t* tbl)
     }
 
     /* Check if we have to go to the next sample in the FIFO/table */
-    if (tbl->baud_count >= tbl->divider) {
+    if (tbl->baud_count >= regs->table_divider) {
         /* Make the tail point to the next sample */
-        const int sample_bytes = tbl->is_u8 ? 1 : 2;
+        const int sample_bytes = regs->table_u8 ? 1 : 2;
         tbl->fifo_tail = (tbl->fifo_tail + sample_bytes) % SAMPLE_FIFO_SIZE;
         tbl->baud_count = 0;
         atomic_fetch_sub(&tbl->fifo_bytes, sample_bytes);
@@ -187,9 +559,9 @@ static int16_t generate_sample(zvb_sample_table_t* tbl)
 }
 
 
-static unsigned int table_samples_count(zvb_sample_table_t* tbl)
+static unsigned int table_samples_count(zvb_sample_table_t* tbl, const zvb_sound_regs_t* regs)
 {
-    if (tbl->is_u8) {
+    if (regs->table_u8) {
         return tbl->fifo_bytes;
     } else {
         return tbl->fifo_bytes / 2;
@@ -197,62 +569,286 @@ static unsigned int table_samples_count(zvb_sample_table_t* tbl)
 }
 
 
+static inline int16_t sample_clamp(float sample)
+{
+    return (int16_t) MAX(-32768.0f, MIN(32767.0f, sample));
+}
+
+
+/**
+ * @brief Generate `count` stereo frames with the current registers, all the voices are generated
+ * for the whole block before being mixed.
+ */
+static void sound_render_block(zvb_sound_t* sound, int16_t* buffer, int count)
+{
+    zvb_sound_regs_t* synth = &sound->synth;
+    float voices[VOICE_COUNT + 1][SOUND_BLOCK_SIZE];
+    float left_gain[VOICE_COUNT + 1];
+    float right_gain[VOICE_COUNT + 1];
+    float left[SOUND_BLOCK_SIZE] = { 0 };
+    float right[SOUND_BLOCK_SIZE] = { 0 };
+
+    for (int ch = 0; ch < VOICE_COUNT; ch++) {
+        voice_render(&synth->voices[ch], voices[ch], count);
+    }
+
+    /* The sample table is the last voice, its bit is 7 in the master registers */
+    float* table = voices[VOICE_COUNT];
+    for (int n = 0; n < count; n++) {
+        table[n] = 0;
+        if (!synth->table_hold && table_samples_count(&sound->sample_table, synth) >= 1) {
+            table[n] = generate_sample(&sound->sample_table, synth);
+        }
+    }
+
+    /* No matter how many samples are enabled, divide by VOICE_COUNT, then apply the master volume */
+    for (int ch = 0; ch <= VOICE_COUNT; ch++) {
+        const int bit = (ch == VOICE_COUNT) ? 7 : ch;
+        left_gain[ch]  = voice_in_left(synth, bit)  ? synth->left_volume / VOICE_COUNT : 0.f;
+        right_gain[ch] = voice_in_right(synth, bit) ? synth->right_volume / VOICE_COUNT : 0.f;
+    }
+
+    /* Mix all the voices at once, these loops are vectorized by the compiler */
+    for (int ch = 0; ch <= VOICE_COUNT; ch++) {
+        const float* voice = voices[ch];
+        const float lgain = left_gain[ch];
+        const float rgain = right_gain[ch];
+        for (int n = 0; n < count; n++) {
+            left[n]  += voice[n] * lgain;
+            right[n] += voice[n] * rgain;
+        }
+    }
+
+    for (int n = 0; n < count; n++) {
+        buffer[n * SOUND_CHANNELS]     = sample_clamp(left[n]);
+        buffer[n * SOUND_CHANNELS + 1] = sample_clamp(right[n]);
+    }
+}
+
+
+/**
+ * @brief Make sure the audio position stays at the expected distance from the emulation.
+ * Small deviations are absorbed by adjusting the playback rate, large ones make the audio jump.
+ *
+ * @param frames Number of frames about to be rendered, used to smooth the measured latency
+ */
+static void sound_sync_timeline(zvb_sound_t* sound, unsigned int frames)
+{
+    zvb_sound_sync_t* sync = &sound->sync;
+    const double emu_cycles = (double) atomic_load_explicit(&sound->emu_cycles, memory_order_relaxed);
+    const double target = emu_cycles - SOUND_LATENCY_CYCLES;
+    const double drift = sound->audio_cycles - target;
+
+    if (drift > SOUND_RESYNC_CYCLES || drift < -SOUND_RESYNC_CYCLES) {
+        atomic_fetch_add_explicit(drift > 0 ? &sync->underruns : &sync->overruns, 1, memory_order_relaxed);
+        sound->audio_cycles = target;
+        sync->fill = SOUND_LATENCY_CYCLES;
+    }
+
+    /* The emulation advances one video frame at a time, filter the measurement over half a second */
+    const double fill = emu_cycles - sound->audio_cycles;
+    const double alpha = MIN(1.0, frames / (SAMPLE_RATE * 0.5));
+    sync->fill += (fill - sync->fill) * alpha;
+
+    if (sync->rate_control) {
+        double error = (sync->fill - SOUND_LATENCY_CYCLES) / SOUND_LATENCY_CYCLES;
+        error = MAX(-1.0, MIN(1.0, error));
+        sync->cycles_per_sample = SOUND_CYCLES_PER_SAMPLE * (1.0 + error * SOUND_RATE_ADJUST);
+    }
+
+    atomic_store_explicit(&sync->fill_us, (unsigned int) (MAX(fill, 0.0) * 1000000 / CPUFREQ), memory_order_relaxed);
+    atomic_store_explicit(&sync->rate_ppm,
+                          (int) lround((sync->cycles_per_sample / SOUND_CYCLES_PER_SAMPLE - 1.0) * 1000000),
+                          memory_order_relaxed);
+}
+
+
+/**
+ * @brief Render `frames` stereo frames, replaying the register writes at the right sample
+ */
+static void sound_render(zvb_sound_t* sound, int16_t* buffer, unsigned int frames)
+{
+    zvb_sound_queue_t* queue = &sound->queue;
+    const unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    while (frames > 0) {
+        sound_replay_events(sound, head);
+
+        /* Generate as many samples as possible until the next register write */
+        unsigned int count = MIN(frames, SOUND_BLOCK_SIZE);
+        const unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        if (tail != head) {
+            const double next = queue->events[tail % SOUND_QUEUE_SIZE].cycle;
+            const double until = ceil((next - sound->audio_cycles) / sound->sync.cycles_per_sample);
+            count = MIN(count, (unsigned int) MAX(until, 1.0));
+        }
+
+        sound_render_block(sound, buffer, count);
+        sound->audio_cycles += count * sound->sync.cycles_per_sample;
+        buffer += count * SOUND_CHANNELS;
+        frames -= count;
+    }
+}
+
+
 static void audio_callback(void* rbuf, unsigned int frames)
 {
-    int16_t *buffer = (int16_t*) rbuf;
+    sound_sync_timeline(s_audio_sound, frames);
+    sound_render(s_audio_sound, (int16_t*) rbuf, frames);
+}
+
+
+/**
+ * ===========================================================
+ *                  OFFLINE RENDERING
+ * ===========================================================
+ */
+
+/**
+ * @brief Write the checksum of the current second to the sums file and start a new one
+ */
+static void sound_record_sum(zvb_sound_recorder_t* rec)
+{
+    if (fprintf(rec->sums, "%lu %08x %u\n", rec->second, rec->sum, rec->sum_frames) < 0) {
+        log_perror("[SOUND] Could not write the checksums file");
+        fclose(rec->sums);
+        rec->sums = NULL;
+    }
+    rec->sum = FNV_OFFSET_BASIS;
+    rec->sum_frames = 0;
+    rec->second++;
+}
 
-    for (unsigned int i = 0; i < frames * 2; i += SOUND_CHANNELS) {
-        int sample_left = 0;
-        int sample_right = 0;
 
-        for (int ch = 0; ch < VOICE_COUNT; ch++) {
-            int16_t sample = generate_wave(&g_sound->voices[ch]);
-            if (voice_in_left(g_sound, ch)) sample_left += sample;
-            if (voice_in_right(g_sound, ch)) sample_right += sample;
+/**
+ * @brief Hash the little-endian bytes of the rendered frames, one line is written per emulated second
+ */
+static void sound_record_update_sum(zvb_sound_recorder_t* rec, const int16_t* buffer, unsigned int frames)
+{
+    for (unsigned int i = 0; i < frames; i++) {
+        for (int ch = 0; ch < SOUND_CHANNELS; ch++) {
+            const uint16_t sample = (uint16_t) buffer[i * SOUND_CHANNELS + ch];
+            rec->sum = (rec->sum ^ (sample & 0xff)) * FNV_PRIME;
+            rec->sum = (rec->sum ^ (sample >> 8)) * FNV_PRIME;
+        }
+        if (++rec->sum_frames == SAMPLE_RATE) {
+            sound_record_sum(rec);
         }
+    }
+}
+
 
-        if (!g_sound->sample_table.hold && table_samples_count(&g_sound->sample_table) >= 1) {
-            int16_t sample = generate_sample(&g_sound->sample_table);
-            if (voice_in_left(g_sound, 7)) sample_left += sample;
-            if (voice_in_right(g_sound, 7)) sample_right += sample;
+/**
+ * @brief Render all the samples located before the given emulated cycle and write them to the file.
+ * Called from the emulation thread, all the register writes stamped before `until` are already queued.
+ */
+static void sound_record(zvb_sound_t* sound, unsigned long until)
+{
+    zvb_sound_recorder_t* rec = &sound->recorder;
+    int16_t buffer[SOUND_BLOCK_SIZE * SOUND_CHANNELS];
+
+    const double remaining = ((double) until - sound->audio_cycles) / sound->sync.cycles_per_sample;
+    unsigned long frames = remaining > 0 ? (unsigned long) remaining : 0;
+
+    while (frames > 0) {
+        const unsigned int count = MIN(frames, SOUND_BLOCK_SIZE);
+        sound_render(sound, buffer, count);
+        wav_write(&rec->wav, buffer, count);
+        if (rec->sums != NULL) {
+            sound_record_update_sum(rec, buffer, count);
         }
+        frames -= count;
+    }
+
+    rec->next_render = until + SOUND_RECORD_CYCLES;
+}
+
+
+/**
+ * ===========================================================
+ *                  EMULATION SIDE
+ * ===========================================================
+ */
 
-        /* Apply master volume */
-        /* No matter how many samples are enabled, divide by VOICE_COUNT and make it signed */
-        sample_left = (sample_left / VOICE_COUNT) * g_sound->left_volume;
-        sample_right = (sample_right / VOICE_COUNT) * g_sound->right_volume;
+void zvb_sound_reset(zvb_sound_t* sound)
+{
+    zvb_sample_table_t* tbl = &sound->sample_table;
 
-        buffer[i]   = (int16_t) sample_left;
-        buffer[i+1] = (int16_t) sample_right;
+    sound_regs_reset(&sound->regs);
+
+    if (sound->enabled) {
+        /* The audio thread owns its registers and the FIFO tail, let it reset them */
+        sound_queue_push(sound, SOUND_EVENT_RESET, tbl->fifo_head);
+    } else {
+        sound_regs_reset(&sound->synth);
+        tbl->fifo_head  = 0;
+        tbl->fifo_tail  = 0;
+        tbl->baud_count = 0;
+        atomic_store(&tbl->fifo_bytes, 0);
     }
 }
 
+
+void zvb_sound_tick(zvb_sound_t* sound, int tstates)
+{
+    sound->cycles += tstates;
+    if (sound->offline) {
+        const zvb_sound_queue_t* queue = &sound->queue;
+        const unsigned int pending = atomic_load_explicit(&queue->head, memory_order_relaxed) -
+                                     atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        if (sound->cycles >= sound->recorder.next_render || pending >= SOUND_QUEUE_SIZE / 2) {
+            sound_record(sound, sound->cycles);
+        }
+    } else if (sound->enabled) {
+        atomic_store_explicit(&sound->emu_cycles, sound->cycles, memory_order_relaxed);
+    }
+}
+
+
+void zvb_sound_get_stats(zvb_sound_t* sound, zvb_sound_stats_t* stats)
+{
+    zvb_sound_sync_t* sync = &sound->sync;
+
+    memset(stats, 0, sizeof(*stats));
+    if (!sound->enabled || sound->offline) {
+        return;
+    }
+    stats->fill_us   = atomic_load_explicit(&sync->fill_us, memory_order_relaxed);
+    stats->target_us = (unsigned int) ((unsigned long long) SOUND_LATENCY_CYCLES * 1000000 / CPUFREQ);
+    stats->rate_ppm  = atomic_load_explicit(&sync->rate_ppm, memory_order_relaxed);
+    stats->underruns = atomic_load_explicit(&sync->underruns, memory_order_relaxed);
+    stats->overruns  = atomic_load_explicit(&sync->overruns, memory_order_relaxed);
+}
+
+
 uint8_t zvb_sound_read(zvb_sound_t* sound, uint32_t port) {
     if (!sound) {
         return 0;
     }
+    const zvb_sound_regs_t* regs = &sound->regs;
     zvb_sample_table_t* tbl = &sound->sample_table;
 
     switch (port) {
         case 1:
-            if (sample_table_enabled(sound)) {
-                return tbl->divider;
+            if (sample_table_enabled(regs)) {
+                return regs->table_divider;
             }
             break;
         case 2:
-            if (sample_table_enabled(sound)) {
+            if (sample_table_enabled(regs)) {
+                const int fifo_bytes = atomic_load(&tbl->fifo_bytes);
                 const uint8_t status =
-                    ((tbl->fifo_bytes == 0) << 7)                |
-                    ((tbl->fifo_bytes == SAMPLE_FIFO_SIZE) << 6) |
-                    (tbl->config & 0x7);
+                    ((fifo_bytes == 0) << 7)                |
+                    ((fifo_bytes == SAMPLE_FIFO_SIZE) << 6) |
+                    (regs->table_config & 0x7);
                 return status;
             }
             break;
-        case REG_MST_LEFT:  return sound->left_voices;
-        case REG_MST_RIGHT: return sound->right_voices;
-        case REG_MST_HOLD:  return sound->hold_voices;
-        case REG_MST_VOL:   return sound->master_volume;
-        case REG_MST_ENA:   return sound->enabled_voices;
+        case REG_MST_LEFT:  return regs->left_voices;
+        case REG_MST_RIGHT: return regs->right_voices;
+        case REG_MST_HOLD:  return regs->hold_voices;
+        case REG_MST_VOL:   return regs->master_volume;
+        case REG_MST_ENA:   return regs->enabled_voices;
         default:            return 0;
     }
 
@@ -260,102 +856,44 @@ uint8_t zvb_sound_read(zvb_sound_t* sound, uint32_t port) {
 }
 
 
-void zvb_sound_write(zvb_sound_t* sound, uint32_t port, uint8_t value) {
-    if (!sound) {
-        return;
+uint32_t zvb_sound_fifo_room(const zvb_sound_t* sound)
+{
+    if (!sample_table_enabled(&sound->regs)) {
+        return 0;
     }
-    zvb_sample_table_t* tbl = &sound->sample_table;
-
-    switch (port) {
-        case REG_FREQ_LOW:
-            for (int i = 0; i < VOICE_COUNT; i++) {
-                if (voice_enabled(sound, i)) {
-                    sound->voices[i].freq_low = value;
-                }
-            }
-            if (sample_table_enabled(sound)) {
-                /* Register 0 corresponds to the FIFO */
-                tbl->fifo[tbl->fifo_head] = value;
-                tbl->fifo_head = (tbl->fifo_head + 1) % SAMPLE_FIFO_SIZE;
-                atomic_fetch_add_explicit(&tbl->fifo_bytes, 1, memory_order_relaxed);
-            }
-            break;
-
-        case REG_FREQ_HIGH:
-            for (int i = 0; i < VOICE_COUNT; i++) {
-                if (voice_enabled(sound, i)) {
-                    sound->voices[i].freq_high = value;
-                }
-            }
+    return SAMPLE_FIFO_SIZE - atomic_load_explicit(&sound->sample_table.fifo_bytes, memory_order_relaxed);
+}
 
-            if (sample_table_enabled(sound)) {
-                tbl->divider = value;
-            }
-            break;
 
-        case REG_WAVEFORM:
-            for (int i = 0; i < VOICE_COUNT; i++) {
-                if (voice_enabled(sound, i)) {
-                    sound->voices[i].wave = value & 0x3;
-                    sound->voices[i].duty = value >> REG_WAVEFORM_DUTY_SH;
-                    sound->voices[i].noise = (sound->voices[i].wave == WAVE_NOISE);
-                }
-            }
-            /* Special case for the sample table voice,
-             * Register 2 corresponds to the configuration */
-            if (sample_table_enabled(sound)) {
-                tbl->config    = value & 0x7;
-                tbl->is_u8     = (value & 1) != 0;
-                tbl->is_signed = (value & 4) != 0;
-            }
-            break;
-
-        case REG_VOICE_VOL:
-            for (int i = 0; i < VOICE_COUNT; i++) {
-                if (voice_enabled(sound, i)) {
-                    sound->voices[i].voice_volume = value;
-                    sound->voices[i].volume = volume_steps_to_float(value, 2);
-                }
-            }
-            break;
+uint32_t zvb_sound_fifo_push(zvb_sound_t* sound, const uint8_t* data, uint32_t count)
+{
+    zvb_sample_table_t* tbl = &sound->sample_table;
 
-        case REG_MST_LEFT:
-            sound->left_voices = value;
-            break;
+    count = MIN(count, zvb_sound_fifo_room(sound));
+    /* Copy in at most two parts, before and after the end of the ring buffer */
+    const uint32_t first = MIN(count, (uint32_t) (SAMPLE_FIFO_SIZE - tbl->fifo_head));
+    memcpy(&tbl->fifo[tbl->fifo_head], data, first);
+    memcpy(&tbl->fifo[0], data + first, count - first);
+    tbl->fifo_head = (tbl->fifo_head + count) % SAMPLE_FIFO_SIZE;
+    atomic_fetch_add_explicit(&tbl->fifo_bytes, count, memory_order_release);
+    return count;
+}
 
-        case REG_MST_RIGHT:
-            sound->right_voices = value;
-            break;
 
-        case REG_MST_HOLD:
-            sound->hold_voices = value;
-            for (int i = 0; i < VOICE_COUNT; i++) {
-                sound->voices[i].hold = voice_held(sound, i);
-            }
-            /* If the wavetable is on hold, it should stop outputting sound */
-            sound->sample_table.hold = voice_held(sound, 7);
-            break;
+void zvb_sound_write(zvb_sound_t* sound, uint32_t port, uint8_t value) {
+    if (!sound) {
+        return;
+    }
 
-        case REG_MST_VOL:
-            sound->master_volume = value;
-            if (value & 0x80) {
-                sound->right_volume = 0.f;
-            } else {
-                /* We have two bits for volume */
-                sound->right_volume = volume_steps_to_float(value >> 2, 2);
-            }
-            if (value & 0x40) {
-                sound->left_volume = 0.f;
-            } else {
-                sound->left_volume = volume_steps_to_float(value, 2);
-            }
-            break;
+    /* Register 0 corresponds to the FIFO, the data goes straight to it, ignore it when full */
+    if (port == REG_FREQ_LOW) {
+        zvb_sound_fifo_push(sound, &value, 1);
+    }
 
-        case REG_MST_ENA:
-            sound->enabled_voices = value;
-            break;
+    sound_regs_write(&sound->regs, port, value);
 
-        default:
-            break;
+    /* The audio thread will apply the same write to its own copy of the registers */
+    if (sound->enabled) {
+        sound_queue_push(sound, port, value);
     }
 }
@@ -6,14 +6,26 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+    #include <sys/mman.h>
+#endif
 #include "hw/zvb/zvb_spi.h"
 #include "utils/log.h"
+#include "utils/helpers.h"
+#include "utils/paths.h"
 
 #define DEBUG_CMD       0
 #define DEBUG_WRITE     0
 
+/* Delay without any block written after which the modified blocks are written back, in T-states */
+#define TF_SYNC_PERIOD  CPUFREQ
+
 #define TF_CMD_MASK     0x40
 #define TF_CMD0_CRC     0x95
 #define TF_CMD1_CRC     0xF9
@@ -21,10 +33,16 @@
 #define TF_CMD58_CRC    0x95
 #define TF_ILL_CMD      0x05
 
+/* Data response tokens sent after each block written */
+#define TF_DATA_ACCEPTED    0x05
+#define TF_DATA_WRITE_ERR   0x0D
+
 #define TF_BLK_SIZE     512
 
 
+#define TF_STOP_TRANS       12
 #define TF_READ_BLK         17
+#define TF_READ_MUL_BLK     18
 #define TF_WRITE_BLK        24
 #define TF_WRITE_MUL_BLK    25
 
@@ -34,6 +52,11 @@
  */
 #define TF_BLK_DUMMY_BYTES  3
 
+/**
+ * @brief Number of CRC bytes following each block of the multiple block commands
+ */
+#define TF_BLK_CRC_BYTES    2
+
 static void zvb_tf_deassert(zvb_spi_t* spi);
 static void zvb_tf_start(zvb_spi_t* spi);
 
@@ -55,29 +78,100 @@ void zvb_spi_reset(zvb_spi_t* spi)
     spi->tf.state = TF_IDLE;
 }
 
-int zvb_spi_load_tf_image(zvb_spi_t* spi, const char* filename)
+int zvb_spi_load_tf_image(zvb_spi_t* spi, const char* filename, const char* delta, bool discard,
+                          disk_durability_t durability, bool async)
 {
+    struct stat st;
+
     if (spi == NULL || filename == NULL) {
         return 1;
     }
+    zvb_tf_t* tf = &spi->tf;
+
+    if (delta != NULL || discard) {
+        if (disk_cow_open(&tf->cow, filename, delta, discard, durability, async) != 0) {
+            return 1;
+        }
+        tf->copy_on_write = true;
+        tf->loaded = true;
+        tf->img_size = tf->cow.base_size;
+        log_printf("[TF] %s loaded successfully\n", filename);
+        return 0;
+    }
 
     /* Open it in both read and write */
-    spi->tf.img = fopen(filename, "r+");
-    if (spi->tf.img == NULL) {
+    tf->fd = open(filename, O_RDWR | OPEN_BINARY);
+    if (tf->fd < 0) {
         log_perror("[TF] Could not open TF Card image");
         return 1;
     }
 
-    log_printf("[TF] %s loaded successfully\n", filename);
+    if (fstat(tf->fd, &st) != 0 || st.st_size == 0) {
+        log_err_printf("[TF] Invalid TF Card image\n");
+        close(tf->fd);
+        return 1;
+    }
+    tf->img_size = st.st_size;
+
+    /* Map the image so the blocks can be accessed without any system call. If that's not possible,
+     * the blocks are read from the file and the modified ones are kept in the cache until written back. */
+#ifndef _WIN32
+    void* img = mmap(NULL, tf->img_size, PROT_READ | PROT_WRITE, MAP_SHARED, tf->fd, 0);
+    if (img != MAP_FAILED) {
+        tf->img = img;
+    }
+#endif
+    disk_cache_init(&tf->cache, tf->fd, tf->img, tf->img != NULL ? tf->img_size : 0, durability, async);
+    tf->loaded = true;
 
-    /* Save the size of the file */
-    fseek(spi->tf.img, 0, SEEK_END);
-    spi->tf.img_size = ftell(spi->tf.img);
-    fseek(spi->tf.img, 0, SEEK_SET);
+    log_printf("[TF] %s loaded successfully\n", filename);
     return 0;
 }
 
 
+void zvb_spi_deinit(zvb_spi_t* spi)
+{
+    zvb_tf_t* tf = &spi->tf;
+
+    if (!tf->loaded) {
+        return;
+    }
+    if (tf->copy_on_write) {
+        disk_cow_close(&tf->cow);
+        tf->copy_on_write = false;
+    } else {
+        disk_cache_deinit(&tf->cache);
+#ifndef _WIN32
+        if (tf->img != NULL) {
+            munmap(tf->img, tf->img_size);
+            tf->img = NULL;
+        }
+#endif
+        close(tf->fd);
+    }
+    tf->loaded = false;
+}
+
+
+void zvb_spi_tick(zvb_spi_t* spi, int tstates)
+{
+    zvb_tf_t* tf = &spi->tf;
+
+    if (!tf->dirty) {
+        return;
+    }
+    tf->sync_countdown -= tstates;
+    if (tf->sync_countdown <= 0) {
+        /* Try again on the next tick if the previous write back is still in progress */
+        if (tf->copy_on_write) {
+            tf->dirty = !disk_cow_flush(&tf->cow, false);
+        } else {
+            tf->dirty = !disk_cache_flush(&tf->cache, false);
+        }
+    }
+}
+
+
 void zvb_spi_write(zvb_spi_t* spi, uint32_t addr, uint8_t value)
 {
     uint_fast8_t index;
@@ -180,6 +274,72 @@ typedef union {
 } r1_resp;
 
 
+/**
+ * @brief Get the block data in the image, NULL if the block is out of the image
+ */
+static const uint8_t* zvb_tf_block(zvb_tf_t* tf, uint32_t block)
+{
+    const size_t offset = (size_t) block * TF_BLK_SIZE;
+    if (offset + TF_BLK_SIZE > tf->img_size) {
+        return NULL;
+    }
+    if (tf->copy_on_write) {
+        return disk_cow_read(&tf->cow, block, tf->buffer);
+    }
+    if (tf->img == NULL) {
+        disk_cache_read(&tf->cache, block, tf->buffer);
+        return tf->buffer;
+    }
+    return tf->img + offset;
+}
+
+
+static bool zvb_tf_write_block(zvb_tf_t* tf, uint32_t block, const uint8_t* data)
+{
+    if ((size_t) block * TF_BLK_SIZE + TF_BLK_SIZE > tf->img_size) {
+        log_err_printf("[TF] Invalid write block: 0x%x\n", block);
+        return false;
+    }
+    if (tf->copy_on_write) {
+        uint8_t* dst = disk_cow_write(&tf->cow, block);
+        if (dst == NULL) {
+            return false;
+        }
+        memcpy(dst, data, TF_BLK_SIZE);
+    } else if (tf->img != NULL) {
+        memcpy(tf->img + (size_t) block * TF_BLK_SIZE, data, TF_BLK_SIZE);
+    } else {
+        disk_cache_write(&tf->cache, block, data);
+    }
+    /* Write the blocks back once the card has been idle for a whole period */
+    tf->dirty = true;
+    tf->sync_countdown = TF_SYNC_PERIOD;
+    return true;
+}
+
+
+/**
+ * @brief Prepare the reply for the next block of a READ_MULTIPLE_BLOCK command: data token, data and CRC
+ */
+static void zvb_tf_next_read_block(zvb_tf_t* tf)
+{
+    const uint8_t* data = zvb_tf_block(tf, tf->block);
+
+    tf->reply_idx = 0;
+    tf->reply_len = 0;
+    if (data == NULL) {
+        /* Reached the end of the card, only send dummy bytes until CMD12 is received */
+        return;
+    }
+    tf->reply[0] = TF_DATA_TOKEN;
+    memcpy(tf->reply + 1, data, TF_BLK_SIZE);
+    /* CRC is not checked by the host */
+    memset(tf->reply + 1 + TF_BLK_SIZE, 0xFF, TF_BLK_CRC_BYTES);
+    tf->reply_len = 1 + TF_BLK_SIZE + TF_BLK_CRC_BYTES;
+    tf->block++;
+}
+
+
 static void zvb_tf_deassert(zvb_spi_t* spi)
 {
     /* Make sure the TF Card has been initialized at least once */
@@ -196,6 +356,11 @@ static void zvb_tf_deassert(zvb_spi_t* spi)
 
 static uint8_t zvb_tf_next_byte(zvb_tf_t* tf)
 {
+    /* Stream the blocks one after the other until the host sends CMD12 */
+    if (tf->state == TF_READ_MULTIPLE && tf->reply_idx == tf->reply_len) {
+        zvb_tf_next_read_block(tf);
+    }
+
     if (tf->reply_idx < tf->reply_len) {
         return tf->reply[tf->reply_idx++];
     }
@@ -274,51 +439,68 @@ static void zvb_tf_process_command(zvb_spi_t* spi, uint32_t command, uint32_t pa
                 r1.ill_cmd = 1;
                 zvb_r1_response(tf, r1.raw);
             } else {
-                tf->state = TF_READ_BLOCK;
-                /* TODO: check the size of the file against the block number */
-                const uint32_t offset = param * TF_BLK_SIZE;
-                if (fseek(tf->img, offset, SEEK_SET) < 0) {
-                    log_perror("[TF] Could not seek into image for reading");
+                const uint8_t* data = zvb_tf_block(tf, param);
+                if (data == NULL) {
+                    log_err_printf("[TF] Invalid read block: 0x%x\n", param);
                     r1.param_err = 1;
                     zvb_r1_response(tf, r1.raw);
                     return;
                 }
+                tf->state = TF_READ_BLOCK;
                 tf->reply[0] = 0xFF;     // Dummy byte
                 tf->reply[1] = 0x00;     // ACK!
                 tf->reply[2] = TF_DATA_TOKEN;     // Set as ready!
-                int rd = fread(tf->reply + TF_BLK_DUMMY_BYTES, 1, TF_BLK_SIZE, tf->img);
-                if (rd < TF_BLK_SIZE) {
-                    log_err_printf("[TF] Warning could only read %d/%d bytes from the image file\n", rd, TF_BLK_SIZE);
-                }
+                memcpy(tf->reply + TF_BLK_DUMMY_BYTES, data, TF_BLK_SIZE);
                 tf->reply_idx = 0;
                 tf->reply_len = TF_BLK_SIZE + TF_BLK_DUMMY_BYTES;
             }
             break;
+        case TF_READ_MUL_BLK:
+            /* Read blocks until CMD12 is received, the blocks are prepared one by one */
+            if (tf->state != TF_IDLE) {
+                r1.ill_cmd = 1;
+                zvb_r1_response(tf, r1.raw);
+            } else if (zvb_tf_block(tf, param) == NULL) {
+                log_err_printf("[TF] Invalid read block: 0x%x\n", param);
+                r1.param_err = 1;
+                zvb_r1_response(tf, r1.raw);
+            } else {
+                tf->state = TF_READ_MULTIPLE;
+                tf->block = param;
+                zvb_r1_response(tf, 0);
+            }
+            break;
+        case TF_STOP_TRANS:
+            /* Only valid while reading multiple blocks, a stuff byte precedes the response */
+            if (tf->state != TF_READ_MULTIPLE) {
+                r1.ill_cmd = 1;
+                zvb_r1_response(tf, r1.raw);
+            } else {
+                tf->state = TF_IDLE;
+                tf->reply[0] = 0xFF;
+                tf->reply[1] = 0xFF;
+                tf->reply[2] = 0x00;
+                tf->reply_idx = 0;
+                tf->reply_len = 3;
+            }
+            break;
         case TF_WRITE_BLK:
-            /* Read block */
+        case TF_WRITE_MUL_BLK:
+            /* Write block(s), the data tokens will follow */
             if (tf->state != TF_IDLE) {
                 r1.ill_cmd = 1;
                 zvb_r1_response(tf, r1.raw);
+            } else if (zvb_tf_block(tf, param) == NULL) {
+                log_err_printf("[TF] Invalid write block: 0x%x\n", param);
+                r1.param_err = 1;
+                zvb_r1_response(tf, r1.raw);
             } else {
-                tf->state = TF_WRITE_BLOCK_WAIT_TOK;
-                /* TODO: check the size of the file against the block number */
-                const size_t offset = param * TF_BLK_SIZE;
-                if (offset >= tf->img_size) {
-                    log_err_printf("[TF] Invalid write offset: 0x%zx/0x%zx\n", offset, tf->img_size);
-                    r1.param_err = 1;
-                    zvb_r1_response(tf, r1.raw);
-                    tf->state = TF_IDLE;
-                    break;
-                }
 #if DEBUG_WRITE
-                log_printf("[TF] Write block, offset: 0x%lx (sector: %x)\n", offset, param);
+                log_printf("[TF] Write block, sector: %x, multiple: %d\n", param, command == TF_WRITE_MUL_BLK);
 #endif
-                if (fseek(tf->img, offset, SEEK_SET) < 0) {
-                    log_perror("[TF] Could not seek into image for writing");
-                    r1.param_err = 1;
-                    zvb_r1_response(tf, r1.raw);
-                    return;
-                }
+                tf->state = TF_WRITE_BLOCK_WAIT_TOK;
+                tf->block = param;
+                tf->multiple = command == TF_WRITE_MUL_BLK;
                 tf->reply[0] = 0xFF;     // Dummy byte
                 tf->reply[1] = 0x00;     // ACK!
                 tf->reply_idx = 0;
@@ -370,64 +552,68 @@ static void zvb_tf_process_command(zvb_spi_t* spi, uint32_t command, uint32_t pa
 }
 
 
-static void zvb_tf_start_write(zvb_spi_t* spi)
+/**
+ * @brief Process a byte sent by the host while writing blocks
+ *
+ * @returns the byte sent back by the card
+ */
+static uint8_t zvb_tf_write_byte(zvb_tf_t* tf, uint8_t value)
 {
-    const int length = spi->ram_len;
-    int i = 0;
-
-    if (spi->tf.state == TF_WRITE_BLOCK_WAIT_TOK) {
-        /* Look for the data token */
-        for (i = 0; i < length; i++) {
-            if (spi->ram_wr.data[i] == TF_DATA_TOKEN) {
-                spi->tf.reply_idx = 0;
-                spi->tf.state = TF_WRITE_BLOCK;
-                /* Make i point to the first data byte */
-                i++;
-                break;
+    switch (tf->state) {
+        case TF_WRITE_BLOCK_WAIT_TOK:
+            /* Look for the data token, or the stop token when writing multiple blocks */
+            if (value == (tf->multiple ? TF_DATA_TOKEN_MUL : TF_DATA_TOKEN)) {
+                tf->reply_idx = 0;
+                tf->state = TF_WRITE_BLOCK;
+            } else if (tf->multiple && value == TF_STOP_TOKEN) {
+                tf->state = TF_WRITE_STOP;
             }
-        }
-    }
-
-    if (spi->tf.state == TF_WRITE_BLOCK) {
-        /* In total, we need to receive 512 bytes of data and 2 CRC bytes */
-        for (; i < length && spi->tf.reply_idx < TF_BLK_SIZE + 2; i++) {
-            spi->tf.reply[spi->tf.reply_idx++] = spi->ram_wr.data[i];
-        }
+            return 0xFF;
+
+        case TF_WRITE_BLOCK:
+            /* In total, we need to receive 512 bytes of data and 2 CRC bytes */
+            tf->reply[tf->reply_idx++] = value;
+            if (tf->reply_idx == TF_BLK_SIZE + TF_BLK_CRC_BYTES) {
+                tf->write_error = !zvb_tf_write_block(tf, tf->block++, tf->reply);
+                tf->state = TF_WRITE_BLOCK_SEND_RESP;
+                tf->reply_idx = 0;
+            }
+            return 0xFF;
 
-        if (spi->tf.reply_idx == TF_BLK_SIZE + 2) {
-            /* Finished receiving the block data, write it to the file, the file has already been seeked */
-#if 0
-            log_printf("[TF] Writing data: \n");
-            for (int i = 0; i < TF_BLK_SIZE; i++) {
-                log_printf("%x, ", spi->tf.reply[i]);
+        case TF_WRITE_BLOCK_SEND_RESP:
+            if (tf->reply_idx == 0) {
+                /* Data response */
+                tf->reply_idx++;
+                return tf->write_error ? TF_DATA_WRITE_ERR : TF_DATA_ACCEPTED;
             }
-            log_printf("\n");
-#endif
-            int wr = fwrite(spi->tf.reply, 1, TF_BLK_SIZE, spi->tf.img);
-            if (wr < TF_BLK_SIZE) {
-                log_err_printf("[TF] Warning could only write %d/%d bytes from the image file\n", wr, TF_BLK_SIZE);
+            if (tf->reply_idx == 1) {
+                /* Busy flag, then wait for the next block when writing multiple blocks, a write error
+                 * terminates the command */
+                tf->reply_idx++;
+                if (tf->write_error) {
+                    tf->state = TF_IDLE;
+                } else if (tf->multiple) {
+                    tf->state = TF_WRITE_BLOCK_WAIT_TOK;
+                }
+                return 0x00;
             }
-            spi->tf.state = TF_WRITE_BLOCK_SEND_RESP;
-            spi->tf.reply_idx = 0;
-        }
+            return 0xFF;
+
+        case TF_WRITE_STOP:
+            /* Busy flag after the stop token */
+            tf->state = TF_IDLE;
+            return 0x00;
+
+        default:
+            return 0xFF;
     }
+}
 
-    if (spi->tf.state == TF_WRITE_BLOCK_SEND_RESP) {
-        /* The index i points to the response index we need to write */
-        if (spi->tf.reply_idx == 0 && i < length) {
-            /* Data response */
-            spi->ram_rd.data[i++] = 0x5;
-            spi->tf.reply_idx++;
-        }
-        if (spi->tf.reply_idx == 1 && i < length) {
-            /* Busy flag */
-            spi->ram_rd.data[i++] = 0x00;
-            spi->tf.reply_idx++;
-        }
-        if (spi->tf.reply_idx >= 2 && i < length) {
-            /* End */
-            memset(spi->ram_rd.data + i, 0xFF, length - i);
-        }
+
+static void zvb_tf_start_write(zvb_spi_t* spi)
+{
+    for (int i = 0; i < spi->ram_len; i++) {
+        spi->ram_rd.data[i] = zvb_tf_write_byte(&spi->tf, spi->ram_wr.data[i]);
     }
 }
 
@@ -437,7 +623,7 @@ static void zvb_tf_start(zvb_spi_t* spi)
     int i;
     const int length = spi->ram_len;
     /* If we don't have any TF card mounted, abort, fill the response with 0xFF */
-    if (spi->tf.img == NULL) {
+    if (!spi->tf.loaded) {
         memset(spi->ram_rd.data, 0xFF, length);
         return;
     }
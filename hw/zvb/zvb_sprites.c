@@ -12,33 +12,42 @@
 #include <stddef.h>
 #include "hw/zvb/zvb_sprites.h"
 
-#define FLOATS_PER_SPRITE   8
+/* Each sprite is 8 bytes big, so it is represented by two RGBA8 pixels in the texture */
+#define PIXELS_PER_SPRITE   2
 
 static void sprites_update_img(zvb_sprites_t* sprites, uint32_t idx);
 
 
+static void sprites_clear_dirty(zvb_sprites_t* sprites)
+{
+    sprites->dirty = 0;
+    sprites->dirty_min = ZVB_SPRITES_COUNT;
+    sprites->dirty_max = -1;
+}
+
+
 void zvb_sprites_init(zvb_sprites_t* sprites, bool rendering_enabled)
 {
     assert(sprites != NULL);
+    _Static_assert(sizeof(zvb_sprite_t) == PIXELS_PER_SPRITE * sizeof(Color), "Sprite must fit in two pixels");
     memset(sprites->data, 0, sizeof(sprites->data));
-    memset(sprites->fdata, 0, sizeof(sprites->fdata));
 
     if (!rendering_enabled) {
-        sprites->dirty = 0;
+        sprites_clear_dirty(sprites);
         return;
     }
 
-    /* Create an empty bitmap image that will be transfered to the GPU when rendering each frame */
+    /* The image points to the raw sprites, the shader will decode the bytes itself, so no conversion is needed */
     sprites->img_sprites = (Image) {
-        .data = sprites->fdata,
-        .width = ZVB_SPRITES_COUNT * 2,  // Two "pixels" per sprites
+        .data = sprites->data,
+        .width = ZVB_SPRITES_COUNT * PIXELS_PER_SPRITE,
         .height = 1,
         .mipmaps = 1,
-        .format = PIXELFORMAT_UNCOMPRESSED_R32G32B32A32
+        .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
     };
 
     sprites->tex_sprites = LoadTextureFromImage(sprites->img_sprites);
-    sprites->dirty = 0;
+    sprites_clear_dirty(sprites);
 }
 
 
@@ -67,28 +76,26 @@ uint8_t zvb_sprites_read(zvb_sprites_t* sprites, uint32_t addr)
 void zvb_sprites_update(zvb_sprites_t* sprites)
 {
     if (sprites->dirty != 0 && sprites->tex_sprites.id != 0) {
-        UpdateTexture(sprites->tex_sprites, sprites->img_sprites.data);
-        sprites->dirty = 0;
+        const int first = sprites->dirty_min;
+        const int count = sprites->dirty_max - first + 1;
+        UpdateTextureRec(sprites->tex_sprites,
+                         (Rectangle) { first * PIXELS_PER_SPRITE, 0, count * PIXELS_PER_SPRITE, 1 },
+                         &sprites->data[first]);
+        sprites_clear_dirty(sprites);
     }
 }
 
 
 /**
- * @brief Update the image with incoming byte from a given layer
+ * @brief Mark the given sprite as modified, it will be uploaded on the next update
  */
 static void sprites_update_img(zvb_sprites_t* sprites, uint32_t idx)
 {
-    zvb_sprite_t*  sprite  = &sprites->data[idx];
-    zvb_fsprite_t* fsprite = &sprites->fdata[idx];
-
-    fsprite->y = sprite->y;
-    fsprite->x = sprite->x;
-    fsprite->tile_number = (sprite->flags.bitmap.tileset_idx << 8) | sprite->flags.bitmap.tile_number;
-    fsprite->f_behind_fg = sprite->flags.bitmap.behind_fg;
-    fsprite->f_flip_x = sprite->flags.bitmap.flip_x;
-    fsprite->f_flip_y = sprite->flags.bitmap.flip_y;
-    /* Store the palette as a mask to simplify the calculation in the shader */
-    fsprite->palette = sprite->flags.bitmap.palette << 4;
-    fsprite->f_height_32 = sprite->extra_flags.bitmap.height_32;
     sprites->dirty = 1;
+    if ((int) idx < sprites->dirty_min) {
+        sprites->dirty_min = idx;
+    }
+    if ((int) idx > sprites->dirty_max) {
+        sprites->dirty_max = idx;
+    }
 }
@@ -153,19 +153,25 @@ uint8_t zvb_text_read(zvb_text_t* text, uint32_t addr)
 }
 
 
-bool zvb_text_update(zvb_text_t* text, zvb_text_info_t* info)
+bool zvb_text_vblank(zvb_text_t* text)
 {
-    if (text == NULL || info == NULL) {
-        return false;
-    }
-
     /* Check if we have to blink the cursor */
     if (text->cursor_time != 0 && text->cursor_time != 0xff) {
         if (++text->frame_counter == text->cursor_time) {
             text->cursor_shown = !text->cursor_shown;
             text->frame_counter = 0;
+            return true;
         }
     }
+    return false;
+}
+
+
+bool zvb_text_update(zvb_text_t* text, zvb_text_info_t* info)
+{
+    if (text == NULL || info == NULL) {
+        return false;
+    }
 
     *info = (zvb_text_info_t) {
         .pos   = { text->cursor_pos.x, text->cursor_pos.y },
@@ -10,7 +10,15 @@
 #include <string.h>
 #include "hw/zvb/zvb_tilemap.h"
 
-static void tilemap_update_img(zvb_tilemap_t* tilemap, int layer, uint32_t addr, uint_fast8_t data);
+static void tilemap_update_img(zvb_tilemap_t* tilemap, int idx);
+
+
+static void tilemap_clear_dirty(zvb_tilemap_t* tilemap)
+{
+    tilemap->dirty = 0;
+    tilemap->dirty_min = ZVB_TILEMAP_SIZE;
+    tilemap->dirty_max = -1;
+}
 
 
 void zvb_tilemap_init(zvb_tilemap_t* tilemap, bool rendering_enabled)
@@ -20,9 +28,9 @@ void zvb_tilemap_init(zvb_tilemap_t* tilemap, bool rendering_enabled)
     /* Initialize both tilemaps to 0 on boot (not reset) */
     memset(tilemap->raw_layer0, 0, sizeof(tilemap->raw_layer0));
     memset(tilemap->raw_layer1, 0, sizeof(tilemap->raw_layer1));
+    tilemap_clear_dirty(tilemap);
 
     if (!rendering_enabled) {
-        tilemap->dirty = 0;
         return;
     }
 
@@ -40,7 +48,6 @@ void zvb_tilemap_init(zvb_tilemap_t* tilemap, bool rendering_enabled)
     memset(tilemap->img_tilemap.data, 0, sizeof(Color) * ZVB_TILEMAP_SIZE);
 
     tilemap->tex_tilemap = LoadTextureFromImage(tilemap->img_tilemap);
-    tilemap->dirty = 0;
 }
 
 
@@ -51,9 +58,7 @@ void zvb_tilemap_write(zvb_tilemap_t* tilemap, int layer, uint32_t addr, uint8_t
     } else {
         tilemap->raw_layer1[addr] = data;
     }
-    if (tilemap->img_tilemap.data != NULL) {
-        tilemap_update_img(tilemap, layer, addr, data);
-    }
+    zvb_tilemap_mark_dirty(tilemap, addr, addr + 1);
 }
 
 
@@ -67,31 +72,47 @@ uint8_t zvb_tilemap_read(zvb_tilemap_t* tilemap, int layer, uint32_t addr)
 }
 
 
+void zvb_tilemap_mark_dirty(zvb_tilemap_t* tilemap, uint32_t from, uint32_t to)
+{
+    tilemap->dirty = 1;
+    if ((int) from < tilemap->dirty_min) {
+        tilemap->dirty_min = from;
+    }
+    if ((int) to - 1 > tilemap->dirty_max) {
+        tilemap->dirty_max = to - 1;
+    }
+}
+
+
 void zvb_tilemap_update(zvb_tilemap_t* tilemap)
 {
     if (tilemap->dirty != 0 && tilemap->tex_tilemap.id != 0) {
-        UpdateTexture(tilemap->tex_tilemap, tilemap->img_tilemap.data);
-        tilemap->dirty = 0;
+        /* The image is a single row, only convert and upload the span of entries that changed */
+        const int first = tilemap->dirty_min;
+        const int count = tilemap->dirty_max - first + 1;
+        Color* pixels = (Color*) tilemap->img_tilemap.data;
+        for (int i = first; i < first + count; i++) {
+            tilemap_update_img(tilemap, i);
+        }
+        UpdateTextureRec(tilemap->tex_tilemap,
+                         (Rectangle) { first, 0, count, 1 },
+                         pixels + first);
+        tilemap_clear_dirty(tilemap);
     }
 }
 
 
 /**
- * @brief Update the image with incoming byte from a given layer
+ * @brief Convert the entry of both layers at the given index into the image
  */
-static void tilemap_update_img(zvb_tilemap_t* tilemap, int layer, uint32_t addr, uint_fast8_t data)
+static void tilemap_update_img(zvb_tilemap_t* tilemap, int idx)
 {
     /* Pixels of the image can be access as an array directly */
-    Color *pixels = (Color*) tilemap->img_tilemap.data;
-    Color *pixel  = pixels + addr;
+    Color *pixel = (Color*) tilemap->img_tilemap.data + idx;
+    const uint_fast8_t attr = tilemap->raw_layer1[idx];
 
-    if (layer == 0) {
-        pixel->r = data;
-    } else {
-        pixel->g = data;
-        pixel->b = (data >> 4) & 0xf;
-        pixel->a = (data >> 0) & 0xf;
-    }
-
-    tilemap->dirty = 1;
+    pixel->r = tilemap->raw_layer0[idx];
+    pixel->g = attr;
+    pixel->b = (attr >> 4) & 0xf;
+    pixel->a = (attr >> 0) & 0xf;
 }
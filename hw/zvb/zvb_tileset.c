@@ -9,45 +9,55 @@
 #include <assert.h>
 #include <string.h>
 #include "hw/zvb/zvb_tileset.h"
+#include "utils/pages.h"
 
 
-static void tileset_update_img(zvb_tileset_t* tileset, uint32_t addr, uint_fast8_t data);
+static void tileset_clear_dirty(zvb_tileset_t* tileset)
+{
+    tileset->dirty = 0;
+    tileset->dirty_min_row = ZVB_TILESET_IMG_HEIGHT;
+    tileset->dirty_max_row = -1;
+}
 
 
-void zvb_tileset_init(zvb_tileset_t* tileset, bool rendering_enabled)
+int zvb_tileset_init(zvb_tileset_t* tileset, bool rendering_enabled)
 {
     assert(tileset != NULL);
 
     /* Initialize both tilesets to 0 on boot (not reset) */
-    memset(tileset->raw, 0, sizeof(tileset->raw));
+    tileset->raw = pages_alloc(ZVB_TILESET_SIZE);
+    if (tileset->raw == NULL) {
+        return -1;
+    }
+    tileset_clear_dirty(tileset);
 
     if (!rendering_enabled) {
-        tileset->dirty = 0;
-        return;
+        return 0;
     }
 
-    /* Create an empty bitmap image, to transmit the data faster to the GPU
+    /* The image points to the raw tileset, to transmit the data faster to the GPU.
      * Each tile is represented by 256 8-bit values on ZVB,
      * Since here the colors are 32-bit, we can store 4 pixels inside.
      * So each tile is 64-color big, we have 256 tiles. */
-    const int width = 64;
-    const int height = 256;
-    _Static_assert(width*height*sizeof(Color) == 65536, "Image texture size is invalid");
-    tileset->img_tileset = GenImageColor(width, height, BLACK);
-    /* Set all the bytes to 0 */
-    memset(tileset->img_tileset.data, 0, width * height);
+    _Static_assert(ZVB_TILESET_IMG_WIDTH * ZVB_TILESET_IMG_HEIGHT * sizeof(Color) == ZVB_TILESET_SIZE,
+                   "Image texture size is invalid");
+    tileset->img_tileset = (Image) {
+        .data = tileset->raw,
+        .width = ZVB_TILESET_IMG_WIDTH,
+        .height = ZVB_TILESET_IMG_HEIGHT,
+        .mipmaps = 1,
+        .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
+    };
 
     tileset->tex_tileset = LoadTextureFromImage(tileset->img_tileset);
-    tileset->dirty = 0;
+    return 0;
 }
 
 
 void zvb_tileset_write(zvb_tileset_t* tileset, uint32_t addr, uint8_t data)
 {
     tileset->raw[addr] = data;
-    if (tileset->img_tileset.data != NULL) {
-        tileset_update_img(tileset, addr, data);
-    }
+    zvb_tileset_mark_dirty(tileset, addr, addr + 1);
 }
 
 
@@ -57,24 +67,33 @@ uint8_t zvb_tileset_read(zvb_tileset_t* tileset, uint32_t addr)
 }
 
 
-void zvb_tileset_update(zvb_tileset_t* tileset)
+void zvb_tileset_mark_dirty(zvb_tileset_t* tileset, uint32_t from, uint32_t to)
 {
-    if (tileset->dirty != 0 && tileset->tex_tileset.id != 0) {
-        UpdateTexture(tileset->tex_tileset, tileset->img_tileset.data);
-        tileset->dirty = 0;
+    /* Each row of the image represents ZVB_TILESET_IMG_WIDTH pixels of 4 bytes */
+    const int row_size = ZVB_TILESET_IMG_WIDTH * sizeof(Color);
+    const int first = from / row_size;
+    const int last = (to - 1) / row_size;
+
+    tileset->dirty = 1;
+    if (first < tileset->dirty_min_row) {
+        tileset->dirty_min_row = first;
+    }
+    if (last > tileset->dirty_max_row) {
+        tileset->dirty_max_row = last;
     }
 }
 
 
-/**
- * @brief Update the image with incoming byte
- */
-static void tileset_update_img(zvb_tileset_t* tileset, uint32_t addr, uint_fast8_t data)
+void zvb_tileset_update(zvb_tileset_t* tileset)
 {
-    _Static_assert(sizeof(Color) == 4, "Color should be 32-bit big");
-    /* Pixels of the image can be access as an array directly. The lines of each tile
-     * are organized linearly. */
-    uint8_t *pixels = tileset->img_tileset.data;
-    pixels[addr] = data;
-    tileset->dirty = 1;
+    if (tileset->dirty != 0 && tileset->tex_tileset.id != 0) {
+        /* Only upload the rows that were modified, all of them are contiguous in the image */
+        const int row_size = ZVB_TILESET_IMG_WIDTH * sizeof(Color);
+        const int first = tileset->dirty_min_row;
+        const int count = tileset->dirty_max_row - first + 1;
+        UpdateTextureRec(tileset->tex_tileset,
+                         (Rectangle) { 0, first, ZVB_TILESET_IMG_WIDTH, count },
+                         tileset->raw + first * row_size);
+        tileset_clear_dirty(tileset);
+    }
 }
@@ -56,6 +56,7 @@ struct dbg_ui_t {
     hwaddr             dis_addr;
     hwaddr             dis_size;
     struct nk_image    vram[DBG_MAX_VRAM_VIEWS];
+    int                vram_tab;
     zvb_t*             zvb;
     bool               main_view_bounds_valid;
     Rectangle          main_view_bounds;
@@ -101,6 +102,7 @@ void ui_panel_mmu(struct dbg_ui_panel_t* panel, struct dbg_ui_t* dctx, dbg_t* db
 void ui_panel_semihost(struct dbg_ui_panel_t* panel, struct dbg_ui_t* dctx, dbg_t* dbg);
 void ui_panel_disassembler(struct dbg_ui_panel_t* panel, struct dbg_ui_t* dctx, dbg_t* dbg);
 void ui_panel_vram(struct dbg_ui_panel_t* panel, struct dbg_ui_t* dctx, dbg_t* dbg);
+uint32_t ui_panel_vram_views(const struct dbg_ui_t* dctx);
 
 int debugger_ui_init(struct dbg_ui_t** ret_ctx, const dbg_ui_init_args_t* args);
 void debugger_ui_deinit(struct dbg_ui_t* dctx);
@@ -110,7 +112,7 @@ void debugger_ui_prepare_render(struct dbg_ui_t* dctx, dbg_t* dbg);
 void debugger_ui_render(struct dbg_ui_t* dctx, dbg_t* dbg);
 bool debugger_ui_main_view_focused(const struct dbg_ui_t* dctx);
 bool debugger_ui_main_view_bounds(const struct dbg_ui_t* dctx, Rectangle* bounds);
-bool debugger_ui_vram_panel_opened(const struct dbg_ui_t* dctx);
+uint32_t debugger_ui_vram_visible_views(const struct dbg_ui_t* dctx);
 
 /** Helpers */
 bool dbg_ui_clickable_label(struct nk_context* ctx, const char* label, const char* value, bool active);
@@ -10,6 +10,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <hw/device.h>
+#include "hw/disk_cow.h"
+#include "hw/disk_cache.h"
 
 
 typedef enum {
@@ -42,12 +44,19 @@ typedef enum {
     IDE_CMD_READ_SECTOR_NR  = 0x21,
     IDE_CMD_WRITE_SECTOR    = 0x30,
     IDE_CMD_WRITE_SECTOR_NR = 0x31,
+    IDE_CMD_READ_MULTIPLE   = 0xC4,
+    IDE_CMD_WRITE_MULTIPLE  = 0xC5,
+    IDE_CMD_SET_MULTIPLE    = 0xC6,
     IDE_CMD_READ_BUFFER     = 0xE4,
+    IDE_CMD_FLUSH_CACHE     = 0xE7,
     IDE_CMD_WRITE_BUFFER    = 0xE8,
     IDE_CMD_IDENTIFY        = 0xEC,
     IDE_CMD_SET_FEATURE     = 0xEF,
 } compactflash_commands_t;
 
+/* Maximum number of sectors per DRQ block for READ/WRITE MULTIPLE */
+#define CF_MAX_MULTIPLE     128
+
 typedef enum {
     IDE_FEAT_ENABLE_8BIT = 0x01,
     IDE_FEAT_DISABLE_8BIT = 0x81,
@@ -72,6 +81,15 @@ typedef enum {
     IDE_DATA_ERROR = 4,
 } compactflash_state_t;
 
+/**
+ * @brief Policy used to write the modified sectors back to the file
+ */
+typedef enum {
+    CF_SYNC_EXIT     = 0, // Only when the emulator exits
+    CF_SYNC_IDLE     = 1, // When no sector has been written for the sync period
+    CF_SYNC_PERIODIC = 2, // At most one sync period after the first modified sector
+} compactflash_sync_t;
+
 typedef struct {
     // device_t
     device_t    parent;
@@ -82,8 +100,26 @@ typedef struct {
     char *file_name;
     size_t total_sectors;
     long data_ofs;
+    /* Base image and delta of the modified sectors, the image file is never written when enabled */
+    bool copy_on_write;
+    disk_cow_t cow;
+    /* Image mapped in memory, NULL if it couldn't be mapped, the sectors then go through the file */
+    uint8_t* image;
+    size_t image_size;
+    /* Data of the current sector, in the mapping when reading it, always in the sector buffer when writing it */
+    uint8_t* data;
+    /* Write back policy of the mapping or of the cached sectors, the period is in T-states */
+    compactflash_sync_t sync;
+    long sync_period;
+    long sync_countdown;
+    bool dirty;
+    /* Performs the write backs in the background, the device is busy until a FLUSH CACHE is done */
+    disk_durability_t durability;
+    disk_cache_t cache;
+    bool flushing, flush_started;
     uint8_t sector_buffer[512];
     int sector_buffer_idx, sec_cnt;
+    int multiple; // Sectors per block for READ/WRITE MULTIPLE, 0 if disabled
     compactflash_state_t state;
     bool master, lba_mode;
     uint8_t status, sec_cur, feature, error;
@@ -91,4 +127,31 @@ typedef struct {
     uint16_t identity[256];
 } compactflash_t;
 
-int compactflash_init(compactflash_t* compactflash, const char *file_name);
+/**
+ * @brief Open the CompactFlash image and map it in memory.
+ *
+ * @param delta_name When not NULL, keep the modified sectors in this delta file, the image is only read
+ * @param discard Never write the modifications to any file, they are lost at exit
+ * @param sync Policy used to write the modified sectors back to the file
+ * @param sync_period_ms Delay of the idle and periodic policies, in milliseconds of emulated time
+ * @param durability When the written back sectors must reach the disk
+ * @param async Write the sectors back from a background thread
+ *
+ * @returns 0 on success, 1 if the CompactFlash must not be emulated
+ */
+int compactflash_init(compactflash_t* compactflash, const char *file_name,
+                      const char *delta_name, bool discard,
+                      compactflash_sync_t sync, int sync_period_ms,
+                      disk_durability_t durability, bool async);
+
+
+/**
+ * @brief Let the CompactFlash know how much time has elapsed, used to sync the modified sectors
+ */
+void compactflash_tick(compactflash_t* compactflash, int elapsed_tstates);
+
+
+/**
+ * @brief Write all the modified sectors back to the image and close it
+ */
+void compactflash_deinit(compactflash_t* compactflash);
@@ -7,6 +7,9 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #define DEVICE(dev) &((dev)->parent)
 
 typedef struct device_t device_t;
@@ -18,6 +21,14 @@ typedef struct {
     uint8_t (*read)(device_t* dev, uint32_t addr);
     uint8_t (*debug_read)(device_t* dev, uint32_t addr); /* Same as read but valid for write-only areas */
     void (*write)(device_t* dev, uint32_t addr, uint8_t data);
+    /* Optional, get a pointer to the data backing `addr` for accesses without side effects.
+     * `size` is the number of bytes requested, it is updated with the number of contiguous bytes
+     * reachable from the returned pointer. Returns NULL if the area cannot be accessed directly. */
+    uint8_t* (*direct)(device_t* dev, uint32_t addr, bool write, uint32_t* size);
+    /* Optional, I/O only, transfer up to `count` bytes between the register `addr` and `data`, with the
+     * same effect as that many consecutive reads or writes. Returns the number of bytes transferred,
+     * which may be less than `count`, 0 if the register doesn't support block transfers. */
+    uint32_t (*block)(device_t* dev, uint32_t addr, bool write, uint8_t* data, uint32_t count);
     int size;
     uint8_t upper_addr;
 } region_t;
@@ -68,6 +79,18 @@ static inline void device_init_mem_debug(device_t* dev, const char* name,
     };
 }
 
+static inline void device_register_direct(device_t* dev,
+                                          uint8_t* (*direct)(device_t*, uint32_t, bool, uint32_t*))
+{
+    dev->mem_region.direct = direct;
+}
+
+static inline void device_register_io_block(device_t* dev,
+                                            uint32_t (*block)(device_t*, uint32_t, bool, uint8_t*, uint32_t))
+{
+    dev->io_region.block = block;
+}
+
 static inline void device_register_reset(device_t* dev, void (*reset)(device_t* dev))
 {
     dev->reset = reset;
@@ -0,0 +1,121 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* The WebAssembly build has no threads, and Windows emulates the positional I/O with a seek that the worker
+ * and the emulation thread can't share, the write backs are performed synchronously */
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+    #define DISK_CACHE_ASYNC_SUPPORT    1
+    #include <pthread.h>
+#endif
+
+#define DISK_CACHE_SECTOR_SIZE  512
+/* Number of dirty sectors after which a write back is started without waiting for the owner */
+#define DISK_CACHE_MAX_DIRTY    4096
+
+
+/**
+ * @brief When the data written back must reach the disk
+ */
+typedef enum {
+    DISK_DURABILITY_NONE     = 0, // Leave it to the host, never sync the file
+    DISK_DURABILITY_PERIODIC = 1, // Sync the file after each write back
+    DISK_DURABILITY_FLUSH    = 2, // Sync the file when the guest flushes its cache, and at exit
+} disk_durability_t;
+
+typedef struct {
+    uint32_t sector;    // DISK_CACHE_FREE if the entry is not used
+    uint8_t  data[DISK_CACHE_SECTOR_SIZE];
+} disk_cache_entry_t;
+
+/**
+ * @brief Hash set of the dirty sectors, indexed by sector number
+ */
+typedef struct {
+    disk_cache_entry_t* entries;
+    uint32_t            capacity;   // Power of two
+    uint32_t            count;
+} disk_cache_set_t;
+
+typedef enum {
+    DISK_CACHE_IDLE = 0,
+    DISK_CACHE_BUSY,    // The thread is writing `flushing` back
+    DISK_CACHE_DONE,    // `flushing` was written, it can be emptied by the emulation thread
+} disk_cache_state_t;
+
+/**
+ * @brief Write-back cache of a disk image, all the file accesses are performed by a background thread.
+ * When the image is memory-mapped, the sectors are modified in place and the write backs only sync
+ * the mapping, else the modified sectors are kept in the cache until they are written back.
+ */
+typedef struct {
+    int                 fd;
+    uint8_t*            image;
+    size_t              image_size;
+    disk_durability_t   durability;
+    disk_cache_set_t    dirty;      // Written by the guest since the last write back
+    disk_cache_set_t    flushing;   // Being written back, only read by both threads
+    bool                sync;       // The current write back must sync the file
+    atomic_int          state;
+    bool                async;
+#if DISK_CACHE_ASYNC_SUPPORT
+    pthread_t           worker;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    bool                quit;
+#endif
+} disk_cache_t;
+
+
+/**
+ * @brief Initialize the cache of an opened image.
+ *
+ * @param image Mapping of the image, NULL if the sectors must be cached
+ * @param async Perform the write backs on a background thread
+ */
+void disk_cache_init(disk_cache_t* cache, int fd, uint8_t* image, size_t image_size,
+                     disk_durability_t durability, bool async);
+
+/**
+ * @brief Read a sector that is not mapped, from the cache or from the file
+ */
+void disk_cache_read(disk_cache_t* cache, uint32_t sector, uint8_t* data);
+
+/**
+ * @brief Write a sector that is not mapped, it stays in the cache until the next write back
+ */
+void disk_cache_write(disk_cache_t* cache, uint32_t sector, const uint8_t* data);
+
+/**
+ * @brief Start writing back the modified sectors, the periodic durability also syncs the file.
+ *
+ * @param sync Sync the file even if the durability is not periodic, used to flush the guest's cache
+ *
+ * @returns false if the previous write back is still in progress, nothing was started
+ */
+bool disk_cache_flush(disk_cache_t* cache, bool sync);
+
+/**
+ * @brief Check whether a write back is in progress
+ */
+bool disk_cache_busy(disk_cache_t* cache);
+
+/**
+ * @brief Wait for the write back in progress, if any, to be over
+ */
+void disk_cache_wait(disk_cache_t* cache);
+
+/**
+ * @brief Write back all the modified sectors, sync the file according to the durability and stop the thread
+ */
+void disk_cache_deinit(disk_cache_t* cache);
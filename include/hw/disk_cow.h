@@ -0,0 +1,111 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "hw/disk_cache.h"
+
+
+/**
+ * @brief Copy-on-write view of a disk image. The base image is only ever read, and shared between
+ * all the instances using it, the sectors written by the guest are kept in a per-instance delta.
+ *
+ * The delta file, when any, is made of a header sector, followed by the table giving the sector number
+ * of each modified sector, followed by their data in the order they were first written. The table has
+ * room for all the sectors of the base image, so adding a sector never moves it:
+ *
+ *   [0:8]   "ZEALCOW1"
+ *   [8:12]  Sector size, always 512
+ *   [12:16] Number of sectors in the delta
+ *   [16:24] Size of the base image in bytes
+ *   [512..] Table, 4 bytes per sector of the base image rounded up to a sector, then the sectors data.
+ *           All the integers are little-endian.
+ *
+ * The header is written last, once the data and the table entries it covers reached the disk. All the
+ * writes to the delta are performed by a disk cache, in the background when possible.
+ */
+#define DISK_COW_MAGIC          "ZEALCOW1"
+#define DISK_COW_SECTOR_SIZE    512
+
+/* The index is made of tables allocated on the first write to any of the sectors they cover */
+#define DISK_COW_TABLE_BITS     16
+#define DISK_COW_TABLE_SIZE     (1 << DISK_COW_TABLE_BITS)
+
+/* The delta sectors are allocated by chunks so that they never move in memory */
+#define DISK_COW_CHUNK_SECTORS  128
+
+typedef struct {
+    int             fd;
+    const uint8_t*  base;           /* Read-only mapping of the base image, NULL if it couldn't be mapped */
+    uint64_t        base_size;
+    uint32_t        total_sectors;
+    uint32_t**      index;          /* Slot of each sector plus one, 0 if it is read from the base image */
+    uint8_t**       chunks;
+    uint32_t*       sectors;        /* Sector number of each slot */
+    uint8_t*        dirty;          /* Slots modified since the last flush */
+    uint32_t        count;
+    uint32_t        capacity;
+    uint32_t        saved_count;    /* Number of slots covered by the header in the delta file */
+    uint32_t        pending_count;  /* Number of slots being written, the header follows once they are */
+    int             delta_fd;       /* -1 when the delta is discarded at exit */
+    disk_cache_t    writer;
+} disk_cow_t;
+
+
+/**
+ * @brief Open the base image read-only and load the delta, if any.
+ *
+ * @param delta_path File storing the modified sectors, created if it doesn't exist. NULL to keep them
+ *                   in memory only.
+ * @param discard Load the delta file but never write to it, all the modifications are lost at exit.
+ * @param durability When the delta writes must reach the disk
+ * @param async Write the delta on a background thread
+ *
+ * @returns 0 on success, -1 on error
+ */
+int disk_cow_open(disk_cow_t* cow, const char* base_path, const char* delta_path, bool discard,
+                  disk_durability_t durability, bool async);
+
+/**
+ * @brief Get the content of a sector for reading.
+ *
+ * @param buffer Sector-sized buffer used when the sector can't be accessed in place.
+ *
+ * @returns Pointer to the sector data, valid until the next call.
+ */
+const uint8_t* disk_cow_read(disk_cow_t* cow, uint32_t sector, uint8_t* buffer);
+
+/**
+ * @brief Get the content of a sector for writing, the first write copies the sector in the delta.
+ *
+ * @returns Pointer to the sector data in the delta, valid until the image is closed, NULL on error.
+ */
+uint8_t* disk_cow_write(disk_cow_t* cow, uint32_t sector);
+
+/**
+ * @brief Start writing the sectors modified since the last call to the delta file, if any. New sectors
+ * take two calls: the header covering them is only written once they are on the disk.
+ *
+ * @param sync Make the data reach the disk, even if the durability doesn't require it
+ *
+ * @returns false if a previous write is still in progress or the header is still to be written,
+ *          the caller must try again later
+ */
+bool disk_cow_flush(disk_cow_t* cow, bool sync);
+
+/**
+ * @brief Check whether a write to the delta is in progress or pending
+ */
+bool disk_cow_busy(disk_cow_t* cow);
+
+/**
+ * @brief Flush the delta and release the images
+ */
+void disk_cow_close(disk_cow_t* cow);
@@ -8,7 +8,10 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
 #include "hw/device.h"
+#include "hw/disk_cache.h"
 
 #define NOR_FLASH_SIZE_KB_MAX (512 * 1024)
 #if CONFIG_NOR_FLASH_512KB
@@ -17,18 +20,36 @@
 #define NOR_FLASH_SIZE_KB (NOR_FLASH_SIZE_KB_MAX / 2)
 #endif
 
+/* Erase granularity of the SST39SF, the modifications are written back to the ROM file by sectors */
+#define FLASH_SECTOR_SIZE   4096
+#define FLASH_SECTOR_COUNT  (NOR_FLASH_SIZE_KB_MAX / FLASH_SECTOR_SIZE)
+
 /**
  * @file Emulation for the NOR Flash (SST39)
  */
 
+/**
+ * @brief User program written over the romdisk, kept so that a reset only patches the bytes that changed
+ */
+typedef struct {
+    char*       argument;       // User program argument, with the optional romdisk address
+    char*       path;
+    struct stat stat;           // Status of the file when it was last written to the flash
+    uint32_t    offset;         // Offset of the romdisk in the flash
+    uint32_t    length;         // Number of bytes written from the offset, romdisk header included
+    char        name[16];       // Name of the program in the romdisk
+    /* ROM content the program was written over */
+    uint8_t*    pristine;
+    uint32_t    pristine_size;
+} flash_romdisk_t;
+
 typedef struct {
     device_t parent;
     size_t size; // in bytes
-#if CONFIG_NOR_FLASH_DYNAMIC_ARRAY
+    /* In read-only mode, private mapping of the ROM file, the pages are shared with the other instances
+     * until modified */
     uint8_t* data;
-#else
-    uint8_t data[NOR_FLASH_SIZE_KB];
-#endif
+    bool mapped;
     int state;
     /* Byte being written to flash */
     uint8_t writing_byte;
@@ -36,13 +57,46 @@ typedef struct {
     int ticks_remaining;
     /* Flag set if any byte was changed (and needs write-back) */
     int dirty;
+    /* Sectors changed since the last write-back */
+    uint32_t dirty_sectors[FLASH_SECTOR_COUNT / 32];
+    /* The changed sectors are written back to this file once the flash has been idle for a while */
+    const char* file_name;
+    long sync_countdown;
+    /* The periodic write-backs are performed in the background through a cache of the ROM file */
+    int writer_fd;
+    disk_cache_t writer;
+    /* Never write the changes back to the ROM file */
+    bool readonly;
+    /* ROM file loaded in the flash and its status at that time, to know whether it must be read again */
+    char* rom_path;
+    struct stat rom_stat;
+    /* Set if the guest modified the flash since the ROM was loaded */
+    bool modified;
+    flash_romdisk_t romdisk;
 } flash_t;
 
 
-int flash_init(flash_t* flash);
+/**
+ * @param readonly Keep all the changes made to the flash in memory, the ROM file is never written
+ */
+int flash_init(flash_t* flash, bool readonly);
 
+/**
+ * @brief Advance the program/erase delays, the changed sectors are handed to the background writer
+ * once the flash has been idle for a while
+ */
 void flash_tick(flash_t* flash, int elapsed_tstates);
 
 int flash_load_from_file(flash_t* flash, const char* rom_filename, const char* userprog_filename);
 
+/**
+ * @brief Write the sectors changed since the last call back to the given ROM file, synchronously,
+ * after waiting for the background writer
+ */
 int flash_save_to_file(flash_t* flash, const char* name);
+
+/**
+ * @brief Wait for the background writer and free the ROM and user program information. The flash
+ * content remains, so it can still be saved with `flash_save_to_file`
+ */
+void flash_deinit(flash_t* flash);
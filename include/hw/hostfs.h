@@ -9,17 +9,33 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <limits.h>
 #include <dirent.h>
+#include <sys/stat.h>
 #include "hw/device.h"
 #include "hw/memory_op.h"
+#include "hw/hostfs_overlay.h"
 
 
 #define MAX_OPENED_FILES        256
 #define ZOS_MAX_NAME_LENGTH     16
+#define HOSTFS_GUEST_PATH_MAX   256
+#define HOSTFS_CACHE_ENTRIES    64
+#define HOSTFS_REQ_DATA_SIZE    (UINT16_MAX + 1)
+
+/* The WebAssembly build has no threads, all the operations are performed synchronously */
+#ifndef __EMSCRIPTEN__
+    #define HOSTFS_ASYNC_SUPPORT    1
+    #include <pthread.h>
+#endif
 
 
 typedef struct {
     uint8_t is_dir;
+    uint8_t is_overlay; /* The entry is served by the overlay, `node` or `listing` is valid */
+    uint8_t append;     /* Overlay files only, writes always happen at the end of the file */
     char    name[ZOS_MAX_NAME_LENGTH];
 #ifdef _WIN32
     /* On Windows, we cannot stat an opened directory, so keep the path */
@@ -28,19 +44,109 @@ typedef struct {
     union {
         FILE* file;
         DIR*  dir;
+        hostfs_ovl_node_t*    node;
+        hostfs_ovl_listing_t* listing;
         void* raw;
     };
 } hostfs_fd_t;
 
+typedef enum {
+    HOSTFS_CACHE_OFF   = 0, // Resolve and stat the paths on each operation
+    HOSTFS_CACHE_ON    = 1, // Cache the paths and their status, only the guest's own changes invalidate them
+    HOSTFS_CACHE_WATCH = 2, // Same, but changes made on the host invalidate them too (Linux only)
+} hostfs_cache_mode_t;
+
+/**
+ * @brief Path given by the guest, resolved and validated to be inside the root directory.
+ * The resolution only depends on the path itself so it never needs to be invalidated, the
+ * result of `stat` is valid as long as `stat_gen` is equal to the cache's one.
+ */
+typedef struct {
+    char*       key;
+    char*       path;
+    uint32_t    hash;
+    uint32_t    last_use;
+    uint32_t    stat_gen;
+    int         stat_ret;
+    struct stat st;
+} hostfs_cache_entry_t;
+
+typedef struct {
+    hostfs_cache_mode_t  mode;
+    bool                 cache_stat;
+    int                  watch_fd;
+    uint32_t             use_counter;
+    uint32_t             stat_gen;
+    hostfs_cache_entry_t entries[HOSTFS_CACHE_ENTRIES];
+} hostfs_cache_t;
+
+typedef enum {
+    HOSTFS_REQ_IDLE,
+    HOSTFS_REQ_QUEUED,
+    HOSTFS_REQ_DONE,
+} hostfs_req_state_t;
+
+/**
+ * @brief Operation being performed on the host. Everything the operation needs from the guest
+ * memory is gathered before it is started and its results are only copied to the guest memory
+ * once it is complete, so that the host side can run on a separate thread.
+ */
+typedef struct {
+    uint8_t  op;
+    uint8_t  status;
+    uint8_t  registers[6];  /* Input registers, updated with the output ones */
+    char     path[PATH_MAX];
+    hostfs_cache_entry_t* entry;    /* Cache entry of `path`, NULL if not cached */
+    int      desc;
+    long     offset;
+    uint16_t addr;          /* Guest address of the data to write back on completion */
+    uint16_t length;        /* Number of bytes in `data` */
+    uint8_t* data;          /* HOSTFS_REQ_DATA_SIZE bytes, committed as the transfers get bigger */
+} hostfs_req_t;
+
 typedef struct {
     device_t     parent;
     const char*  root_path;
     uint8_t      registers[16];
     hostfs_fd_t  descriptors[MAX_OPENED_FILES];
     const memory_op_t* host_ops;
+    hostfs_req_t req;
+    atomic_int   req_state;
+    /* Only accessed while preparing or performing an operation, never by two threads at once */
+    hostfs_cache_t cache;
+    hostfs_overlay_t overlay;
+    bool         async;
+#if HOSTFS_ASYNC_SUPPORT
+    pthread_t       worker;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    bool            quit;
+#endif
 } zeal_hostfs_t;
 
 
-int hostfs_init(zeal_hostfs_t* hostfs, const memory_op_t* ops);
+/**
+ * @brief Initialize the HostFS device.
+ *
+ * @param async When true, the host file operations are performed on a worker thread while the
+ *              status register reports ZOS_PENDING. Else, they are performed synchronously.
+ * @param cache Caching of the resolved paths and of their status
+ */
+int hostfs_init(zeal_hostfs_t* hostfs, const memory_op_t* ops, bool async, hostfs_cache_mode_t cache);
+
+/**
+ * @brief Keep all the modifications made by the guest in memory instead of writing them to the
+ * host directory, which only needs to be readable. Must be called before `hostfs_load_path`.
+ *
+ * @param export_path Optional tar archive (`.tar` extension) or directory to export the
+ *                    modifications to when the device is deinitialized, NULL to discard them.
+ */
+void hostfs_enable_overlay(zeal_hostfs_t* hostfs, const char* export_path);
 
 int hostfs_load_path(zeal_hostfs_t* hostfs, const char* root_path);
+
+/**
+ * @brief Wait for the pending operation, if any, stop the worker thread and free the cache.
+ * The overlay modifications are exported at that point, if requested.
+ */
+void hostfs_deinit(zeal_hostfs_t* hostfs);
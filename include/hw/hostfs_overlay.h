@@ -0,0 +1,138 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
+
+
+/**
+ * @brief The overlay keeps all the modifications made by the guest in memory, the host directory
+ * is only ever read. Files are stored as fixed-size chunks, the ones that were never written are
+ * read from the host file they replace, if any.
+ */
+#define HOSTFS_OVL_CHUNK_SIZE   4096
+
+typedef enum {
+    HOSTFS_OVL_FILE,
+    HOSTFS_OVL_DIR,
+    HOSTFS_OVL_WHITEOUT,    /* Hides the host entry at the same path, which was removed by the guest */
+} hostfs_ovl_type_t;
+
+typedef struct {
+    char*             path;         /* Resolved host path of the entry */
+    uint32_t          hash;
+    hostfs_ovl_type_t type;
+    bool              opaque;       /* Directory hiding the content of the host directory at the same path */
+    bool              detached;     /* Replaced or removed, only kept alive for the descriptors still using it */
+    int               refs;         /* Number of descriptors using the node */
+    FILE*             base;         /* Host file backing the chunks, kept open while the node is in use */
+    time_t            mtime;
+    uint32_t          size;
+    uint32_t          base_size;    /* Size of the host file backing the chunks not written yet */
+    uint32_t          chunk_count;
+    uint8_t**         chunks;       /* HOSTFS_OVL_CHUNK_SIZE bytes each, NULL when never written */
+} hostfs_ovl_node_t;
+
+typedef struct {
+    uint8_t is_file;
+    char*   name;
+} hostfs_ovl_dirent_t;
+
+/**
+ * @brief Snapshot of a directory content, merging the host entries and the overlay ones
+ */
+typedef struct {
+    char*               path;
+    int                 count;
+    int                 next;
+    hostfs_ovl_dirent_t entries[];
+} hostfs_ovl_listing_t;
+
+typedef struct {
+    bool                enabled;
+    const char*         export_path;
+    const char*         root_path;
+    hostfs_ovl_node_t** nodes;
+    int                 count;
+    int                 capacity;
+} hostfs_overlay_t;
+
+
+/**
+ * @brief Enable the overlay, all the modifications will be kept in memory.
+ *
+ * @param export_path Optional path to export the modifications to when the overlay is freed,
+ *                    a tar archive if it ends with `.tar`, a directory else. NULL to discard them.
+ */
+void hostfs_ovl_init(hostfs_overlay_t* ov, const char* export_path);
+
+/**
+ * @brief Set the root directory of the host file system, used to get the relative paths on export
+ */
+void hostfs_ovl_set_root(hostfs_overlay_t* ov, const char* root_path);
+
+/**
+ * @brief Export the modifications if requested and free the overlay
+ */
+void hostfs_ovl_deinit(hostfs_overlay_t* ov);
+
+/**
+ * @brief Get the overlay node for the given resolved path, NULL if the host entry is untouched
+ */
+hostfs_ovl_node_t* hostfs_ovl_find(hostfs_overlay_t* ov, const char* path);
+
+/**
+ * @brief Fill `st` with the status of the node, in the same way `stat` would.
+ *
+ * @returns 0 on success, -1 if the node is a whiteout
+ */
+int hostfs_ovl_stat(const hostfs_ovl_node_t* node, struct stat* st);
+
+/**
+ * @brief Create a file or a directory node, replacing any existing node at the same path.
+ *
+ * @param base_size For files, size of the host file to use as the initial content, 0 for an empty file.
+ * @param opaque For directories, whether the host directory at the same path must be hidden.
+ */
+hostfs_ovl_node_t* hostfs_ovl_create(hostfs_overlay_t* ov, const char* path, hostfs_ovl_type_t type,
+                                     uint32_t base_size, bool opaque);
+
+/**
+ * @brief Remove the entry at the given path.
+ *
+ * @param host_exists Whether the host has an entry at that path which must now be hidden.
+ */
+int hostfs_ovl_remove(hostfs_overlay_t* ov, const char* path, bool host_exists);
+
+/**
+ * @brief Mark the node as used by a descriptor, it remains valid until released
+ */
+void hostfs_ovl_acquire(hostfs_ovl_node_t* node);
+
+/**
+ * @brief Release a node acquired by a descriptor, a detached node is freed when its last
+ * descriptor is closed.
+ */
+void hostfs_ovl_release(hostfs_overlay_t* ov, hostfs_ovl_node_t* node);
+
+void hostfs_ovl_truncate(hostfs_ovl_node_t* node);
+
+uint32_t hostfs_ovl_read(hostfs_ovl_node_t* node, uint32_t offset, uint8_t* data, uint32_t length);
+
+uint32_t hostfs_ovl_write(hostfs_ovl_node_t* node, uint32_t offset, const uint8_t* data, uint32_t length);
+
+/**
+ * @brief List the content of the directory at `path`, NULL if it is not a visible directory
+ */
+hostfs_ovl_listing_t* hostfs_ovl_list(hostfs_overlay_t* ov, const char* path);
+
+void hostfs_ovl_listing_free(hostfs_ovl_listing_t* listing);
@@ -13,24 +13,38 @@
 #define AT24C512_ADDR    0x50
 #define AT24C512_SIZE    0x10000  // 64KB
 #define AT24C512_PAGE    128      // Page size: 128 bytes
+#define AT24C512_PAGES   (AT24C512_SIZE / AT24C512_PAGE)
 
 
 typedef struct at24c512_t {
     struct i2c_device_t parent;
-    uint8_t     data[AT24C512_SIZE];
+    uint8_t*    data;   // Committed by the host as the pages get written
     uint16_t    address;
     int         sector_written;
     int         count;
     bool        writing;
-    FILE*       file;
+    /* Image file, -1 if there is none or if the EEPROM is volatile */
+    int         fd;
+    /* Pages written since the last write-back, which happens once the EEPROM has been idle for a while */
+    uint32_t    dirty[AT24C512_PAGES / 32];
+    bool        dirty_any;
+    long        sync_countdown;
 } at24c512_t;
 
 
 /**
  * @brief Initialize the emulated EEPROM, if a file is passed, it will
  * be loaded inside the eeprom.
+ *
+ * @param is_volatile Never write the changes back to the file, they are lost at exit
+ */
+int at24c512_init(at24c512_t* eeprom, const char* filename, bool is_volatile);
+
+
+/**
+ * @brief Let the EEPROM know how much time has elapsed, used to write back the modified pages
  */
-int at24c512_init(at24c512_t* eeprom, const char* filename);
+void at24c512_tick(at24c512_t* eeprom, int elapsed_tstates);
 
 
 /**
@@ -8,12 +8,21 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 
 typedef struct {
     uint8_t (*read_byte)(void*, uint16_t);
     void (*write_byte)(void*, uint16_t, uint8_t);
     uint8_t (*phys_read_byte)(void*, uint32_t);
     void (*phys_write_byte)(void*, uint32_t, uint8_t);
+    /* Optional, get a host pointer to the virtual memory, see `memory_direct` */
+    uint8_t* (*direct)(void*, uint16_t, bool, uint32_t*);
+    /* Optional, get a host pointer to the physical memory, see `memory_phys_direct` */
+    uint8_t* (*phys_direct)(void*, uint32_t, bool, uint32_t*);
+    /* Optional, keep the CPU off the bus for the given number of T-states */
+    void (*bus_stall)(void*, unsigned long);
     void* opaque;
 } memory_op_t;
 
@@ -24,10 +33,38 @@ static inline uint8_t memory_read_byte(const memory_op_t* ops, uint16_t addr)
 }
 
 
+/**
+ * @brief Get a host pointer to the virtual memory at `addr`, for accesses without side effects.
+ *
+ * @param write Whether the returned pointer will be written to
+ * @param size Number of bytes requested, updated with the number of contiguous bytes reachable
+ *             from the returned pointer. The span never crosses a virtual page.
+ *
+ * @returns NULL if the memory cannot be accessed directly, the byte callbacks must be used in that case.
+ */
+static inline uint8_t* memory_direct(const memory_op_t* ops, uint16_t addr, bool write, uint32_t* size)
+{
+    if (ops->direct == NULL) {
+        return NULL;
+    }
+    return ops->direct(ops->opaque, addr, write, size);
+}
+
+
 static inline void memory_read_bytes(const memory_op_t* ops, uint16_t addr, uint8_t* values, size_t size)
 {
-    for (size_t i = 0; i < size; i++) {
-        values[i] = ops->read_byte(ops->opaque, addr + i);
+    while (size > 0) {
+        uint32_t count = size;
+        const uint8_t* src = memory_direct(ops, addr, false, &count);
+        if (src != NULL) {
+            memcpy(values, src, count);
+        } else {
+            values[0] = ops->read_byte(ops->opaque, addr);
+            count = 1;
+        }
+        addr += count;
+        values += count;
+        size -= count;
     }
 }
 
@@ -39,8 +76,18 @@ static inline void memory_write_byte(const memory_op_t* ops, uint16_t addr, uint
 
 static inline void memory_write_bytes(const memory_op_t* ops, uint16_t addr, uint8_t* values, size_t size)
 {
-    for (size_t i = 0; i < size; i++) {
-        ops->write_byte(ops->opaque, addr + i, values[i]);
+    while (size > 0) {
+        uint32_t count = size;
+        uint8_t* dst = memory_direct(ops, addr, true, &count);
+        if (dst != NULL) {
+            memcpy(dst, values, count);
+        } else {
+            ops->write_byte(ops->opaque, addr, values[0]);
+            count = 1;
+        }
+        addr += count;
+        values += count;
+        size -= count;
     }
 }
 
@@ -50,10 +97,37 @@ static inline uint8_t memory_phys_read_byte(const memory_op_t* ops, uint32_t add
     return ops->phys_read_byte(ops->opaque, addr);
 }
 
+/**
+ * @brief Get a host pointer to the physical memory at `addr`, for accesses without side effects.
+ *
+ * @param write Whether the returned pointer will be written to
+ * @param size Number of bytes requested, updated with the number of contiguous bytes reachable
+ *             from the returned pointer. The span never crosses a physical page.
+ *
+ * @returns NULL if the memory cannot be accessed directly, the byte callbacks must be used in that case.
+ */
+static inline uint8_t* memory_phys_direct(const memory_op_t* ops, uint32_t addr, bool write, uint32_t* size)
+{
+    if (ops->phys_direct == NULL) {
+        return NULL;
+    }
+    return ops->phys_direct(ops->opaque, addr, write, size);
+}
+
 static inline void memory_phys_read_bytes(const memory_op_t* ops, uint32_t addr, uint8_t* values, size_t size)
 {
-    for (size_t i = 0; i < size; i++) {
-        values[i] = ops->phys_read_byte(ops->opaque, addr + i);
+    while (size > 0) {
+        uint32_t count = size;
+        const uint8_t* src = memory_phys_direct(ops, addr, false, &count);
+        if (src != NULL) {
+            memcpy(values, src, count);
+        } else {
+            values[0] = ops->phys_read_byte(ops->opaque, addr);
+            count = 1;
+        }
+        addr += count;
+        values += count;
+        size -= count;
     }
 }
 
@@ -64,7 +138,28 @@ static inline void memory_phys_write_byte(const memory_op_t* ops, uint32_t addr,
 
 static inline void memory_phys_write_bytes(const memory_op_t* ops, uint32_t addr, uint8_t* values, size_t size)
 {
-    for (size_t i = 0; i < size; i++) {
-        ops->phys_write_byte(ops->opaque, addr + i, values[i]);
+    while (size > 0) {
+        uint32_t count = size;
+        uint8_t* dst = memory_phys_direct(ops, addr, true, &count);
+        if (dst != NULL) {
+            memcpy(dst, values, count);
+        } else {
+            ops->phys_write_byte(ops->opaque, addr, values[0]);
+            count = 1;
+        }
+        addr += count;
+        values += count;
+        size -= count;
+    }
+}
+
+
+/**
+ * @brief Used by bus masters (DMA) to account for the time the CPU had to wait for the bus
+ */
+static inline void memory_bus_stall(const memory_op_t* ops, unsigned long tstates)
+{
+    if (ops->bus_stall != NULL) {
+        ops->bus_stall(ops->opaque, tstates);
     }
 }
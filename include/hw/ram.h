@@ -19,11 +19,7 @@
 typedef struct {
         device_t parent;
         size_t size; // in bytes
-#if CONFIG_RAM_DYNAMIC_ARRAY
-        uint8_t* data;
-#else
-        uint8_t data[RAM_SIZE_KB];
-#endif
+        uint8_t* data; // Committed by the host as the pages get written
 } ram_t;
 
 int ram_init(ram_t *);
@@ -21,6 +21,10 @@ struct z80 {
     void (*write_byte)(void*, uint16_t, uint8_t);
     uint8_t (*port_in)(void*, uint16_t);
     void (*port_out)(void*, uint16_t, uint8_t);
+    // optional, used by INIR/OTIR to transfer up to `count` bytes between a port and the memory at `addr`
+    // at once, returns the number of bytes transferred, 0 to fall back to one byte per iteration
+    unsigned (*port_in_block)(void*, uint16_t port, uint16_t addr, unsigned count);
+    unsigned (*port_out_block)(void*, uint16_t port, uint16_t addr, unsigned count);
     void* userdata;
 
     unsigned long cyc; // cycle count (t-states)
@@ -24,6 +24,7 @@
 #include "hw/compactflash.h"
 #include "hw/semihost.h"
 #include "utils/config.h"
+#include "utils/frameskip.h"
 #include "debugger/debugger_ui.h"
 #include "hw/userport/snes_adapter.h"
 
@@ -94,6 +95,7 @@ struct zeal_t {
 
     /* Renderer */
     RenderTexture2D  zvb_out;
+    frameskip_t      frameskip;
     bool headless;
     bool should_exit;
 
@@ -106,6 +108,7 @@ struct zeal_t {
     dbg_state_t      dbg_state;
     dbg_t            dbg;
     struct dbg_ui_t* dbg_ui;
+    double           dbg_vram_refresh;  // Time of the last VRAM debug views refresh
     uint8_t        (*dbg_read_memory)(struct zeal_t*, hwaddr addr);
 #endif
 };
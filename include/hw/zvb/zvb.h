@@ -32,6 +32,18 @@
 #define ZVB_MAX_RES_WIDTH   640
 #define ZVB_MAX_RES_HEIGHT  480
 
+/**
+ * @brief The video board occupies 128KB of memory, decoded by blocks of 256 bytes
+ */
+#define ZVB_MEM_SIZE        (128 * 1024)
+#define ZVB_MEM_BLOCK_SIZE  256
+#define ZVB_MEM_BLOCK_COUNT (ZVB_MEM_SIZE / ZVB_MEM_BLOCK_SIZE)
+
+/**
+ * @brief Bitmap value for a debug view (any `DBG_*` value from `dbg_vram_t`)
+ */
+#define ZVB_DBG_VIEW(view)  (1U << (view))
+
 /**
  * @brief Width and height for the debug textures, account for the grid of 1px
  */
@@ -86,6 +98,13 @@
 #define STATE_VBLANK        1
 #define STATE_COUNT         2
 
+/**
+ * @brief Time spent by the raster in the visible area and in V-blank, in microseconds
+ */
+#define ZVB_VISIBLE_US          15253
+#define ZVB_VBLANK_US           1430
+#define ZVB_FRAME_US            (ZVB_VISIBLE_US + ZVB_VBLANK_US)
+
 
 /**
  * @brief Macros listing of all the objects in the shaders
@@ -185,9 +204,27 @@ typedef struct {
 typedef struct {
     bool flipped_y;
     bool rendering_enabled;
+    /* Adjust the audio playback rate to follow the emulation speed */
+    bool audio_sync;
+    /* When not NULL, the audio is rendered from emulated time to this WAV file instead of the audio device */
+    const char* audio_output;
+    /* Optional file receiving a checksum of each emulated second of rendered audio */
+    const char* audio_sums;
 } zvb_config_t;
 
 
+/**
+ * @brief Entry of the memory decoding table, describes a 256-byte block of the memory window
+ */
+typedef struct {
+    /* Pointers to the data backing the block, NULL if the accesses have side effects */
+    uint8_t* rd;
+    uint8_t* wr;
+    /* Sub-block the block belongs to, used for the accesses that have side effects */
+    uint8_t  region;
+} zvb_mem_block_t;
+
+
 typedef struct {
     device_t         parent;
     zvb_video_mode_t mode;
@@ -204,6 +241,11 @@ typedef struct {
     zvb_sound_t      sound;
     zvb_dma_t        dma;
 
+    /* Memory decoding table, one entry per 256-byte block */
+    zvb_mem_block_t  mem_blocks[ZVB_MEM_BLOCK_COUNT];
+    /* Bitmap of the blocks written through a direct pointer, sub-blocks are notified before rendering */
+    uint32_t         dirty_blocks[ZVB_MEM_BLOCK_COUNT / 32];
+
     /* Internally used to make the shader work on the whole screen */
     zvb_shader_t     shaders[SHADERS_COUNT];
     RenderTexture    tex_dummy;
@@ -219,6 +261,13 @@ typedef struct {
     long             tstates_counter;
     bool             need_render;
     bool             rendering_enabled;
+    /* Incremented on each change that affects the output (VRAM, registers, cursor blink).
+     * When it didn't change since the last render, the previous frame can be presented as-is. */
+    uint32_t         generation;
+    uint32_t         rendered_generation;
+    /* Generation of the debug textures and bitmap of the views rendered for that generation */
+    uint32_t         debug_generation;
+    uint32_t         debug_views;
     /* When rendering to the screen directly, Y must be flipped,
      * But when rendering to a texture (debugger UI), it must not be*/
     bool             flipped_y;
@@ -243,6 +292,32 @@ static inline bool zvb_is_text_mode(const zvb_t* zvb)
     return zvb->mode == MODE_TEXT_640 || zvb->mode == MODE_TEXT_320;
 }
 
+/**
+ * @brief Check whether the video board content changed since the last call to `zvb_render`.
+ * If it didn't, the previously rendered frame is still valid and doesn't need to be rendered again.
+ */
+static inline bool zvb_content_changed(const zvb_t* zvb)
+{
+    return zvb->generation != zvb->rendered_generation;
+}
+
+/**
+ * @brief Check whether a frame is ready to be prepared and rendered (display reached refresh state)
+ */
+static inline bool zvb_frame_ready(const zvb_t* zvb)
+{
+    return zvb->rendering_enabled && zvb->need_render;
+}
+
+/**
+ * @brief Drop the current frame: the textures are not updated and nothing is rendered.
+ * The changes will be taken into account by the next rendered frame.
+ */
+static inline void zvb_skip_frame(zvb_t* zvb)
+{
+    zvb->need_render = false;
+}
+
 /**
  * @brief Initialize the video board
  *
@@ -256,14 +331,15 @@ int zvb_init(zvb_t* zvb, const zvb_config_t* config, const memory_op_t* ops);
  * @brief Function to call to let the video board be aware of how many
  * interrupts have elapsed.
  */
-void zvb_tick(zvb_t* zvb, const int tstates);
+void zvb_tick(zvb_t* zvb, int tstates);
 
 
 /**
  * @brief Prepare the rendering, this will update the textures and images.
  * Must be called before `zvb_render`!
  *
- * @returns true if ZVB is ready to render (display reached refresh state), false else
+ * @returns true if ZVB is ready to render (display reached refresh state), false else.
+ *          `zvb_content_changed` tells whether the frame really needs to be rendered again.
  */
 bool zvb_prepare_render(zvb_t* zvb);
 
@@ -287,9 +363,12 @@ void zvb_deinit(zvb_t* zvb);
 
 
 /**
- * @brief Render the current VRAM state in the debug textures, must be called after `render` function
+ * @brief Render the current VRAM state in the debug textures, must be called after `render` function.
+ * Views that are already up to date with the VRAM content are not rendered again.
+ *
+ * @param views Bitmap of the views to render, made of `ZVB_DBG_VIEW(DBG_*)` values
  */
-void zvb_render_debug_textures(zvb_t* zvb);
+void zvb_render_debug_textures(zvb_t* zvb, uint32_t views);
 
 
 /**
@@ -9,6 +9,7 @@
 
 #include <stdint.h>
 #include "hw/memory_op.h"
+#include "hw/zvb/zvb_sound.h"
 
 /**
  * @brief I/O registers address, relative to the controller
@@ -20,6 +21,8 @@
 #define DMA_REG_CLK_DIV    0x9
 
 #define DMA_CTRL_START     0x80
+/* Read: a descriptor is being streamed to the sound FIFO, write: abort the streaming */
+#define DMA_CTRL_STREAM    0x40
 
 #define DMA_OP_INC  0
 #define DMA_OP_DEC  1
@@ -41,7 +44,9 @@ typedef union {
         uint8_t last  : 1;
         uint8_t rd_op : 2;
         uint8_t wr_op : 2;
-        uint8_t rsd   : 3;
+        /* Destination is the sample table FIFO, `wr_addr` and `wr_op` are ignored */
+        uint8_t sound : 1;
+        uint8_t rsd   : 2;
     };
     uint8_t raw;
 } dma_flags_t;
@@ -73,17 +78,31 @@ typedef struct {
         };
         uint32_t desc_addr;
     };
-    /* Clock divider for all the transfers */
+    /* Clock divider for all the transfers, in CPU T-states per read and write */
     zvb_dma_clk_t      clk;
     /* Machine operations for mmeory read and write */
     const memory_op_t* ops;
+    /* Descriptor being streamed to the sound FIFO, in the background, as the FIFO empties */
+    zvb_dma_descriptor_t stream;
+    bool               streaming;
+    zvb_sound_t*       sound;
 } zvb_dma_t;
 
 
 /**
  * @brief Initialize the DMA controller
  */
-void zvb_dma_init(zvb_dma_t* dma, const memory_op_t* ops);
+void zvb_dma_init(zvb_dma_t* dma, const memory_op_t* ops, zvb_sound_t* sound);
+
+
+/**
+ * @brief Make the emulated time advance for the DMA controller, feeds the sound FIFO when streaming.
+ * The CPU is stalled while the DMA holds the bus, since this happens between two instructions,
+ * the caller must account for the returned T-states itself.
+ *
+ * @returns Number of T-states the CPU has been stalled for
+ */
+unsigned long zvb_dma_tick(zvb_dma_t* dma);
 
 
 /**
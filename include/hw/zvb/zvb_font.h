@@ -31,6 +31,9 @@ typedef struct {
     Image   img_font;
     Texture tex_font;
     int     dirty;
+    /* Characters (included) that were modified since the last upload */
+    int     dirty_min;
+    int     dirty_max;
 } zvb_font_t;
 
 
@@ -64,6 +67,15 @@ void zvb_font_write(zvb_font_t* font, uint32_t addr, uint8_t data);
 uint8_t zvb_font_read(zvb_font_t* font, uint32_t addr);
 
 
+/**
+ * @brief Mark a range of the font as modified, to call after accessing `raw_font` directly.
+ *
+ * @param from First address modified, relative to the font address space.
+ * @param to Address following the last byte modified.
+ */
+void zvb_font_mark_dirty(zvb_font_t* font, uint32_t from, uint32_t to);
+
+
 /**
  * @brief Update the font renderer, needs to be called before starting drawing anything on screen.
  */
@@ -11,6 +11,8 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 #include "raylib.h"
+#include "utils/helpers.h"
+#include "utils/wav.h"
 
 #define VOICE_COUNT      4
 #define SAMPLE_RATE      44091
@@ -65,17 +67,17 @@ typedef struct {
     /* Internal values, unrelated to the registers */
     float volume;
     unsigned int phase;
+    uint32_t lfsr;  // Noise generator state
 } zvb_voice_t;
 
 
+/**
+ * @brief Sample table FIFO, shared between the emulation thread (producer) and the audio thread (consumer)
+ */
 typedef struct {
-    bool hold;
-    int divider;
-    int config;
-    bool is_u8;
-    bool is_signed;
-    /* FIFO-related */
+    /* Only modified by the emulation thread */
     int fifo_head;
+    /* Only modified by the audio thread */
     int fifo_tail;
     atomic_int fifo_bytes;
     uint8_t fifo[SAMPLE_FIFO_SIZE];
@@ -84,6 +86,10 @@ typedef struct {
 } zvb_sample_table_t;
 
 
+/**
+ * @brief State of the sound registers. The emulation thread and the audio thread each have their own copy,
+ * the latter is updated by replaying the register writes at the right time.
+ */
 typedef struct {
     zvb_voice_t        voices[VOICE_COUNT];
     uint_fast8_t       hold_voices;
@@ -91,20 +97,149 @@ typedef struct {
     uint_fast8_t       left_voices;
     uint_fast8_t       right_voices;
     uint_fast8_t       master_volume;
-    zvb_sample_table_t sample_table;
-    /* RayLib's audio stream */
-    AudioStream        stream;
+    /* Sample table configuration */
+    bool               table_hold;
+    int                table_divider;
+    int                table_config;
+    bool               table_u8;
+    bool               table_signed;
     /* Volume interpreted from the master_volume register */
     float              left_volume;
     float              right_volume;
+} zvb_sound_regs_t;
+
+
+/**
+ * @brief Size of the register writes queue, must be a power of two
+ */
+#define SOUND_QUEUE_SIZE    8192
+
+/**
+ * @brief Special port used to tell the audio thread that the controller was reset
+ */
+#define SOUND_EVENT_RESET   0xffff
+
+typedef struct {
+    unsigned long cycle;    // T-state at which the write occurred
+    uint16_t      port;
+    uint16_t      value;
+} zvb_sound_event_t;
+
+
+/**
+ * @brief Lock-free single-producer single-consumer queue of register writes
+ */
+typedef struct {
+    zvb_sound_event_t* events;  /* SOUND_QUEUE_SIZE entries, committed as the queue fills up */
+    /* Free-running indexes, `head` is only modified by the emulation thread, `tail` by the audio thread */
+    atomic_uint       head;
+    atomic_uint       tail;
+    unsigned int      dropped;
+} zvb_sound_queue_t;
+
+
+/**
+ * @brief The audio thread plays the register writes with a fixed delay behind the emulation, large enough
+ * to absorb the emulation running a whole video frame at once. If the two timelines drift further than
+ * the resync threshold, the audio timeline jumps back to the target delay.
+ */
+#define SOUND_LATENCY_CYCLES    (2 * CPUFREQ / 60)
+#define SOUND_RESYNC_CYCLES     (2 * CPUFREQ / 60)
+#define SOUND_CYCLES_PER_SAMPLE ((double) CPUFREQ / SAMPLE_RATE)
+
+/**
+ * @brief With the rate control enabled, the audio thread consumes the emulated time up to 0.5% faster
+ * or slower than nominal, to keep the latency at SOUND_LATENCY_CYCLES when the emulation doesn't run
+ * exactly at the expected speed (refresh rate of the monitor, host too slow, ...).
+ */
+#define SOUND_RATE_ADJUST       0.005
+
+
+typedef struct {
+    wav_writer_t  wav;
+    /* Optional file receiving the FNV-1a hash of each emulated second of audio */
+    FILE*         sums;
+    uint32_t      sum;
+    uint32_t      sum_frames;
+    unsigned long second;
+    /* Emulated T-states at which the next samples will be rendered */
+    unsigned long next_render;
+} zvb_sound_recorder_t;
+
+
+/**
+ * @brief Audio synchronization state, owned by the audio thread
+ */
+typedef struct {
+    bool         rate_control;
+    /* Emulated T-states consumed per sample, adjusted around SOUND_CYCLES_PER_SAMPLE */
+    double       cycles_per_sample;
+    /* Low-pass filtered distance between the emulation and the audio thread, in T-states */
+    double       fill;
+    /* Statistics published for the emulation thread */
+    atomic_uint  fill_us;
+    atomic_int   rate_ppm;
+    atomic_uint  underruns;
+    atomic_uint  overruns;
+} zvb_sound_sync_t;
+
+
+/**
+ * @brief Snapshot of the audio synchronization statistics
+ */
+typedef struct {
+    /* Amount of emulated time buffered ahead of the audio output, and its target */
+    unsigned int fill_us;
+    unsigned int target_us;
+    /* Current deviation from the nominal playback rate, in parts per million */
+    int          rate_ppm;
+    /* Number of times the audio output caught up with the emulation, or fell too far behind it */
+    unsigned int underruns;
+    unsigned int overruns;
+} zvb_sound_stats_t;
+
+
+typedef struct {
+    /* Registers as seen by the emulated CPU */
+    zvb_sound_regs_t   regs;
+    /* Registers as seen by the audio thread, at the position of the sample being generated */
+    zvb_sound_regs_t   synth;
+    zvb_sample_table_t sample_table;
+    zvb_sound_queue_t  queue;
+    /* Emulated T-states elapsed, used to stamp the register writes */
+    unsigned long      cycles;
+    atomic_ulong       emu_cycles;
+    /* Position of the audio thread on the emulation timeline */
+    double             audio_cycles;
+    zvb_sound_sync_t   sync;
+    /* RayLib's audio stream */
+    AudioStream        stream;
+    /* Offline rendering to a file, driven by the emulated time instead of the audio device */
+    zvb_sound_recorder_t recorder;
     bool               enabled;
+    bool               offline;
 } zvb_sound_t;
 
 
 /**
  * @brief Initialize the sound controller
+ *
+ * @param enabled Open the audio device and generate the samples
+ * @param rate_control Adjust the playback rate to keep a constant latency behind the emulation
+ */
+void zvb_sound_init(zvb_sound_t* sound, bool enabled, bool rate_control);
+
+
+/**
+ * @brief Initialize the sound controller to render the audio to a WAV file instead of the audio device.
+ * The samples are generated from the emulated time, so the output doesn't depend on the host speed.
+ *
+ * @param wav_path Path of the WAV file to create
+ * @param sums_path Optional path of the file receiving a checksum of each emulated second, can be NULL
+ *
+ * @returns 0 on success, -1 on error
  */
-void zvb_sound_init(zvb_sound_t* sound, bool enabled);
+int zvb_sound_init_offline(zvb_sound_t* sound, const char* wav_path, const char* sums_path);
 
 
 /**
@@ -130,6 +265,35 @@ uint8_t zvb_sound_read(zvb_sound_t* sound, uint32_t port);
 void zvb_sound_write(zvb_sound_t* sound, uint32_t port, uint8_t value);
 
 
+/**
+ * @brief Get the number of bytes the sample table FIFO can accept, 0 when the sample table is disabled
+ */
+uint32_t zvb_sound_fifo_room(const zvb_sound_t* sound);
+
+
+/**
+ * @brief Push bytes to the sample table FIFO without going through the I/O registers, used by the DMA.
+ * The bytes that don't fit in the FIFO are ignored.
+ *
+ * @returns Number of bytes accepted
+ */
+uint32_t zvb_sound_fifo_push(zvb_sound_t* sound, const uint8_t* data, uint32_t count);
+
+
+/**
+ * @brief Make the emulated time advance for the sound controller.
+ *
+ * @param tstates Number of T-states elapsed since the last call
+ */
+void zvb_sound_tick(zvb_sound_t* sound, int tstates);
+
+
+/**
+ * @brief Get the audio synchronization statistics, all zeros if the audio device is not used.
+ */
+void zvb_sound_get_stats(zvb_sound_t* sound, zvb_sound_stats_t* stats);
+
+
 /**
  * @brief Deinitialize the sound controller
  */
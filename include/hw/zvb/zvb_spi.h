@@ -8,11 +8,18 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "hw/disk_cow.h"
+#include "hw/disk_cache.h"
 
 #define SPI_RAM_LEN     8
 #define SPI_VERSION     1
 
-#define TF_DATA_TOKEN   0xFE
+#define TF_DATA_TOKEN       0xFE
+/* Tokens used by the WRITE_MULTIPLE_BLOCK command, before each block and to end the transfer */
+#define TF_DATA_TOKEN_MUL   0xFC
+#define TF_STOP_TOKEN       0xFD
 
 /**
  * @brief I/O registers address, relative to the controller
@@ -64,16 +71,19 @@ typedef enum {
     TF_IDLE,
     TF_CMD55_RECEIVED,
     TF_READ_BLOCK,
+    TF_READ_MULTIPLE,
     TF_WRITE_BLOCK_WAIT_TOK,
     TF_WRITE_BLOCK,
     TF_WRITE_BLOCK_SEND_RESP,
+    TF_WRITE_STOP,
 } zvb_tf_state_t;
 
 
 static inline int zvb_tf_is_write(zvb_tf_state_t st) {
     return st == TF_WRITE_BLOCK_WAIT_TOK ||
            st == TF_WRITE_BLOCK ||
-           st == TF_WRITE_BLOCK_SEND_RESP;
+           st == TF_WRITE_BLOCK_SEND_RESP ||
+           st == TF_WRITE_STOP;
 }
 
 
@@ -82,8 +92,25 @@ static inline int zvb_tf_is_write(zvb_tf_state_t st) {
  */
 typedef struct {
     zvb_tf_state_t  state;
-    FILE*           img;
+    /* Content of the image mapped in memory, NULL if it couldn't be mapped, the blocks then go through the cache */
+    uint8_t*        img;
     size_t          img_size;
+    int             fd;
+    bool            loaded;
+    /* The modified blocks are written back once the card has been idle for a while */
+    disk_cache_t    cache;
+    bool            dirty;
+    long            sync_countdown;
+    /* When enabled, the image is only read and the written blocks are kept in a delta */
+    bool            copy_on_write;
+    disk_cow_t      cow;
+    /* Block read when it can't be accessed in place */
+    uint8_t         buffer[DISK_COW_SECTOR_SIZE];
+    /* Next block to transfer for the multiple block commands */
+    uint32_t        block;
+    bool            multiple;
+    /* The last block received could not be written */
+    bool            write_error;
     /* Managed by the SPI controller */
     uint8_t         reply[1024];
     int             reply_idx;
@@ -126,6 +153,12 @@ void zvb_spi_reset(zvb_spi_t* spi);
 void zvb_spi_write(zvb_spi_t* spi, uint32_t addr, uint8_t value);
 
 
+/**
+ * @brief Let the controller know how much time has elapsed, used to write back the TF card blocks
+ */
+void zvb_spi_tick(zvb_spi_t* spi, int tstates);
+
+
 /**
  * @brief Function to call when a read occurs on the SPI I/O controller.
  *
@@ -137,6 +170,18 @@ uint8_t zvb_spi_read(zvb_spi_t* spi, uint32_t addr);
 /**
  * @brief Load an image for the TF card
  *
+ * @param delta When not NULL, keep the written blocks in this delta file, the image is only read
+ * @param discard Never write the modifications to any file, they are lost at exit
+ * @param durability When the written back blocks must reach the disk
+ * @param async Write the blocks back from a background thread
+ *
  * @return 0 on success, 1 in case of error
  */
-int zvb_spi_load_tf_image(zvb_spi_t* spi, const char* filename);
+int zvb_spi_load_tf_image(zvb_spi_t* spi, const char* filename, const char* delta, bool discard,
+                          disk_durability_t durability, bool async);
+
+
+/**
+ * @brief Write the modified blocks back to the TF card image and close it
+ */
+void zvb_spi_deinit(zvb_spi_t* spi);
@@ -50,32 +50,19 @@ typedef struct {
 _Static_assert(sizeof(zvb_sprite_t) == 8, "Sprite structure must have a size of 8 bytes");
 
 
-/**
- * @brief Sprite type where each entry is a float (for the texture)
- */
-typedef struct {
-    float x;
-    float y;
-    float tile_number;
-    float palette;
-    float f_behind_fg;
-    float f_flip_y;
-    float f_flip_x;
-    float f_height_32;
-} zvb_fsprite_t;
-
-
 /**
  * @brief Define all the sprites in the system.
  */
 typedef struct {
     zvb_sprite_t    data[ZVB_SPRITES_COUNT];
-    zvb_fsprite_t   fdata[ZVB_SPRITES_COUNT];
     int             wr_latch;
-    /* Make rendering faster by using an Image and a Texture for both layers */
+    /* The raw sprites are transferred as-is to the GPU, 8 bytes per sprite, so 2 RGBA8 pixels */
     Image           img_sprites;
     Texture         tex_sprites;
     int             dirty;
+    /* Sprites (included) that were modified since the last upload */
+    int             dirty_min;
+    int             dirty_max;
 } zvb_sprites_t;
 
 
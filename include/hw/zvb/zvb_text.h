@@ -139,7 +139,15 @@ uint8_t zvb_text_read(zvb_text_t* text, uint32_t addr);
 
 
 /**
- * @brief Update the text, must be called once per frame. The info structure will be filled.
+ * @brief Function to call at each V-blank, makes the cursor blink.
+ *
+ * @returns true if the cursor visibility changed, false else.
+ */
+bool zvb_text_vblank(zvb_text_t* text);
+
+
+/**
+ * @brief Get the current cursor and scroll state, the info structure will be filled.
  *
  * @returns true if the cursor is shown, false else.
  */
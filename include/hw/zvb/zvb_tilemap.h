@@ -25,6 +25,9 @@ typedef struct {
     Image   img_tilemap;
     Texture tex_tilemap;
     int     dirty;
+    /* Entries of the image (included) that were modified since the last upload */
+    int     dirty_min;
+    int     dirty_max;
 } zvb_tilemap_t;
 
 
@@ -62,6 +65,15 @@ void zvb_tilemap_write(zvb_tilemap_t* tilemap, int layer, uint32_t addr, uint8_t
 uint8_t zvb_tilemap_read(zvb_tilemap_t* tilemap, int layer, uint32_t addr);
 
 
+/**
+ * @brief Mark a range of entries as modified in both layers, to call after accessing the raw layers directly.
+ *
+ * @param from First entry modified.
+ * @param to Entry following the last one modified.
+ */
+void zvb_tilemap_mark_dirty(zvb_tilemap_t* tilemap, uint32_t from, uint32_t to);
+
+
 /**
  * @brief Update the tilemap renderer, needs to be called before starting drawing anything on screen.
  */
@@ -16,14 +16,23 @@
  */
 #define ZVB_TILESET_SIZE        (65536)
 
+/**
+ * @brief Dimensions of the tileset image, each pixel holds 4 bytes of the tileset
+ */
+#define ZVB_TILESET_IMG_WIDTH   (64)
+#define ZVB_TILESET_IMG_HEIGHT  (256)
+
 
 typedef struct {
-    /* Raw arrays representing the tileset in VRAM */
-    uint8_t raw[ZVB_TILESET_SIZE];
-    /* Make rendering faster by using an Image and a Texture for the tileset */
+    /* Raw array representing the tileset in VRAM, its pages are only committed once written */
+    uint8_t* raw;
+    /* Make rendering faster by using an Image and a Texture for the tileset, the image data is `raw` */
     Image   img_tileset;
     Texture tex_tileset;
     int     dirty;
+    /* Rows of the image (included) that were modified since the last upload */
+    int     dirty_min_row;
+    int     dirty_max_row;
 } zvb_tileset_t;
 
 
@@ -39,8 +48,10 @@ static inline Texture* zvb_tileset_texture(zvb_tileset_t* tileset)
 
 /**
  * @brief Initialize the tileset, must be called before using it.
+ *
+ * @returns 0 on success, -1 if the tileset could not be allocated
  */
-void zvb_tileset_init(zvb_tileset_t* tileset, bool rendering_enabled);
+int zvb_tileset_init(zvb_tileset_t* tileset, bool rendering_enabled);
 
 
 /**
@@ -61,6 +72,15 @@ void zvb_tileset_write(zvb_tileset_t* tileset, uint32_t addr, uint8_t data);
 uint8_t zvb_tileset_read(zvb_tileset_t* tileset, uint32_t addr);
 
 
+/**
+ * @brief Mark a range of the tileset as modified, to call after accessing `raw` directly.
+ *
+ * @param from First address modified, relative to the tileset address space.
+ * @param to Address following the last byte modified.
+ */
+void zvb_tileset_mark_dirty(zvb_tileset_t* tileset, uint32_t from, uint32_t to);
+
+
 /**
  * @brief Update the tileset renderer, needs to be called before starting drawing anything on screen.
  */
@@ -38,6 +38,7 @@ typedef struct {
 
     bool keyboard_passthru; // whether to pass all keypresses through to emulator
     bool hex_upper;
+    int vram_refresh_rate;  // VRAM views refresh rate in Hz while running, 0 for every frame
 
     int width;
     int height;
@@ -47,8 +48,20 @@ typedef struct {
 
 typedef struct {
     int volume;
+    bool sync;  // Slightly adjust the audio rate to keep a constant latency behind the emulation
 } config_audio_t;
 
+typedef struct {
+    int frameskip;  // Any of the FRAMESKIP_* values or number of frames to skip
+} config_video_t;
+
+typedef struct {
+    int cf_sync;        // Any of the CF_SYNC_* values
+    int cf_sync_period; // Delay in milliseconds of emulated time for the idle and periodic syncs
+    int hostfs_cache;   // Any of the HOSTFS_CACHE_* values
+    int disk_durability; // Any of the DISK_DURABILITY_* values, for the CompactFlash and TF images
+} config_storage_t;
+
 typedef struct {
     const char* config_path;
     const char* rom_filename;
@@ -59,8 +72,18 @@ typedef struct {
     const char* hostfs_path;
     const char* map_file;
     const char* breakpoints;
+    const char* frameskip;
+    const char* wav_filename;
+    const char* wav_sums_filename;
+    const char* hostfs_export;
+    const char* cf_delta;
+    const char* tf_delta;
     unsigned long headless_run_ticks;
     bool headless;
+    bool hostfs_overlay;
+    bool discard_disks;
+    bool rom_readonly;
+    bool eeprom_volatile;
     bool config_save;
     uint8_t verbose;
     bool no_reset;
@@ -68,6 +91,8 @@ typedef struct {
 
 typedef struct {
     config_audio_t audio;
+    config_video_t video;
+    config_storage_t storage;
     config_debugger_t debugger;
     config_window_t window; // main window options
     config_arguments_t arguments;
@@ -0,0 +1,71 @@
+/*
+ * SPDX-FileCopyrightText: 2026 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * @brief Frame skipping modes, any positive value is the maximum number of consecutive frames
+ * to skip when the host is too slow.
+ */
+#define FRAMESKIP_AUTO      (-1)
+#define FRAMESKIP_OFF       (0)
+/* Returned by the parser for an invalid mode */
+#define FRAMESKIP_INVALID   (-2)
+
+/**
+ * @brief Maximum number of consecutive frames that can be skipped, in any mode
+ */
+#define FRAMESKIP_MAX       (8)
+
+
+typedef struct {
+    int    mode;
+    /* Duration of an emulated frame, in seconds */
+    double period;
+    /* Host time of the previous frame */
+    double last_time;
+    /* Host time the emulation is behind of, in seconds */
+    double lag;
+    int    consecutive;
+    /* Statistics, skipped frames during the last second */
+    double stats_start;
+    int    stats_count;
+    int    skipped_per_sec;
+} frameskip_t;
+
+
+/**
+ * @brief Initialize the frame skipping policy.
+ *
+ * @param mode FRAMESKIP_AUTO, FRAMESKIP_OFF or the number of frames to skip.
+ * @param period Duration of an emulated frame, in seconds.
+ */
+void frameskip_init(frameskip_t* fs, int mode, double period);
+
+
+/**
+ * @brief Function to call each time an emulated frame is ready to be rendered.
+ *
+ * @returns true if the frame must be skipped (not prepared, rendered nor presented), false else.
+ */
+bool frameskip_next(frameskip_t* fs);
+
+
+/**
+ * @brief Parse a frame skipping mode from a string: "auto", "off" or a number.
+ *
+ * @returns the mode, FRAMESKIP_INVALID if the string is invalid.
+ */
+int frameskip_parse(const char* str);
+
+
+/**
+ * @brief Get a short description of the frame skipping state, used in the FPS overlay.
+ */
+const char* frameskip_describe(const frameskip_t* fs);
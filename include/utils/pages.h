@@ -0,0 +1,24 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+
+
+/**
+ * @brief Allocate a zero-filled memory area whose pages are only committed by the host when they are
+ * first written. Used for the large emulated memories, most programs only ever touch a few pages of them.
+ *
+ * @returns the area, NULL on error
+ */
+void* pages_alloc(size_t size);
+
+/**
+ * @brief Release an area allocated with `pages_alloc`
+ */
+void pages_free(void* pages, size_t size);
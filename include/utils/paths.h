@@ -40,15 +40,38 @@
 
 
 #ifdef _WIN32
+#include <io.h>
+#include <sys/types.h>
+
 static inline int os_mkdir(const char* path, int mode) {
     (void) mode;
     extern int mkdir(const char*);
     return mkdir(path);
 }
 
+/* Windows has no positional I/O, the descriptors passed are never shared between threads */
+static inline ssize_t os_pread(int fd, void* buf, size_t count, int64_t offset) {
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) {
+        return -1;
+    }
+    return _read(fd, buf, (unsigned int) count);
+}
+
+static inline ssize_t os_pwrite(int fd, const void* buf, size_t count, int64_t offset) {
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) {
+        return -1;
+    }
+    return _write(fd, buf, (unsigned int) count);
+}
+
+#define os_fsync _commit
+
 #else
 
 #define os_mkdir mkdir
+#define os_pread pread
+#define os_pwrite pwrite
+#define os_fsync fsync
 
 #endif // _WIN32
 
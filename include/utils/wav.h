@@ -0,0 +1,49 @@
+/*
+ * SPDX-FileCopyrightText: 2026 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/**
+ * @brief Writer for 16-bit PCM WAV files
+ */
+typedef struct {
+    FILE*    file;
+    int      channels;
+    /* Number of frames written so far, a frame contains one sample per channel */
+    uint32_t frames;
+    /* Set after a write error, nothing more is appended to the file */
+    bool     failed;
+} wav_writer_t;
+
+
+/**
+ * @brief Create a WAV file, the header is completed when the file is closed.
+ *
+ * @returns 0 on success, -1 on error
+ */
+int wav_open(wav_writer_t* wav, const char* path, int sample_rate, int channels);
+
+
+/**
+ * @brief Append interleaved 16-bit samples to the file.
+ *
+ * @param frames Number of frames in `samples`
+ */
+void wav_write(wav_writer_t* wav, const int16_t* samples, uint32_t frames);
+
+
+/**
+ * @brief Complete the WAV header and close the file.
+ *
+ * @returns 0 on success, -1 if any write failed
+ */
+int wav_close(wav_writer_t* wav);
@@ -0,0 +1,71 @@
+# SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+#
+# SPDX-License-Identifier: Apache-2.0
+
+# Inspect a disk delta created with --cf-delta/--tf-delta, or merge it into its base image.
+#
+# Usage: disk_delta.py info <delta>
+#        disk_delta.py merge <image> <delta> [<output>]
+
+import os
+import shutil
+import struct
+import sys
+
+MAGIC = b"ZEALCOW1"
+HEADER = struct.Struct("<8sIIQ")
+
+
+def load_delta(path):
+    with open(path, "rb") as f:
+        magic, sector_size, count, base_size = HEADER.unpack(f.read(HEADER.size))
+        if magic != MAGIC:
+            sys.exit(f"{path} is not a disk delta")
+        total_sectors = (base_size + sector_size - 1) // sector_size
+        if count > total_sectors:
+            sys.exit(f"{path} has an invalid sector count")
+        # The table follows the header sector, with room for all the sectors of the base image
+        f.seek(sector_size)
+        raw = f.read(count * 4)
+        if len(raw) != count * 4:
+            sys.exit(f"{path} is truncated")
+        table = struct.unpack(f"<{count}I", raw)
+        if any(sector >= total_sectors for sector in table):
+            sys.exit(f"{path} has an invalid sector table")
+    table_sectors = (total_sectors * 4 + sector_size - 1) // sector_size
+    return sector_size, base_size, table, 1 + table_sectors
+
+
+def info(delta):
+    sector_size, base_size, table, _ = load_delta(delta)
+    print(f"Base image size: {base_size} bytes")
+    print(f"Modified sectors: {len(table)} ({len(table) * sector_size} bytes)")
+    if table:
+        print(f"Sector range: {min(table)}-{max(table)}")
+
+
+def merge(image, delta, output=None):
+    sector_size, base_size, table, data_start = load_delta(delta)
+    if os.path.getsize(image) != base_size:
+        sys.exit(f"{delta} was made for an image of {base_size} bytes")
+    if output is not None:
+        shutil.copyfile(image, output)
+        image = output
+
+    with open(delta, "rb") as src, open(image, "r+b") as dst:
+        for slot, sector in enumerate(table):
+            src.seek((data_start + slot) * sector_size)
+            data = src.read(sector_size)
+            dst.seek(sector * sector_size)
+            # The last sector of the image may be incomplete
+            dst.write(data[:max(0, base_size - sector * sector_size)])
+    print(f"Merged {len(table)} sectors into {image}")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) == 3 and sys.argv[1] == "info":
+        info(sys.argv[2])
+    elif len(sys.argv) in (4, 5) and sys.argv[1] == "merge":
+        merge(*sys.argv[2:])
+    else:
+        sys.exit("Usage: disk_delta.py info <delta> | merge <image> <delta> [<output>]")
@@ -15,11 +15,26 @@
 #include "hw/zvb/zvb.h"
 #include "utils/paths.h"
 #include "utils/log.h"
+#include "utils/frameskip.h"
+#include "hw/compactflash.h"
+#include "hw/hostfs.h"
 #include "raylib.h"
 
 config_t config ={
     .audio = {
         .volume = 100,
+        .sync = true,
+    },
+
+    .video = {
+        .frameskip = FRAMESKIP_AUTO,
+    },
+
+    .storage = {
+        .cf_sync = CF_SYNC_IDLE,
+        .cf_sync_period = 1000,
+        .hostfs_cache = HOSTFS_CACHE_WATCH,
+        .disk_durability = DISK_DURABILITY_FLUSH,
     },
 
     .arguments = {
@@ -60,7 +75,13 @@ void config_debug(void)
     log_printf("=== command line ===\n");
     log_printf("  config_path: %s\n", config.arguments.config_path);
     log_printf(" rom_filename: %s\n", config.arguments.rom_filename);
+    log_printf(" rom_readonly: %s\n", config.arguments.rom_readonly ? "True" : "False");
+    log_printf("eeprom_volatile: %s\n", config.arguments.eeprom_volatile ? "True" : "False");
     log_printf("  hostfs_path: %s\n", config.arguments.hostfs_path);
+    log_printf("hostfs_overlay: %s\n", config.arguments.hostfs_overlay ? "True" : "False");
+    log_printf("     cf_delta: %s\n", config.arguments.cf_delta);
+    log_printf("     tf_delta: %s\n", config.arguments.tf_delta);
+    log_printf("discard_disks: %s\n", config.arguments.discard_disks ? "True" : "False");
     log_printf("     map_file: %s\n", config.arguments.map_file);
     log_printf("debug_enabled: %s\n", config.debugger.enabled == DEBUGGER_STATE_ARG ? "True" : "False");
     log_printf("    headless: %s\n", config.arguments.headless ? "True" : "False");
@@ -72,6 +93,18 @@ void config_debug(void)
     log_printf("\n");
     log_printf("=== audio ===\n");
     log_printf(" volume: %d\n", config.audio.volume);
+    log_printf("   sync: %s\n", config.audio.sync ? "True" : "False");
+
+    log_printf("\n");
+    log_printf("=== video ===\n");
+    log_printf("frameskip: %d\n", config.video.frameskip);
+
+    log_printf("\n");
+    log_printf("=== storage ===\n");
+    log_printf("       cf_sync: %d\n", config.storage.cf_sync);
+    log_printf("cf_sync_period: %d\n", config.storage.cf_sync_period);
+    log_printf("  hostfs_cache: %d\n", config.storage.hostfs_cache);
+    log_printf("disk_durability: %d\n", config.storage.disk_durability);
 
     log_printf("\n");
     log_printf("=== debugger ===\n");
@@ -101,16 +134,29 @@ int usage(const char* progname)
     log_printf("  -c, --config <file>                Zeal Config\n");
     log_printf("  -s, --save <file>                  Save * arguments to Zeal Config\n");
     log_printf("  -r, --rom <file>                   * Load ROM file\n");
+    log_printf("  -R, --rom-readonly                 Never write the flash modifications back to the ROM file\n");
     log_printf("  -u, --uprog <file>[,<addr>]        Load user program in romdisk at hex address\n");
     log_printf("  -e, --eeprom <file>                Load EEPROM file\n");
+    log_printf("  -E, --eeprom-volatile              Never write the EEPROM modifications back to its file\n");
     log_printf("  -t, --tf <file>                    Load TF/SDcard file\n");
+    log_printf("  -C, --cf <file>                    Load CompactFlash file\n");
+    log_printf("  -d, --cf-delta <file>              Keep the CompactFlash modifications in a delta file,\n");
+    log_printf("                                     the CompactFlash image itself is only read\n");
+    log_printf("  -T, --tf-delta <file>              Same as -d, for the TF/SDcard image\n");
+    log_printf("  -D, --discard-disks                Discard the CompactFlash and TF/SDcard modifications at exit\n");
     log_printf("  -H, --hostfs <path>                Set host filesystem path\n");
+    log_printf("  -O, --hostfs-overlay               Keep the host filesystem modifications in memory\n");
+    log_printf("  -X, --hostfs-export <path>         Same as -O, export the modifications at exit to a\n");
+    log_printf("                                     directory, or to a tar archive if <path> ends with .tar\n");
     log_printf("  -m, --map <file>                   Load memory map file (for debugging)\n");
     log_printf("  -g, --debug                        * Enable debug mode\n");
     log_printf("  -b, --brk <addr/sym>[,<addr/sym>]  * Set breakpoints on boot (requires debug mode)\n");
     log_printf("  -n, --headless [<tstates>]         Run without GUI (no window/input/rendering)\n");
     log_printf("                                     Optional tstates number to execute can be given\n");
     log_printf("  -q, --no-reset                     Exit emulator when a reset is detected\n");
+    log_printf("  -f, --frameskip <auto|off|N>       * Skip frames when the host is too slow (default: auto)\n");
+    log_printf("  -w, --wav <file>                   Render the audio to a WAV file from emulated time\n");
+    log_printf("  -W, --wav-sums <file>              Write a checksum of each emulated second of audio (requires -w)\n");
     log_printf("  -v, --verbose                      Verbose console output; repeat for more detail (-vvv)\n");
     log_printf("  -h, --help                         Show this help message\n");
     log_printf("\n");
@@ -127,16 +173,26 @@ int parse_command_args(int argc, char* argv[])
     struct option long_options[] = {
         {   "config", required_argument, 0, 'c'},
         {      "rom", required_argument, 0, 'r'},
+        { "rom-readonly",     no_argument, 0, 'R'},
         {   "eeprom", required_argument, 0, 'e'},
+        { "eeprom-volatile",  no_argument, 0, 'E'},
         {       "tf", required_argument, 0, 't'},
         {    "uprog", required_argument, 0, 'u'},
         {       "cf", required_argument, 0, 'C'},
         {   "hostfs", required_argument, 0, 'H'},
+        { "cf-delta", required_argument, 0, 'd'},
+        { "tf-delta", required_argument, 0, 'T'},
+        { "discard-disks",    no_argument, 0, 'D'},
+        { "hostfs-overlay",   no_argument, 0, 'O'},
+        { "hostfs-export", required_argument, 0, 'X'},
         {      "map", required_argument, 0, 'm'},
         {    "debug", required_argument, 0, 'g'},
         {      "brk", required_argument, 0, 'b'},
         { "headless", optional_argument, 0, 'n'},
         { "no-reset",       no_argument, 0, 'q'},
+        {"frameskip", required_argument, 0, 'f'},
+        {      "wav", required_argument, 0, 'w'},
+        { "wav-sums", required_argument, 0, 'W'},
         {     "save",       no_argument, 0, 's'},
         {  "verbose",       no_argument, 0, 'v'},
         {    "help",        no_argument, 0, 'h'},
@@ -146,7 +202,7 @@ int parse_command_args(int argc, char* argv[])
     const char* config_path = get_config_path();
     if(config_path) config.arguments.config_path = config_path;
 
-    while ((opt = getopt_long(argc, argv, "c:r:e:u:t:C:H:m:b:n::qsgvh", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "c:r:Re:Eu:t:C:d:T:DH:OX:m:b:n::f:w:W:qsgvh", long_options, NULL)) != -1) {
         switch (opt) {
             case 'c':
                 config.arguments.config_path = optarg;
@@ -157,9 +213,15 @@ int parse_command_args(int argc, char* argv[])
             case 'r':
                 config.arguments.rom_filename = optarg;
                 break;
+            case 'R':
+                config.arguments.rom_readonly = true;
+                break;
             case 'e':
                 config.arguments.eeprom_filename = optarg;
                 break;
+            case 'E':
+                config.arguments.eeprom_volatile = true;
+                break;
             case 't':
                 config.arguments.tf_filename = optarg;
                 break;
@@ -169,11 +231,26 @@ int parse_command_args(int argc, char* argv[])
             case 'C':
                 config.arguments.cf_filename = optarg;
                 break;
+            case 'd':
+                config.arguments.cf_delta = optarg;
+                break;
+            case 'T':
+                config.arguments.tf_delta = optarg;
+                break;
+            case 'D':
+                config.arguments.discard_disks = true;
+                break;
             case 'h':
                 return usage(argv[0]);
             case 'H':
                 config.arguments.hostfs_path = optarg;
                 break;
+            case 'X':
+                config.arguments.hostfs_export = optarg;
+                /* fall-through */
+            case 'O':
+                config.arguments.hostfs_overlay = true;
+                break;
             case 'm':
                 config.arguments.map_file = optarg;
                 break;
@@ -216,6 +293,20 @@ int parse_command_args(int argc, char* argv[])
             case 'q':
                 config.arguments.no_reset = true;
                 break;
+            case 'f':
+                config.arguments.frameskip = optarg;
+                config.video.frameskip = frameskip_parse(optarg);
+                if (config.video.frameskip == FRAMESKIP_INVALID) {
+                    log_err_printf("[CONFIG] Invalid frameskip mode %s, expected auto, off or a number of frames\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'w':
+                config.arguments.wav_filename = optarg;
+                break;
+            case 'W':
+                config.arguments.wav_sums_filename = optarg;
+                break;
             case '?':
                 // Handle unknown options
                 log_err_printf("[CONFIG] Unknown option -%c\n", optopt);
@@ -223,6 +314,11 @@ int parse_command_args(int argc, char* argv[])
         }
     }
 
+    if (config.arguments.wav_sums_filename != NULL && config.arguments.wav_filename == NULL) {
+        log_err_printf("[CONFIG] -W/--wav-sums requires -w/--wav\n");
+        return 1;
+    }
+
     return 0;
 }
 
@@ -246,6 +342,30 @@ void config_parse_file(const char* file) {
     } else if (config.audio.volume > 100) {
         config.audio.volume = 100;
     }
+    config.audio.sync = rini_get_config_value_fallback(config.ini, "AUDIO_SYNC", 1);
+
+    if(config.arguments.frameskip == NULL) {
+        config.video.frameskip = rini_get_config_value_fallback(config.ini, "VIDEO_FRAMESKIP", FRAMESKIP_AUTO);
+        if (config.video.frameskip < FRAMESKIP_AUTO) {
+            config.video.frameskip = FRAMESKIP_AUTO;
+        } else if (config.video.frameskip > FRAMESKIP_MAX) {
+            config.video.frameskip = FRAMESKIP_MAX;
+        }
+    }
+
+    config.storage.cf_sync = rini_get_config_value_fallback(config.ini, "CF_SYNC", CF_SYNC_IDLE);
+    if (config.storage.cf_sync < CF_SYNC_EXIT || config.storage.cf_sync > CF_SYNC_PERIODIC) {
+        config.storage.cf_sync = CF_SYNC_IDLE;
+    }
+    config.storage.cf_sync_period = rini_get_config_value_fallback(config.ini, "CF_SYNC_PERIOD", 1000);
+    config.storage.hostfs_cache = rini_get_config_value_fallback(config.ini, "HOSTFS_CACHE", HOSTFS_CACHE_WATCH);
+    if (config.storage.hostfs_cache < HOSTFS_CACHE_OFF || config.storage.hostfs_cache > HOSTFS_CACHE_WATCH) {
+        config.storage.hostfs_cache = HOSTFS_CACHE_WATCH;
+    }
+    config.storage.disk_durability = rini_get_config_value_fallback(config.ini, "DISK_DURABILITY", DISK_DURABILITY_FLUSH);
+    if (config.storage.disk_durability < DISK_DURABILITY_NONE || config.storage.disk_durability > DISK_DURABILITY_FLUSH) {
+        config.storage.disk_durability = DISK_DURABILITY_FLUSH;
+    }
 
     config.window.width = rini_get_config_value_fallback(config.ini, "WIN_WIDTH", -1);
     config.window.height = rini_get_config_value_fallback(config.ini, "WIN_HEIGHT", -1);
@@ -258,6 +378,10 @@ void config_parse_file(const char* file) {
     config.debugger.x = rini_get_config_value_fallback(config.ini, "DEBUG_POS_X", -1);
     config.debugger.y = rini_get_config_value_fallback(config.ini, "DEBUG_POS_Y", -1);
     config.debugger.hex_upper = rini_get_config_value_fallback(config.ini, "DEBUG_HEX_UPPER", 1);
+    config.debugger.vram_refresh_rate = rini_get_config_value_fallback(config.ini, "DEBUG_VRAM_REFRESH", 10);
+    if (config.debugger.vram_refresh_rate < 0) {
+        config.debugger.vram_refresh_rate = 0;
+    }
 }
 
 int config_save(void)
@@ -286,6 +410,21 @@ int config_save(void)
     config_window_t *window = &config.window;
     rini_set_config_comment_line(&ini, "Audio");
     rini_set_config_value(&ini, "AUDIO_VOLUME", config.audio.volume, "Master Volume Percent");
+    rini_set_config_value(&ini, "AUDIO_SYNC", config.audio.sync, "Adjust the audio rate to the emulation speed");
+
+    /* Only persist the frame skipping given as an argument if requested */
+    int frameskip = config.video.frameskip;
+    if(config.arguments.frameskip != NULL && !config.arguments.config_save) {
+        frameskip = rini_get_config_value_fallback(config.ini, "VIDEO_FRAMESKIP", FRAMESKIP_AUTO);
+    }
+    rini_set_config_comment_line(&ini, "Video");
+    rini_set_config_value(&ini, "VIDEO_FRAMESKIP", frameskip, "Frame skipping: -1 auto, 0 off, N frames");
+
+    rini_set_config_comment_line(&ini, "Storage");
+    rini_set_config_value(&ini, "CF_SYNC", config.storage.cf_sync, "CompactFlash write back: 0 on exit, 1 when idle, 2 periodic");
+    rini_set_config_value(&ini, "CF_SYNC_PERIOD", config.storage.cf_sync_period, "CompactFlash write back delay in ms");
+    rini_set_config_value(&ini, "HOSTFS_CACHE", config.storage.hostfs_cache, "HostFS path cache: 0 off, 1 on, 2 on and watch host changes");
+    rini_set_config_value(&ini, "DISK_DURABILITY", config.storage.disk_durability, "CF/TF sync to disk: 0 never, 1 on each write back, 2 on FLUSH CACHE and exit");
 
     rini_set_config_comment_line(&ini, "Main Window");
     rini_set_config_value(&ini, "WIN_WIDTH", window->width, "Width");
@@ -303,6 +442,7 @@ int config_save(void)
     rini_set_config_value(&ini, "DEBUG_POS_Y", debugger->y, "Y Position");
     rini_set_config_value(&ini, "DEBUG_ENABLED", debugger->config_enabled, "Debug Enabled");
     rini_set_config_value(&ini, "DEBUG_HEX_UPPER", debugger->hex_upper, "Use Upper Hex");
+    rini_set_config_value(&ini, "DEBUG_VRAM_REFRESH", debugger->vram_refresh_rate, "VRAM views refresh rate in Hz, 0 for every frame");
 
     dbg_ui_config_save(&ini);
 #endif // CONFIG_ENABLE_DEBUGGER
@@ -0,0 +1,93 @@
+/*
+ * SPDX-FileCopyrightText: 2026 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "raylib.h"
+#include "utils/frameskip.h"
+#include "utils/helpers.h"
+
+
+void frameskip_init(frameskip_t* fs, int mode, double period)
+{
+    memset(fs, 0, sizeof(*fs));
+    fs->mode = MIN(mode, FRAMESKIP_MAX);
+    fs->period = period;
+}
+
+
+bool frameskip_next(frameskip_t* fs)
+{
+    const double now = GetTime();
+    bool skip = false;
+
+    if (fs->last_time == 0) {
+        /* First frame, nothing to measure yet */
+        fs->last_time = now;
+        fs->stats_start = now;
+        return false;
+    }
+
+    if (fs->mode != FRAMESKIP_OFF) {
+        /* Accumulate how late the host is compared to real-time. When the host keeps up, rendered
+         * frames are paced by Raylib so the lag stays around 0 and no frame is skipped, in any mode.
+         * A fixed mode only bounds the number of consecutive skipped frames. Limit the lag to prevent
+         * a long pause (window moved, breakpoint, ...) from skipping many frames afterwards. */
+        const int limit = fs->mode == FRAMESKIP_AUTO ? FRAMESKIP_MAX : fs->mode;
+        fs->lag += (now - fs->last_time) - fs->period;
+        if (fs->lag < 0) {
+            fs->lag = 0;
+        } else if (fs->lag > limit * fs->period) {
+            fs->lag = limit * fs->period;
+        }
+        skip = fs->lag >= fs->period && fs->consecutive < limit;
+    }
+    fs->last_time = now;
+
+    if (skip) {
+        fs->consecutive++;
+        fs->stats_count++;
+    } else {
+        fs->consecutive = 0;
+    }
+
+    if (now - fs->stats_start >= 1.0) {
+        fs->skipped_per_sec = fs->stats_count;
+        fs->stats_count = 0;
+        fs->stats_start = now;
+    }
+
+    return skip;
+}
+
+
+int frameskip_parse(const char* str)
+{
+    if (str == NULL || strcmp(str, "auto") == 0) {
+        return FRAMESKIP_AUTO;
+    } else if (strcmp(str, "off") == 0) {
+        return FRAMESKIP_OFF;
+    }
+
+    char* endptr = NULL;
+    const long value = strtol(str, &endptr, 10);
+    if (endptr == str || *endptr != '\0' || value < FRAMESKIP_AUTO) {
+        return FRAMESKIP_INVALID;
+    }
+    return (int) MIN(value, FRAMESKIP_MAX);
+}
+
+
+const char* frameskip_describe(const frameskip_t* fs)
+{
+    if (fs->mode == FRAMESKIP_OFF) {
+        return "Frameskip: off";
+    } else if (fs->mode == FRAMESKIP_AUTO) {
+        return TextFormat("Frameskip: auto (%d/s)", fs->skipped_per_sec);
+    }
+    return TextFormat("Frameskip: %d (%d/s)", fs->mode, fs->skipped_per_sec);
+}
@@ -0,0 +1,51 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Required for MAP_ANONYMOUS */
+#ifndef _DEFAULT_SOURCE
+    #define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+#ifdef _WIN32
+    /* Only this file needs it, no conflict with Raylib */
+    #include <windows.h>
+#elif !defined(__EMSCRIPTEN__)
+    #include <sys/mman.h>
+#endif
+#include "utils/pages.h"
+
+
+void* pages_alloc(size_t size)
+{
+#ifdef __EMSCRIPTEN__
+    /* No virtual memory to take advantage of */
+    return calloc(1, size);
+#elif defined(_WIN32)
+    /* The committed pages are only backed by memory once touched, and read as zeroes */
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void* pages = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return pages == MAP_FAILED ? NULL : pages;
+#endif
+}
+
+
+void pages_free(void* pages, size_t size)
+{
+    if (pages == NULL) {
+        return;
+    }
+#ifdef __EMSCRIPTEN__
+    (void) size;
+    free(pages);
+#elif defined(_WIN32)
+    (void) size;
+    VirtualFree(pages, 0, MEM_RELEASE);
+#else
+    munmap(pages, size);
+#endif
+}
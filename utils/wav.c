@@ -0,0 +1,115 @@
+/*
+ * SPDX-FileCopyrightText: 2026 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+#include <string.h>
+#include "utils/wav.h"
+#include "utils/log.h"
+
+#define WAV_HEADER_SIZE     44
+#define WAV_RIFF_SIZE_OFF   4
+#define WAV_DATA_SIZE_OFF   40
+
+
+static void wav_put16(uint8_t* dst, uint16_t value)
+{
+    dst[0] = value & 0xff;
+    dst[1] = value >> 8;
+}
+
+
+static void wav_put32(uint8_t* dst, uint32_t value)
+{
+    wav_put16(dst, value & 0xffff);
+    wav_put16(dst + 2, value >> 16);
+}
+
+
+int wav_open(wav_writer_t* wav, const char* path, int sample_rate, int channels)
+{
+    const int block_align = channels * sizeof(int16_t);
+    uint8_t header[WAV_HEADER_SIZE];
+
+    memset(wav, 0, sizeof(*wav));
+    wav->file = fopen(path, "wb");
+    if (wav->file == NULL) {
+        log_perror("[WAV] Could not create file");
+        return -1;
+    }
+    wav->channels = channels;
+
+    /* The RIFF and data sizes are filled when closing the file */
+    memcpy(header, "RIFF\0\0\0\0WAVEfmt ", 16);
+    wav_put32(header + 16, 16);
+    wav_put16(header + 20, 1);  // PCM
+    wav_put16(header + 22, channels);
+    wav_put32(header + 24, sample_rate);
+    wav_put32(header + 28, sample_rate * block_align);
+    wav_put16(header + 32, block_align);
+    wav_put16(header + 34, 16);
+    memcpy(header + 36, "data\0\0\0\0", 8);
+
+    if (fwrite(header, sizeof(header), 1, wav->file) != 1) {
+        log_perror("[WAV] Could not write header");
+        fclose(wav->file);
+        wav->file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+void wav_write(wav_writer_t* wav, const int16_t* samples, uint32_t frames)
+{
+    uint8_t buffer[1024];
+    const uint32_t count = frames * wav->channels;
+
+    if (wav->file == NULL || wav->failed) {
+        return;
+    }
+
+    /* WAV files are little-endian, no matter the host */
+    for (uint32_t i = 0; i < count; ) {
+        uint32_t size = 0;
+        for (; i < count && size < sizeof(buffer); i++, size += 2) {
+            wav_put16(buffer + size, (uint16_t) samples[i]);
+        }
+        if (fwrite(buffer, 1, size, wav->file) != size) {
+            log_perror("[WAV] Could not write samples, the file will be incomplete");
+            wav->failed = true;
+            return;
+        }
+    }
+    wav->frames += frames;
+}
+
+
+int wav_close(wav_writer_t* wav)
+{
+    uint8_t size[4];
+    int err = wav->failed ? -1 : 0;
+
+    if (wav->file == NULL) {
+        return err;
+    }
+
+    /* Even after an error, the header describes the samples that could be written */
+    const uint32_t data_size = wav->frames * wav->channels * sizeof(int16_t);
+    wav_put32(size, data_size + WAV_HEADER_SIZE - 8);
+    if (fseek(wav->file, WAV_RIFF_SIZE_OFF, SEEK_SET) != 0 || fwrite(size, sizeof(size), 1, wav->file) != 1) {
+        err = -1;
+    }
+    wav_put32(size, data_size);
+    if (fseek(wav->file, WAV_DATA_SIZE_OFF, SEEK_SET) != 0 || fwrite(size, sizeof(size), 1, wav->file) != 1) {
+        err = -1;
+    }
+    if (fclose(wav->file) != 0 || err != 0) {
+        log_perror("[WAV] Could not complete the file");
+        err = -1;
+    }
+    wav->file = NULL;
+    return err;
+}